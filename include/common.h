@@ -100,7 +100,7 @@ extern "C" {
 #endif
 
 #if __has_attribute(aligned)
-#define cyn_aligned(S) __attribute__((packed, (S)))
+#define cyn_aligned(S) __attribute__((aligned(S)))
 #else
 #warning "Align attribute not available, attempt to use cyn_aligned will cause an error"
 #define cyn_aligned(S) struct cyn_aligned_not_supported_on_current_platform{};
@@ -237,7 +237,7 @@ attr(always_inline)
 static void Token_setFloat(Token* token, f64 flt)
 {
     token->value.f = flt;
-    token->value.kind = vkdInt;
+    token->value.kind = vkdFloat;
 }
 
 attr(always_inline)
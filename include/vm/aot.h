@@ -0,0 +1,99 @@
+/**
+ * Copyright (c) 2022 Suilteam, Carter Mbotho
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the MIT license. See LICENSE for details.
+ *
+ * @author Carter
+ * @date 2022-12-29
+ */
+
+#pragma once
+
+#include <vm/vm.h>
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * The function translated ahead of time from the code of a virtual machine,
+ * it runs the virtual machine from the instruction pointed to by `ip`
+ */
+typedef void (*VirtualMachineAotEntry)(VM *vm);
+
+/**
+ * Translates the given bytecode into a C program (\see VM_aot_main). The
+ * virtual machine registers are kept in local variables and jumps become
+ * `goto`s. Instructions that call into the host (`ncall`, `alloc`, `puts`...)
+ * and `ret` are executed by \see VM_step.
+ *
+ * @param code the bytecode to translate
+ * @param fp the file to write the C program to
+ * @param mem the size of the ram committed for the translated program
+ * @param max the size of the ram reserved for the translated program
+ * @param ss the stack size of the translated program
+ */
+void VM_aot_translate(Code *code, FILE *fp, u64 mem, u64 max, u32 ss);
+
+/**
+ * The entry point of programs generated by \see VM_aot_translate. Loads
+ * the given code image onto a virtual machine and runs \param entry.
+ *
+ * @param image the bytecode embedded in the program
+ * @param size the size of \param image
+ * @param entry the translated code
+ * @param mem the size of the ram committed for the virtual machine
+ * @param max the size of the ram reserved for the virtual machine
+ * @param ss the size of the stack
+ * @param argc the number of arguments to pass to the virtual machine
+ * @param argv the arguments passed to the virtual machine
+ *
+ * @return the exit code of the program
+ */
+int VM_aot_main(const u8 *image, u32 size, VirtualMachineAotEntry entry,
+                u64 mem, u64 max, u32 ss, int argc, char *argv[]);
+
+/**
+ * Invoked by translated code when `ip` points to an instruction that
+ * translated code cannot jump to, always aborts the virtual machine
+ *
+ * @param vm
+ */
+attr(noreturn)
+void VM_aot_bad_target(VM *vm);
+
+/**
+ * Stack operations of translated code, \param sp is the local holding
+ * the stack pointer (\see VM_pushn, VM_popn)
+ */
+attr(always_inline)
+static void VM_aot_push(VM *vm, u64 *sp, i64 value)
+{
+    if ((*sp - 8) <= vm->ram.sb)
+        VM_memory_grow_stack(vm, *sp - 8);
+
+    *sp -= 8;
+    *((i64 *) MEM(vm, *sp)) = value;
+}
+
+attr(always_inline)
+static Value *VM_aot_popn(VM *vm, u64 *sp, u8 count)
+{
+    Value *ret;
+    u32 size = count << 3;
+    if ((*sp + size) > vm->ram.size)
+        VM_abort(vm, "VM stack memory underflow - escapes virtual machine memory");
+
+    ret = (Value *) MEM(vm, *sp);
+    *sp += size;
+    return ret;
+}
+
+#define VM_aot_pop(V, SP) (VM_aot_popn((V), (SP), 1)->i)
+
+#ifdef __cplusplus
+}
+#endif
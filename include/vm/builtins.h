@@ -17,44 +17,52 @@
 extern "C" {
 #endif
 
-#define VM_NATIVE_OS_FUNCS(XX, UU)     \
-    XX(Read,        read)                    \
-    XX(Write,       write)                   \
-    XX(Open,        open)                    \
-    XX(Close,       close)                   \
-    XX(Stat,        stat)                    \
-    XX(Fstat,       fstat)                   \
-    XX(Lstat,       lstat)                   \
-    XX(Poll,        poll)                    \
-    XX(Lseek,       lseek)                   \
-    XX(Pipe,        pipe)                    \
-    XX(Select,      select)                  \
-    XX(Dup,         dup)                     \
-    XX(Dup2,        dup2)                    \
-    XX(Getpid,      getpid)                  \
-    XX(Sendfile,    sendfile)                \
-    XX(Socket,      socket)                  \
-    XX(Connect,     connect)                 \
-    XX(Accept,      accept)                  \
-    XX(Sendto,      sendto)                  \
-    XX(Recvfrom,    recvfrom)                \
-    XX(Shutdown,    shutdown)                \
-    XX(Bind,        bind)                    \
-    XX(Listen,      listen)                  \
-    XX(Getsockname, getsockname)             \
-    XX(Getpeername, getpeername)             \
-    XX(Fcntl,       fcntl)                   \
-    UU(Flock,       flock)                   \
-    UU(Fsync,       fsync)                   \
-    UU(Fetcwd,      getcwd)                  \
-    UU(Chdir,       chdir)                   \
-    UU(Rename,      rename)                  \
-    UU(Mkdir,       mkdir)                   \
-    UU(Rmdir,       rmdir)                   \
-    UU(Creat,       creat)                   \
-    UU(Link,        link)                    \
-    UU(Unlink,      unlink)                  \
-    UU(Symlink,     symlink)                 \
+/**
+ * Lists the builtin native calls along with their signature, the
+ * smallest and largest number of arguments they take.
+ *
+ * @param XX a macro invoked with the name, the native function
+ * and the signature of implemented builtins
+ * @param UU same as \param XX but for builtins not implemented yet
+ */
+#define VM_NATIVE_OS_FUNCS(XX, UU)              \
+    XX(Read,        read,        3, 3)      \
+    XX(Write,       write,       3, 3)      \
+    XX(Open,        open,        2, 3)      \
+    XX(Close,       close,       1, 1)      \
+    XX(Stat,        stat,        2, 2)      \
+    XX(Fstat,       fstat,       2, 2)      \
+    XX(Lstat,       lstat,       2, 2)      \
+    XX(Poll,        poll,        3, 3)      \
+    XX(Lseek,       lseek,       3, 3)      \
+    XX(Pipe,        pipe,        1, 1)      \
+    XX(Select,      select,      5, 5)      \
+    XX(Dup,         dup,         1, 1)      \
+    XX(Dup2,        dup2,        2, 2)      \
+    XX(Getpid,      getpid,      0, 0)      \
+    XX(Sendfile,    sendfile,    4, 4)      \
+    XX(Socket,      socket,      3, 3)      \
+    XX(Connect,     connect,     3, 3)      \
+    XX(Accept,      accept,      3, 3)      \
+    XX(Sendto,      sendto,      6, 6)      \
+    XX(Recvfrom,    recvfrom,    6, 6)      \
+    XX(Shutdown,    shutdown,    2, 2)      \
+    XX(Bind,        bind,        3, 3)      \
+    XX(Listen,      listen,      2, 2)      \
+    XX(Getsockname, getsockname, 3, 3)      \
+    XX(Getpeername, getpeername, 3, 3)      \
+    XX(Fcntl,       fcntl,       2, 3)      \
+    UU(Flock,       flock,       2, 2)      \
+    UU(Fsync,       fsync,       1, 1)      \
+    UU(Fetcwd,      getcwd,      2, 2)      \
+    UU(Chdir,       chdir,       1, 1)      \
+    UU(Rename,      rename,      2, 2)      \
+    UU(Mkdir,       mkdir,       2, 2)      \
+    UU(Rmdir,       rmdir,       1, 1)      \
+    UU(Creat,       creat,       2, 2)      \
+    UU(Link,        link,        2, 2)      \
+    UU(Unlink,      unlink,      1, 1)      \
+    UU(Symlink,     symlink,     2, 2)      \
 
 
 typedef enum VirtualMachineBuiltinNativeCall {
@@ -68,6 +76,37 @@ typedef enum VirtualMachineBuiltinNativeCall {
 
 extern NativeCall vmNativeBuiltinCallTbl[];
 
+/**
+ * The number of arguments taken by a builtin native call
+ *
+ * @property min the smallest number of arguments
+ *
+ * @property max the largest number of arguments, which is the number
+ * of arguments passed by `ncallr`
+ */
+typedef struct VirtualMachineNativeSignature {
+    u8 min;
+    u8 max;
+} NativeSignature;
+
+/**
+ * The signature of every builtin (\see VM_NATIVE_OS_FUNCS), builtins do
+ * not check the number of arguments they are given. Calls checked at load
+ * time run unchecked, the others are checked by \see VM_native_check.
+ */
+extern const NativeSignature vmNativeBuiltinSignatureTbl[];
+
+/**
+ * Aborts the virtual machine unless native function \param id takes
+ * \param nargs arguments. Native functions other than builtins are not
+ * checked.
+ *
+ * @param vm the virtual machine calling the native function
+ * @param id the builtin id or the address of the native function
+ * @param nargs the number of arguments passed to the function
+ */
+void VM_native_check(VM *vm, uptr id, u32 nargs);
+
 #define bncWRITE(FD, BUF, S, R)         \
     cPUSH(FD, dW),                      \
     cPUSH(BUF,dQ),                      \
@@ -103,6 +103,13 @@ extern "C" {
  */
 #define xIMb(T, N) .ibm = 0, .rmd = amImm, .ims = SZ_(T), .ii = (N)
 
+/**
+ * Macro used to encode a floating point immediate value for argument B,
+ * \param T is either `f32` or `f64` and must match the instruction mode
+ */
+#define fIMb(T, N) .ibm = 0, .rmd = amImm, .ims = SZ_(T),  \
+    .iu = ((SZ_(T) == szWord)? f2uX((N), 32) : f2uX((N), 64))
+
 #define sIMb(S, N) .ibm = 0, .rmd = amImm, .ims = (S), .ii = (N)
 
 /**
@@ -155,6 +162,35 @@ extern "C" {
  */
 #define cRET(A, ...)      ((Instruction) { B0_(Ret,   2),  A, ##__VA_ARGS__})
 
+/**
+ * `fcall` instruction used to call a function with a fixed frame. The
+ * frame only holds the return address and the caller's `bp`, the arguments
+ * pushed by the caller start at `[bp, fargs]` and the function knows how
+ * many there are.
+ *
+ * @param A the instruction offset of the function
+ *
+ * @example
+ * ```
+ * cFCALL(xIMa(i32, -120))  // fcall -120
+ * ```
+ */
+#define cFCALL(A, ...)    ((Instruction) { B0_(Fcall, 2),  A, ##__VA_ARGS__})
+
+/**
+ * `fret` instruction used to return from a function called with `fcall`.
+ * Drops the frame and the arguments pushed by the caller, values are
+ * returned in registers.
+ *
+ * @param A the number of arguments taken by the function
+ *
+ * @example
+ * ```
+ * cFRET(xIMa(u8, 2))       // fret 2
+ * ```
+ */
+#define cFRET(A, ...)     ((Instruction) { B0_(Fret,  2),  A, ##__VA_ARGS__})
+
 /**
  * `jmp` instruction used to unconditionally jump to an instruction offset. Takes
  * the offset to jump to, which can be a negative number to jump backwards
@@ -278,6 +314,7 @@ extern "C" {
 #define cPUTS(A, ...)     ((Instruction) { B0_(Puts,  2),  A, ##__VA_ARGS__})
 #define cPUTC(A, ...)     ((Instruction) { B0_(Putc,  2),  A, ##__VA_ARGS__})
 #define cNCALL(A, ...)    ((Instruction) { B0_(Ncall, 2),  A, ##__VA_ARGS__})
+#define cNCALLR(A, ...)   ((Instruction) { B0_(Ncallr, 2), A, ##__VA_ARGS__})
 #define cDLLOC(A, ...)    ((Instruction) { B0_(Dlloc, 2),  A, ##__VA_ARGS__})
 
 
@@ -299,6 +336,146 @@ extern "C" {
 #define cCMP(A, B, ...)     ((Instruction) { B0_(Cmp,   3),  A, B, ##__VA_ARGS__})
 #define cCALL(A, B, ...)    ((Instruction) { B0_(Call,  3),  A, B, ##__VA_ARGS__})
 #define cALLOC(A, B, ...)   ((Instruction) { B0_(Alloc, 3),  A, B, ##__VA_ARGS__})
+#define cRALLOC(A, B, ...)  ((Instruction) { B0_(Ralloc,3),  A, B, ##__VA_ARGS__})
+
+/**
+ * Arena instructions, `anew` creates an arena with chunks of B bytes into
+ * argument A. `aalloc` allocates B bytes from arena A into `r0`
+ * (\see VM_ARENA_ADDR), `areset` releases everything allocated from
+ * arena A at once and `afree` releases the arena too.
+ *
+ * @example
+ * ```
+ * cANEW(rRa(r1), xIMb(u16, 4096))     // anew r1 4096
+ * cAALLOC(rRa(r1), xIMb(u8, 24))      // aalloc r1 24
+ * cARESET(rRa(r1))                    // areset r1
+ * ```
+ */
+#define cANEW(A, B, ...)    ((Instruction) { B0_(Anew,  3),  A, B, ##__VA_ARGS__})
+#define cAALLOC(A, B, ...)  ((Instruction) { B0_(Aalloc,3),  A, B, ##__VA_ARGS__})
+#define cARESET(A, ...)     ((Instruction) { B0_(Areset,2),  A, ##__VA_ARGS__})
+#define cAFREE(A, ...)      ((Instruction) { B0_(Afree, 2),  A, ##__VA_ARGS__})
+
+/**
+ * Floating point instructions, `.w` works on `f32` values and `.q` on `f64`
+ * values. `fcmp` sets the flags like `cmp`, none when either value is NaN.
+ * `fcvt` converts a value of the other float width, `itof` converts a
+ * 64-bit integer and `ftoi` truncates a float into a 64-bit integer.
+ *
+ * @example
+ * ```
+ * cFADD(rRa(r0), rRb(r1), dQ)           // fadd.q r0 r1
+ * cFMUL(rRa(r0), fIMb(f32, 2.5), dW)    // fmul.w r0 2.5
+ * cFCVT(rRa(r0), rRb(r1), dW)           // fcvt.w r0 r1
+ * ```
+ */
+#define cFADD(A, B, ...)    ((Instruction) { B0_(Fadd,  3),  A, B, ##__VA_ARGS__})
+#define cFSUB(A, B, ...)    ((Instruction) { B0_(Fsub,  3),  A, B, ##__VA_ARGS__})
+#define cFMUL(A, B, ...)    ((Instruction) { B0_(Fmul,  3),  A, B, ##__VA_ARGS__})
+#define cFDIV(A, B, ...)    ((Instruction) { B0_(Fdiv,  3),  A, B, ##__VA_ARGS__})
+#define cFCMP(A, B, ...)    ((Instruction) { B0_(Fcmp,  3),  A, B, ##__VA_ARGS__})
+#define cFCVT(A, B, ...)    ((Instruction) { B0_(Fcvt,  3),  A, B, ##__VA_ARGS__})
+#define cITOF(A, B, ...)    ((Instruction) { B0_(Itof,  3),  A, B, ##__VA_ARGS__})
+#define cFTOI(A, B, ...)    ((Instruction) { B0_(Ftoi,  3),  A, B, ##__VA_ARGS__})
+
+/**
+ * Vector instructions work on the 128-bit vector registers `v0-v7`, the mode
+ * gives the width of the lanes. Argument A is a vector register, except for
+ * `vred` which sums the lanes of the vector register B into register A. `vst`
+ * stores vector A to the memory referenced by B, `vdup` copies B to every lane
+ * and `vshuf` selects the lanes of A using the lanes of B.
+ *
+ * @example
+ * ```
+ * cVLD(rRa(0), mRb(r1), dB)             // vld.b v0 [r1]
+ * cVADD(rRa(0), rRb(1), dB)             // vadd.b v0 v1
+ * cVRED(rRa(r0), rRb(0), dB)            // vred.b r0 v0
+ * ```
+ */
+#define cVLD(A, B, ...)     ((Instruction) { B0_(Vld,   3),  A, B, ##__VA_ARGS__})
+#define cVST(A, B, ...)     ((Instruction) { B0_(Vst,   3),  A, B, ##__VA_ARGS__})
+#define cVDUP(A, B, ...)    ((Instruction) { B0_(Vdup,  3),  A, B, ##__VA_ARGS__})
+#define cVADD(A, B, ...)    ((Instruction) { B0_(Vadd,  3),  A, B, ##__VA_ARGS__})
+#define cVSUB(A, B, ...)    ((Instruction) { B0_(Vsub,  3),  A, B, ##__VA_ARGS__})
+#define cVMUL(A, B, ...)    ((Instruction) { B0_(Vmul,  3),  A, B, ##__VA_ARGS__})
+#define cVAND(A, B, ...)    ((Instruction) { B0_(Vand,  3),  A, B, ##__VA_ARGS__})
+#define cVOR(A, B, ...)     ((Instruction) { B0_(Vor,   3),  A, B, ##__VA_ARGS__})
+#define cVXOR(A, B, ...)    ((Instruction) { B0_(Vxor,  3),  A, B, ##__VA_ARGS__})
+#define cVCEQ(A, B, ...)    ((Instruction) { B0_(Vceq,  3),  A, B, ##__VA_ARGS__})
+#define cVCGT(A, B, ...)    ((Instruction) { B0_(Vcgt,  3),  A, B, ##__VA_ARGS__})
+#define cVSHUF(A, B, ...)   ((Instruction) { B0_(Vshuf, 3),  A, B, ##__VA_ARGS__})
+#define cVRED(A, B, ...)    ((Instruction) { B0_(Vred,  3),  A, B, ##__VA_ARGS__})
+
+/**
+ * Bulk memory instructions work on the number of bytes in `r0` (\see VM_BULK_LEN)
+ * starting at the address given by argument A. `mcpy` copies from address B,
+ * the ranges may overlap. `mset` fills with byte B. `mcmp` compares with the
+ * bytes at address B and sets the flags like `cmp`. `mchr` scans for byte B
+ * up to the end of memory and sets `r0` to its offset, or to the number of
+ * bytes scanned when it is not found.
+ *
+ * @example
+ * ```
+ * cMCPY(rRa(r1), rRb(r2))           // mcpy r1 r2
+ * cMSET(rRa(r1), xIMb(u8, 0))       // mset r1 0
+ * cMCHR(rRa(r1), xIMb(u8, '\n'))    // mchr r1 '\n'
+ * ```
+ */
+#define cMCPY(A, B, ...)    ((Instruction) { B0_(Mcpy,  3),  A, B, ##__VA_ARGS__})
+#define cMSET(A, B, ...)    ((Instruction) { B0_(Mset,  3),  A, B, ##__VA_ARGS__})
+#define cMCMP(A, B, ...)    ((Instruction) { B0_(Mcmp,  3),  A, B, ##__VA_ARGS__})
+#define cMCHR(A, B, ...)    ((Instruction) { B0_(Mchr,  3),  A, B, ##__VA_ARGS__})
+
+/**
+ * Compare and branch instructions jump to the target \param T, an offset
+ * relative to the instruction, if argument A compares to argument B as
+ * given by the instruction. The flags are left as they are, the `u` variants
+ * compare unsigned values in the width of the mode. `djnz` decrements
+ * argument A and jumps unless it became 0.
+ *
+ * @example
+ * ```
+ * cJLT(rRa(r1), xIMb(u8, 10), -12)    // jlt r1 10 -12
+ * cJEQ(rRa(r1), rRb(r2), 20, dB)      // jeq.b r1 r2 20
+ * cDJNZ(rRa(r2), -8)                  // djnz r2 -8
+ * ```
+ */
+#define cJEQ(A, B, T, ...)  ((Instruction) { B0_(Jeq,   3),  A, B, .itg = (T), ##__VA_ARGS__})
+#define cJNE(A, B, T, ...)  ((Instruction) { B0_(Jne,   3),  A, B, .itg = (T), ##__VA_ARGS__})
+#define cJLT(A, B, T, ...)  ((Instruction) { B0_(Jlt,   3),  A, B, .itg = (T), ##__VA_ARGS__})
+#define cJLE(A, B, T, ...)  ((Instruction) { B0_(Jle,   3),  A, B, .itg = (T), ##__VA_ARGS__})
+#define cJGT(A, B, T, ...)  ((Instruction) { B0_(Jgt,   3),  A, B, .itg = (T), ##__VA_ARGS__})
+#define cJGE(A, B, T, ...)  ((Instruction) { B0_(Jge,   3),  A, B, .itg = (T), ##__VA_ARGS__})
+#define cJLTU(A, B, T, ...) ((Instruction) { B0_(Jltu,  3),  A, B, .itg = (T), ##__VA_ARGS__})
+#define cJLEU(A, B, T, ...) ((Instruction) { B0_(Jleu,  3),  A, B, .itg = (T), ##__VA_ARGS__})
+#define cJGTU(A, B, T, ...) ((Instruction) { B0_(Jgtu,  3),  A, B, .itg = (T), ##__VA_ARGS__})
+#define cJGEU(A, B, T, ...) ((Instruction) { B0_(Jgeu,  3),  A, B, .itg = (T), ##__VA_ARGS__})
+#define cDJNZ(A, T, ...)    ((Instruction) { B0_(Djnz,  2),  A, .itg = (T), ##__VA_ARGS__})
+
+/**
+ * Conditional instructions testing the flags set by `cmp`, `fcmp` or `mcmp`.
+ * `set<cc>` writes 1 to argument A if the condition holds and 0 otherwise,
+ * `csel<cc>` moves argument B into argument A only if it holds.
+ *
+ * @example
+ * ```
+ * cCMP(rRa(r1), rRb(r2))              // cmp r1 r2
+ * cSETLT(rRa(r0))                     // setlt r0
+ * cCSELGT(rRa(r1), rRb(r2))           // cselgt r1 r2
+ * ```
+ */
+#define cSETEQ(A, ...)      ((Instruction) { B0_(Seteq,  2), A, ##__VA_ARGS__})
+#define cSETNE(A, ...)      ((Instruction) { B0_(Setne,  2), A, ##__VA_ARGS__})
+#define cSETLT(A, ...)      ((Instruction) { B0_(Setlt,  2), A, ##__VA_ARGS__})
+#define cSETLE(A, ...)      ((Instruction) { B0_(Setle,  2), A, ##__VA_ARGS__})
+#define cSETGT(A, ...)      ((Instruction) { B0_(Setgt,  2), A, ##__VA_ARGS__})
+#define cSETGE(A, ...)      ((Instruction) { B0_(Setge,  2), A, ##__VA_ARGS__})
+#define cCSELEQ(A, B, ...)  ((Instruction) { B0_(Cseleq, 3), A, B, ##__VA_ARGS__})
+#define cCSELNE(A, B, ...)  ((Instruction) { B0_(Cselne, 3), A, B, ##__VA_ARGS__})
+#define cCSELLT(A, B, ...)  ((Instruction) { B0_(Csellt, 3), A, B, ##__VA_ARGS__})
+#define cCSELLE(A, B, ...)  ((Instruction) { B0_(Cselle, 3), A, B, ##__VA_ARGS__})
+#define cCSELGT(A, B, ...)  ((Instruction) { B0_(Cselgt, 3), A, B, ##__VA_ARGS__})
+#define cCSELGE(A, B, ...)  ((Instruction) { B0_(Cselge, 3), A, B, ##__VA_ARGS__})
 
 #ifdef __cplusplus
 }
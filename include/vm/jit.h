@@ -0,0 +1,104 @@
+/**
+ * Copyright (c) 2022 Suilteam, Carter Mbotho
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the MIT license. See LICENSE for details.
+ *
+ * @author Carter
+ * @date 2022-12-27
+ */
+
+#pragma once
+
+#include <vm/vm.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef CYN_VM_TRACE_THRESHOLD
+// Number of backward jumps to a loop header before its loop is traced
+#define CYN_VM_TRACE_THRESHOLD 64
+#endif
+
+#ifndef CYN_VM_TRACE_MAX
+// Maximum number of instructions in a trace
+#define CYN_VM_TRACE_MAX 512
+#endif
+
+#ifndef CYN_VM_TRACE_CACHE
+// Size of the memory holding compiled traces
+#define CYN_VM_TRACE_CACHE (1024 * 1024)
+#endif
+
+/**
+ * Translates the decoded instructions of the given virtual machine into
+ * native code. Only x86-64 hosts are supported, compiling fails on other
+ * hosts or when the build disables the JIT (`CYN_VM_JIT`).
+ *
+ * Instructions are translated one at a time using fixed templates. The
+ * stack, base and first general purpose registers are kept in host
+ * registers and written back to \property regs before the interpreter
+ * (\see VM_step) executes the instructions that are not translated, like
+ * `ret` and the instructions calling into the host.
+ *
+ * @param vm the virtual machine whose code should be compiled, the code
+ * must have been decoded (\see VM_decode)
+ *
+ * @return true if the code was compiled, false otherwise
+ */
+bool VM_jit_compile(VM *vm);
+
+/**
+ * Run the compiled code of the given virtual machine starting at the
+ * instruction pointed to by the `ip` register until the machine halts
+ *
+ * @param vm a virtual machine whose code was compiled (\see VM_jit_compile)
+ */
+void VM_jit_run(VM *vm);
+
+/**
+ * Release the native code compiled for the given virtual machine,
+ * including compiled traces
+ *
+ * @param vm
+ */
+void VM_jit_release(VM *vm);
+
+/**
+ * Enables tracing of hot loops while interpreting. The interpreter reports
+ * backward jumps (\see VM_jit_trace) and once a loop header is reached
+ * `CYN_VM_TRACE_THRESHOLD` times, one iteration of the loop is recorded
+ * and compiled to native code. Compiled traces guard the path they were
+ * recorded on and return to the interpreter when it is left.
+ *
+ * @param vm the virtual machine whose loops should be traced
+ *
+ * @return true if tracing was enabled
+ */
+bool VM_jit_trace_init(VM *vm);
+
+/**
+ * Invoked by the interpreter when a backward jump to \param header is
+ * taken. Counts the loop and records, compiles or runs its trace.
+ *
+ * @param vm
+ * @param header the target of a backward jump
+ *
+ * @return the next instruction to interpret
+ */
+DecodedInstruction *VM_jit_trace(VM *vm, DecodedInstruction *header);
+
+/**
+ * Invoked when a memory access faults (\see CYN_VM_GUARD_PAGES), writes
+ * the registers kept in host registers back to the virtual machine if the
+ * fault is in compiled code so that they are reported when aborting.
+ *
+ * @param vm
+ * @param ctx the `ucontext_t` of the signal handler
+ */
+void VM_jit_fault_context(VM *vm, void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,273 @@
+/**
+ * Copyright (c) 2022 Suilteam, Carter Mbotho
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the MIT license. See LICENSE for details.
+ *
+ * @author Carter
+ * @date 2023-01-02
+ */
+
+#pragma once
+
+#include <vm/vm.h>
+
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Lane-wise kernels of the vector instructions (\see VM_OP_VECTOR). The
+ * destination is always a vector register, sources might also be virtual
+ * machine memory which is not aligned, so every access is unaligned. Lanes
+ * wrap around on overflow, comparisons set every bit of lanes that match.
+ */
+
+// Applies OP to every pair of lanes of \param A and \param B
+#define VM_VECTOR_MAP(D, A, B, BITS, OP)                                        \
+    do {                                                                        \
+        u##BITS vmA[128 / (BITS)], vmB[128 / (BITS)];                           \
+        memcpy(vmA, (A), sizeof(vmA));                                          \
+        memcpy(vmB, (B), sizeof(vmB));                                          \
+        for (u32 vmI = 0; vmI < 128 / (BITS); vmI++)                            \
+            vmA[vmI] = OP(vmA[vmI], vmB[vmI], BITS);                            \
+        memcpy((D), vmA, sizeof(vmA));                                          \
+    } while (0)
+
+#define VM_VECTOR_LANES(D, A, B, M, OP)                                         \
+    switch (M) {                                                                \
+        case szByte:  VM_VECTOR_MAP(D, A, B, 8, OP); break;                     \
+        case szShort: VM_VECTOR_MAP(D, A, B, 16, OP); break;                    \
+        case szWord:  VM_VECTOR_MAP(D, A, B, 32, OP); break;                    \
+        default:      VM_VECTOR_MAP(D, A, B, 64, OP); break;                    \
+    }
+
+#define VM_LANE_ADD(A, B, BITS) ((A) + (B))
+#define VM_LANE_SUB(A, B, BITS) ((A) - (B))
+#define VM_LANE_MUL(A, B, BITS) ((u64) (A) * (B))
+#define VM_LANE_AND(A, B, BITS) ((A) & (B))
+#define VM_LANE_OR(A, B, BITS)  ((A) | (B))
+#define VM_LANE_XOR(A, B, BITS) ((A) ^ (B))
+#define VM_LANE_CEQ(A, B, BITS) (((A) == (B))? (u##BITS) ~0ull : 0)
+#define VM_LANE_CGT(A, B, BITS) ((((i##BITS) (A)) > ((i##BITS) (B)))? (u##BITS) ~0ull : 0)
+
+#ifdef __SSE2__
+#define VM_VECTOR_SSE2(D, A, B, FN)                                             \
+    _mm_storeu_si128((__m128i *) (D), FN(_mm_loadu_si128((const __m128i *) (A)), \
+                                         _mm_loadu_si128((const __m128i *) (B))))
+#endif
+
+/**
+ * Sets every lane of vector \param dst to \param value truncated to the
+ * width of the lanes
+ */
+attr(always_inline)
+static void VM_vdup(void *dst, u64 value, Mode mode)
+{
+#ifdef __SSE2__
+    __m128i v;
+    switch (mode) {
+        case szByte:  v = _mm_set1_epi8((i8) value); break;
+        case szShort: v = _mm_set1_epi16((i16) value); break;
+        case szWord:  v = _mm_set1_epi32((i32) value); break;
+        default:      v = _mm_set1_epi64x((i64) value); break;
+    }
+    _mm_storeu_si128((__m128i *) dst, v);
+#else
+    VectorReg v;
+    switch (mode) {
+        case szByte:  for (u32 i = 0; i < 16; i++) v.b[i] = value; break;
+        case szShort: for (u32 i = 0; i < 8; i++) v.s[i] = value; break;
+        case szWord:  for (u32 i = 0; i < 4; i++) v.w[i] = value; break;
+        default:      v.q[0] = v.q[1] = value; break;
+    }
+    memcpy(dst, &v, sizeof(v));
+#endif
+}
+
+attr(always_inline)
+static void VM_vadd(void *dst, const void *a, const void *b, Mode mode)
+{
+#ifdef __SSE2__
+    switch (mode) {
+        case szByte:  VM_VECTOR_SSE2(dst, a, b, _mm_add_epi8); break;
+        case szShort: VM_VECTOR_SSE2(dst, a, b, _mm_add_epi16); break;
+        case szWord:  VM_VECTOR_SSE2(dst, a, b, _mm_add_epi32); break;
+        default:      VM_VECTOR_SSE2(dst, a, b, _mm_add_epi64); break;
+    }
+#else
+    VM_VECTOR_LANES(dst, a, b, mode, VM_LANE_ADD);
+#endif
+}
+
+attr(always_inline)
+static void VM_vsub(void *dst, const void *a, const void *b, Mode mode)
+{
+#ifdef __SSE2__
+    switch (mode) {
+        case szByte:  VM_VECTOR_SSE2(dst, a, b, _mm_sub_epi8); break;
+        case szShort: VM_VECTOR_SSE2(dst, a, b, _mm_sub_epi16); break;
+        case szWord:  VM_VECTOR_SSE2(dst, a, b, _mm_sub_epi32); break;
+        default:      VM_VECTOR_SSE2(dst, a, b, _mm_sub_epi64); break;
+    }
+#else
+    VM_VECTOR_LANES(dst, a, b, mode, VM_LANE_SUB);
+#endif
+}
+
+// SSE2 only multiplies 16-bit lanes, the others are left to the compiler
+attr(always_inline)
+static void VM_vmul(void *dst, const void *a, const void *b, Mode mode)
+{
+#ifdef __SSE2__
+    if (mode == szShort) {
+        VM_VECTOR_SSE2(dst, a, b, _mm_mullo_epi16);
+        return;
+    }
+#endif
+    VM_VECTOR_LANES(dst, a, b, mode, VM_LANE_MUL);
+}
+
+// bitwise operations do not depend on the width of the lanes
+attr(always_inline)
+static void VM_vand(void *dst, const void *a, const void *b, Mode mode)
+{
+#ifdef __SSE2__
+    VM_VECTOR_SSE2(dst, a, b, _mm_and_si128);
+#else
+    VM_VECTOR_MAP(dst, a, b, 64, VM_LANE_AND);
+#endif
+}
+
+attr(always_inline)
+static void VM_vor(void *dst, const void *a, const void *b, Mode mode)
+{
+#ifdef __SSE2__
+    VM_VECTOR_SSE2(dst, a, b, _mm_or_si128);
+#else
+    VM_VECTOR_MAP(dst, a, b, 64, VM_LANE_OR);
+#endif
+}
+
+attr(always_inline)
+static void VM_vxor(void *dst, const void *a, const void *b, Mode mode)
+{
+#ifdef __SSE2__
+    VM_VECTOR_SSE2(dst, a, b, _mm_xor_si128);
+#else
+    VM_VECTOR_MAP(dst, a, b, 64, VM_LANE_XOR);
+#endif
+}
+
+attr(always_inline)
+static void VM_vceq(void *dst, const void *a, const void *b, Mode mode)
+{
+#ifdef __SSE2__
+    switch (mode) {
+        case szByte:  VM_VECTOR_SSE2(dst, a, b, _mm_cmpeq_epi8); return;
+        case szShort: VM_VECTOR_SSE2(dst, a, b, _mm_cmpeq_epi16); return;
+        case szWord:  VM_VECTOR_SSE2(dst, a, b, _mm_cmpeq_epi32); return;
+        default:      break;
+    }
+#endif
+    VM_VECTOR_LANES(dst, a, b, mode, VM_LANE_CEQ);
+}
+
+// lanes are compared as signed integers
+attr(always_inline)
+static void VM_vcgt(void *dst, const void *a, const void *b, Mode mode)
+{
+#ifdef __SSE2__
+    switch (mode) {
+        case szByte:  VM_VECTOR_SSE2(dst, a, b, _mm_cmpgt_epi8); return;
+        case szShort: VM_VECTOR_SSE2(dst, a, b, _mm_cmpgt_epi16); return;
+        case szWord:  VM_VECTOR_SSE2(dst, a, b, _mm_cmpgt_epi32); return;
+        default:      break;
+    }
+#endif
+    VM_VECTOR_LANES(dst, a, b, mode, VM_LANE_CGT);
+}
+
+// Lane `i` of the result is the lane of \param a selected by lane `i` of
+// \param b, taken modulo the number of lanes
+#define VM_VECTOR_SHUFFLE(D, A, B, BITS)                                        \
+    do {                                                                        \
+        u##BITS vmA[128 / (BITS)], vmB[128 / (BITS)];                           \
+        memcpy(vmA, (A), sizeof(vmA));                                          \
+        memcpy(vmB, (B), sizeof(vmB));                                          \
+        for (u32 vmI = 0; vmI < 128 / (BITS); vmI++)                            \
+            vmB[vmI] = vmA[vmB[vmI] % (128 / (BITS))];                          \
+        memcpy((D), vmB, sizeof(vmB));                                          \
+    } while (0)
+
+attr(always_inline)
+static void VM_vshuf(void *dst, const void *a, const void *b, Mode mode)
+{
+    switch (mode) {
+        case szByte:
+#ifdef __SSSE3__
+            _mm_storeu_si128((__m128i *) dst,
+                             _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) a),
+                                              _mm_and_si128(_mm_loadu_si128((const __m128i *) b),
+                                                            _mm_set1_epi8(0x0F))));
+#else
+            VM_VECTOR_SHUFFLE(dst, a, b, 8);
+#endif
+            break;
+        case szShort: VM_VECTOR_SHUFFLE(dst, a, b, 16); break;
+        case szWord:  VM_VECTOR_SHUFFLE(dst, a, b, 32); break;
+        default:      VM_VECTOR_SHUFFLE(dst, a, b, 64); break;
+    }
+}
+
+/**
+ * Sums the lanes of vector \param src as unsigned integers
+ */
+attr(always_inline)
+static u64 VM_vred(const void *src, Mode mode)
+{
+    VectorReg v;
+    u64 sum = 0;
+
+#ifdef __SSE2__
+    if (mode == szByte) {
+        __m128i s = _mm_sad_epu8(_mm_loadu_si128((const __m128i *) src), _mm_setzero_si128());
+        _mm_storeu_si128((__m128i *) &v, s);
+        return v.q[0] + v.q[1];
+    }
+#endif
+    memcpy(&v, src, sizeof(v));
+    switch (mode) {
+        case szByte:  for (u32 i = 0; i < 16; i++) sum += v.b[i]; break;
+        case szShort: for (u32 i = 0; i < 8; i++) sum += v.s[i]; break;
+        case szWord:  for (u32 i = 0; i < 4; i++) sum += v.w[i]; break;
+        default:      sum = v.q[0] + v.q[1]; break;
+    }
+    return sum;
+}
+
+#undef VM_VECTOR_SHUFFLE
+#ifdef __SSE2__
+#undef VM_VECTOR_SSE2
+#endif
+#undef VM_LANE_CGT
+#undef VM_LANE_CEQ
+#undef VM_LANE_XOR
+#undef VM_LANE_OR
+#undef VM_LANE_AND
+#undef VM_LANE_MUL
+#undef VM_LANE_SUB
+#undef VM_LANE_ADD
+
+#ifdef __cplusplus
+}
+#endif
@@ -11,6 +11,7 @@
 #pragma once
 
 #include <common.h>
+#include <stream.h>
 #include <tree.h>
 #include <vector.h>
 #include <vm/value.h>
@@ -34,6 +35,10 @@ extern "C" {
 #define CYN_VM_DEFAULT_MS (1024 * 1024)         // default memory size 1MB
 #endif
 
+#ifndef CYN_VM_DEFAULT_MX
+#define CYN_VM_DEFAULT_MX (64 * 1024 * 1024)    // default memory reserved 64MB
+#endif
+
 #ifndef CYN_VM_ALIGNMENT
 #define CYN_VM_ALIGNMENT sizeof(uptr)
 #endif
@@ -43,7 +48,11 @@ extern "C" {
 #endif
 
 #ifndef CYN_VM_HEAP_DEFAULT_NHBS
-#define CYN_VM_HEAP_DEFAULT_NHBS (256)
+#define CYN_VM_HEAP_DEFAULT_NHBS 256
+#endif
+
+#ifndef CYN_VM_HEAP_DEFAULT_ALLOCATOR
+#define CYN_VM_HEAP_DEFAULT_ALLOCATOR halTlsf
 #endif
 
 #ifdef CYN_VM_BUILD_DEBUG
@@ -57,7 +66,8 @@ extern "C" {
  * @property osz This represents the size of the instruction excluding
  * the size of the immediate value for instructions that takes on
  *
- * @property osc the op code for the instruction
+ * @property osc the op code for the instruction, only the low 6 bits are
+ * encoded with the size. Op codes from 64 are preceded by \see VM_OP_EXT
  *
  * @property ra instruction argument A. Should be a memory reference or
  * register if the instruction takes 2 arguments.
@@ -85,12 +95,15 @@ extern "C" {
  * @property iea is effective addressing. Used if the second instruction
  * argument is a memory reference and the immediate value is an offset
  * into the reference
+ *
+ * @property itg the target of compare and branch instructions, relative to
+ * the instruction. It is encoded after the immediate value (\see VM_OP_BRANCH)
  */
 typedef struct VirtualMachineInstruction {
     union {
         struct attr(packed) {
-            u8 osz:2;
-            u8 opc:6;
+            u16 osz:2;
+            u16 opc:7;
         };
         u8 b1;
     };
@@ -117,12 +130,16 @@ typedef struct VirtualMachineInstruction {
         u64 iu;
         i64 ii;
     };
+    i32 itg;
 } attr(packed) Instruction;
 
 /**
  * A list of registers supported by the virtual machine
  *
- * `r0-r5` these are general purpose registers
+ * `r0-r11` these are general purpose registers. `r0-r5` are caller saved,
+ * they pass arguments to and values from native calls (\see VM_NCALLR_REGS)
+ * and any call may change them. `r6-r11` are caller saved as well, the code
+ * generator uses them as scratch registers while evaluating expressions.
  * `sp` the stack pointer register
  * `ip` the instruction pointer register
  * `bp` the base pointer register
@@ -135,6 +152,12 @@ typedef enum VirtualMachineRegister {
     r3,
     r4,
     r5,
+    r6,
+    r7,
+    r8,
+    r9,
+    r10,
+    r11,
     sp,
     ip,
     bp,
@@ -148,6 +171,24 @@ typedef enum VirtualMachineRegister {
  */
 extern const char *vmRegisterNameTbl[];
 
+/**
+ * The number of vector registers `v0-v7`, they are separate from the
+ * general purpose registers and only used by vector instructions
+ * (\see VM_OP_VECTOR)
+ */
+#define VM_VREG_COUNT 8
+
+/**
+ * A vector register, 128 bits holding lanes of 8, 16, 32 or 64 bits as
+ * given by the mode of the vector instruction using it
+ */
+typedef union attr(aligned, 16) VirtualMachineVectorRegister {
+    u8  b[16];
+    u16 s[8];
+    u32 w[4];
+    u64 q[2];
+} VectorReg;
+
 /**
  * Data modes supported by the virtual machine
  */
@@ -194,7 +235,7 @@ typedef union {
     f32 f;
     u32 u;
     u8  _b[4];
-} FltU32;
+} Flt32;
 
 /**
  * A union used to copy u64 bytes to f64 type and
@@ -216,7 +257,7 @@ typedef union {
  * A macro used to copy bytes from a unsigned value \param V of size
  * \param B to a float type of the same size
  */
-#define u2fX(V, B) ({ CynPST(Flt, B) LineVAR(u) = {.u = (V)}; LineVAR(u).v; })
+#define u2fX(V, B) ({ CynPST(Flt, B) LineVAR(u) = {.u = (V)}; LineVAR(u).f; })
 
 /**
  * A list of supported virtual machine argument mode
@@ -277,7 +318,7 @@ typedef enum VirtualMachineFlags {
     XX(Puti,  puti, 1)                 \
     XX(Puts,  puts, 1)                 \
     XX(Putc,  putc, 1)                 \
-    XX(Mcpy,  mcpy, 1)                 \
+    XX(Mcpy,  mcpy, 2)                 \
     XX(Dlloc, dlloc, 1)                \
     XX(Ncall, ncall, 1)                \
                                        \
@@ -298,6 +339,68 @@ typedef enum VirtualMachineFlags {
     XX(Mod,   mod, 2)                  \
     XX(Cmp,   cmp, 2)                  \
     XX(Alloc, alloc, 2)                \
+                                       \
+    XX(Fcall, fcall, 1)                \
+    XX(Fret,  fret, 1)                 \
+    XX(Ncallr,ncallr, 1)               \
+                                       \
+    XX(Fadd,  fadd, 2)                 \
+    XX(Fsub,  fsub, 2)                 \
+    XX(Fmul,  fmul, 2)                 \
+    XX(Fdiv,  fdiv, 2)                 \
+    XX(Fcmp,  fcmp, 2)                 \
+    XX(Fcvt,  fcvt, 2)                 \
+    XX(Itof,  itof, 2)                 \
+    XX(Ftoi,  ftoi, 2)                 \
+                                       \
+    XX(Vld,   vld, 2)                  \
+    XX(Vst,   vst, 2)                  \
+    XX(Vdup,  vdup, 2)                 \
+    XX(Vadd,  vadd, 2)                 \
+    XX(Vsub,  vsub, 2)                 \
+    XX(Vmul,  vmul, 2)                 \
+    XX(Vand,  vand, 2)                 \
+    XX(Vor,   vor, 2)                  \
+    XX(Vxor,  vxor, 2)                 \
+    XX(Vceq,  vceq, 2)                 \
+    XX(Vcgt,  vcgt, 2)                 \
+    XX(Vshuf, vshuf, 2)                \
+    XX(Vred,  vred, 2)                 \
+                                       \
+    XX(Mset,  mset, 2)                 \
+    XX(Mcmp,  mcmp, 2)                 \
+    XX(Mchr,  mchr, 2)                 \
+                                       \
+    XX(Jeq,   jeq, 2)                  \
+    XX(Jne,   jne, 2)                  \
+    XX(Jlt,   jlt, 2)                  \
+    XX(Jle,   jle, 2)                  \
+    XX(Jgt,   jgt, 2)                  \
+    XX(Jge,   jge, 2)                  \
+    XX(Jltu,  jltu, 2)                 \
+    XX(Jleu,  jleu, 2)                 \
+    XX(Jgtu,  jgtu, 2)                 \
+    XX(Jgeu,  jgeu, 2)                 \
+    XX(Djnz,  djnz, 1)                 \
+                                       \
+    XX(Seteq, seteq, 1)                \
+    XX(Setne, setne, 1)                \
+    XX(Setlt, setlt, 1)                \
+    XX(Setle, setle, 1)                \
+    XX(Setgt, setgt, 1)                \
+    XX(Setge, setge, 1)                \
+    XX(Cseleq, cseleq, 2)              \
+    XX(Cselne, cselne, 2)              \
+    XX(Csellt, csellt, 2)              \
+    XX(Cselle, cselle, 2)              \
+    XX(Cselgt, cselgt, 2)              \
+    XX(Cselge, cselge, 2)              \
+                                       \
+    XX(Anew,  anew, 2)                 \
+    XX(Aalloc,aalloc, 2)               \
+    XX(Areset,areset, 1)               \
+    XX(Afree, afree, 1)                \
+    XX(Ralloc,ralloc, 2)               \
 
 /**
  * An enum listing all the op codes define above (\see VM_OP_CODES)
@@ -310,6 +413,60 @@ typedef enum VirtualMachineOpCodes {
     opcCOUNT
 } OpCodes;
 
+/**
+ * Op codes from \see VM_OP_PAGE do not fit the 6 bits encoded with the size
+ * of the instruction, they are preceded by this byte which has a size of 0
+ * and is otherwise invalid
+ */
+#define VM_OP_PAGE 64
+#define VM_OP_EXT  0x04
+
+/**
+ * Checks whether op code \param OPC writes to its first argument
+ */
+#define VM_OP_WRITES_A(OPC)                                     \
+    (((OPC) >= opAlloca && (OPC) <= opAlloc && (OPC) != opCmp) || \
+     ((OPC) >= opNot && (OPC) <= opDec) || (OPC) == opPop ||      \
+     (VM_OP_FLOAT(OPC) && (OPC) != opFcmp) || (OPC) == opVred || \
+     (OPC) == opDjnz || VM_OP_SELECT(OPC) || (OPC) == opAnew || \
+     (OPC) == opRalloc)
+
+/**
+ * Checks whether op code \param OPC is a floating point operation. These
+ * only support the `.w` (`f32`) and `.q` (`f64`) modes.
+ */
+#define VM_OP_FLOAT(OPC) ((OPC) >= opFadd && (OPC) <= opFtoi)
+
+/**
+ * Checks whether op code \param OPC is a vector operation, the mode gives
+ * the width of the lanes of its vector registers (\see VectorReg)
+ */
+#define VM_OP_VECTOR(OPC) ((OPC) >= opVld && (OPC) <= opVred)
+
+/**
+ * Checks whether argument A, respectively argument B, of op code \param OPC
+ * names a vector register when it is a register. Memory references are
+ * always through general purpose registers.
+ */
+#define VM_OP_VECTOR_A(OPC) (VM_OP_VECTOR(OPC) && (OPC) != opVred)
+#define VM_OP_VECTOR_B(OPC) (VM_OP_VECTOR(OPC) && (OPC) != opVdup)
+
+/**
+ * Checks whether op code \param OPC is a compare and branch instruction.
+ * These compare argument A with argument B, or decrement argument A for
+ * `djnz`, and jump to their target (\see Instruction.itg) without
+ * changing the flags. Unsigned compares are made in the width of the mode.
+ */
+#define VM_OP_BRANCH(OPC) ((OPC) >= opJeq && (OPC) <= opDjnz)
+
+/**
+ * Checks whether op code \param OPC is a `set<cc>` or a `csel<cc>`
+ * instruction. These test the flags set by `cmp`, `fcmp` or `mcmp`, `set<cc>`
+ * writes 1 to argument A when the condition holds and 0 otherwise while
+ * `csel<cc>` moves argument B into argument A only when it holds.
+ */
+#define VM_OP_SELECT(OPC) ((OPC) >= opSeteq && (OPC) <= opCselge)
+
 typedef Pair(OpCodes, u8) OpCodeInfo;
 
 #ifdef CYN_VM_BUILD_TOOL
@@ -317,6 +474,7 @@ OpCodeInfo VM_get_opcode_for_instr_(const char *instr, u32 len);
 #define VM_get_opcode_for_instr(instr) VM_get_opcode_for_instr_((instr), strlen(instr))
 Register Vm_get_register_from_str_(const char *str, u32 len);
 #define Vm_get_register_from_str(str) Vm_get_register_from_str_((str), strlen(str))
+u8 Vm_get_vector_register_from_str_(const char *str, u32 len);
 #endif
 
 /**
@@ -348,6 +506,288 @@ typedef struct VirtualMachineCodeHeader {
     u8  code[0];
 } attr(packed) CodeHeader;
 
+/**
+ * A list of operand kinds resolved by the decoder (\see VM_decode)
+ *
+ * `okNone` the instruction does not take the argument
+ * `okReg` the argument is a register
+ * `okRegMem` the argument is a memory reference through a register, plus
+ * the effective address offset if any
+ * `okImm` the argument is an immediate value
+ * `okImmMem` the argument is a memory reference through an immediate address
+ */
+typedef enum VirtualMachineOperandKind {
+    okNone,
+    okReg,
+    okRegMem,
+    okImm,
+    okImmMem
+} OperandKind;
+
+/**
+ * The dispatch key of the pseudo instruction used to mark an instruction
+ * that was truncated by the end of code space
+ */
+#define VM_DECODE_TRAP  (opcCOUNT << 1)
+
+/**
+ * The dispatch key of the pseudo instruction used to mark instructions
+ * with an unknown op code
+ */
+#define VM_DECODE_UNKNOWN  ((opcCOUNT << 1) | 1)
+
+/**
+ * The dispatch key of instructions reading `ip` or writing `ip`, `sp`, `bp`
+ * or `flg` through an operand. The interpreter keeps these registers in
+ * locals, such instructions are executed by \see VM_step instead.
+ */
+#define VM_DECODE_STEP  ((opcCOUNT << 1) + 2)
+
+/**
+ * The dispatch keys of `ncall <imm>` and `ncallr <imm>` once the called
+ * native function has been resolved into \see VirtualMachine.natives.
+ * The number of arguments given to a builtin by `ncall` is checked when
+ * running, unless it is pushed right before the call, in which case it
+ * is checked when decoding (\see VM_FUSED_SEQUENCES).
+ */
+#define VM_DECODE_NCALL   ((opcCOUNT << 1) + 3)
+#define VM_DECODE_NCALLR  ((opcCOUNT << 1) + 4)
+
+/**
+ * Op codes whose handlers are specialized at compile time for every
+ * instruction mode and operand form (\see VM_BINARY_FORMS, VM_UNARY_FORMS)
+ *
+ * @param XX invoked for instructions taking 2 arguments
+ * @param YY invoked for instructions taking 1 argument
+ */
+#define VM_SPECIALIZED_OPS(XX, YY)      \
+    XX(Add)                             \
+    XX(Sub)                             \
+    XX(And)                             \
+    XX(Or)                              \
+    XX(Sar)                             \
+    XX(Sal)                             \
+    XX(Xor)                             \
+    XX(Bor)                             \
+    XX(Band)                            \
+    XX(Mul)                             \
+    XX(Div)                             \
+    XX(Mod)                             \
+    XX(Mov)                             \
+    XX(Cmp)                             \
+    XX(Jeq)                             \
+    XX(Jne)                             \
+    XX(Jlt)                             \
+    XX(Jle)                             \
+    XX(Jgt)                             \
+    XX(Jge)                             \
+    XX(Jltu)                            \
+    XX(Jleu)                            \
+    XX(Jgtu)                            \
+    XX(Jgeu)                            \
+    YY(Djnz)                            \
+    YY(Seteq)                           \
+    YY(Setne)                           \
+    YY(Setlt)                           \
+    YY(Setle)                           \
+    YY(Setgt)                           \
+    YY(Setge)                           \
+    XX(Cseleq)                          \
+    XX(Cselne)                          \
+    XX(Csellt)                          \
+    XX(Cselle)                          \
+    XX(Cselgt)                          \
+    XX(Cselge)                          \
+    YY(Not)                             \
+    YY(BNot)                            \
+    YY(Inc)                             \
+    YY(Dec)                             \
+    YY(Push)                            \
+    YY(Pop)                             \
+    YY(Jmp)                             \
+    YY(Jmpz)                            \
+    YY(Jmpnz)                           \
+    YY(Jmpg)                            \
+    YY(Jmps)
+
+typedef enum VirtualMachineSpecializedOps {
+#define XX(N) sop##N,
+    VM_SPECIALIZED_OPS(XX, XX)
+#undef XX
+    sopCOUNT
+} SpecializedOp;
+
+/**
+ * Operand forms of specialized instructions taking 2 arguments. Each
+ * form is listed as `XX(Name, A, B, S)` where A and B are the kinds of
+ * the arguments and S the kind of the argument whose mode is `ims`
+ *
+ * `R` register, `M` memory reference through a register (with the effective
+ * address offset), `I` immediate value
+ */
+#define VM_BINARY_FORMS(XX, ...)        \
+    XX(RR, R, R, R, ##__VA_ARGS__)      \
+    XX(RM, R, M, M, ##__VA_ARGS__)      \
+    XX(RI, R, I, I, ##__VA_ARGS__)      \
+    XX(MR, M, R, R, ##__VA_ARGS__)      \
+    XX(MM, M, M, M, ##__VA_ARGS__)      \
+    XX(MI, M, I, I, ##__VA_ARGS__)
+
+/**
+ * Operand forms of specialized instructions taking 1 argument
+ * (\see VM_BINARY_FORMS)
+ */
+#define VM_UNARY_FORMS(XX, ...)         \
+    XX(R, R, N, R, ##__VA_ARGS__)       \
+    XX(M, M, N, M, ##__VA_ARGS__)       \
+    XX(I, I, N, I, ##__VA_ARGS__)
+
+typedef enum VirtualMachineOperandForm {
+#define XX(F, ...) sf##F,
+    VM_BINARY_FORMS(XX)
+    VM_UNARY_FORMS(XX)
+#undef XX
+    sfCOUNT
+} OperandForm;
+
+/**
+ * Invokes \param XX for every instruction mode
+ */
+#define VM_MODES(XX, ...)               \
+    XX(szByte,  ##__VA_ARGS__)          \
+    XX(szShort, ##__VA_ARGS__)          \
+    XX(szWord,  ##__VA_ARGS__)          \
+    XX(szQuad,  ##__VA_ARGS__)
+
+/**
+ * Computes the dispatch key of the handler of specialized op code \param S
+ * for mode \param M and operand form \param F
+ */
+#define VM_SPEC_KEY(S, M, F) \
+    ((VM_DECODE_NCALLR + 1) + ((((S) << 2) | (M)) * sfCOUNT) + (F))
+
+/**
+ * Conditional jumps that get fused with a `cmp` instruction immediately
+ * preceding them into a single compare and branch superinstruction
+ */
+#define VM_FUSED_JUMPS(XX)              \
+    XX(Jmpz)                            \
+    XX(Jmpnz)                           \
+    XX(Jmpg)                            \
+    XX(Jmps)
+
+typedef enum VirtualMachineFusedJumps {
+#define XX(N) fj##N,
+    VM_FUSED_JUMPS(XX)
+#undef XX
+    fjCOUNT
+} FusedJump;
+
+/**
+ * Computes the dispatch key of the superinstruction fusing a `cmp` in
+ * mode \param M and operand form \param F with the jump \param J
+ */
+#define VM_FUSE_CMP_KEY(J, M, F) \
+    (VM_SPEC_KEY(sopCOUNT, 0, 0) + ((((J) << 2) | (M)) * sfCOUNT) + (F))
+
+/**
+ * Other instruction sequences executed as a single superinstruction
+ *
+ * `PushNcall` - `push <nargs>` followed by `ncall <imm>` of a native function
+ * taking that many arguments, which is called unchecked
+ * `PopnPop`   - `popn <imm>` followed by `pop <reg>`
+ * `PushMovPop` - `push.q <reg>`, `mov.q <reg> <reg|imm>` and `pop.q <reg>`,
+ * which is how expressions spill their left hand side
+ */
+#define VM_FUSED_SEQUENCES(XX)          \
+    XX(PushNcall)                       \
+    XX(PopnPop)                         \
+    XX(PushMovPop)
+
+typedef enum VirtualMachineFusedSequences {
+#define XX(N) fs##N,
+    VM_FUSED_SEQUENCES(XX)
+#undef XX
+    fsCOUNT
+} FusedSequence;
+
+/**
+ * Computes the dispatch key of the fused sequence \param S
+ */
+#define VM_FUSE_KEY(S) (VM_FUSE_CMP_KEY(fjCOUNT, 0, 0) + (S))
+
+/**
+ * Stack operations of functions whose stack usage is known at load time,
+ * these do not check the stack bounds. The space needed by the function is
+ * checked once by the `call` into it instead (\see VM_stack_analyze)
+ *
+ * `PushR` - `push.q <reg>`
+ * `PushI` - `push <imm>`
+ * `PopR`  - `pop.q <reg>`
+ * `Popn`  - `popn <imm>`
+ * `Call`  - `call <imm>`, checks the space needed by the called function
+ */
+#define VM_UNCHECKED_STACK_OPS(XX)      \
+    XX(PushR)                           \
+    XX(PushI)                           \
+    XX(PopR)                            \
+    XX(Popn)                            \
+    XX(Call)
+
+typedef enum VirtualMachineUncheckedStackOps {
+#define XX(N) us##N,
+    VM_UNCHECKED_STACK_OPS(XX)
+#undef XX
+    usCOUNT
+} UncheckedStackOp;
+
+/**
+ * Computes the dispatch key of the unchecked stack operation \param U
+ */
+#define VM_STACK_KEY(U) (VM_FUSE_KEY(fsCOUNT) + (U))
+
+/**
+ * A fixed width instruction produced by decoding an instruction from
+ * code space once at load time.
+ *
+ * @property instr the decoded instruction, with the `ims` fix up for
+ * single argument instructions applied and the immediate value sign extended
+ * to 64-bits
+ *
+ * @property ka the kind of argument A (\see VirtualMachineOperandKind)
+ *
+ * @property kb the kind of argument B
+ *
+ * @property op the dispatch key of the instruction, `(opc << 1) | regBit`,
+ * the key of a specialized handler (\see VM_SPEC_KEY) or the key of a
+ * superinstruction (\see VM_FUSE_CMP_KEY, VM_FUSE_KEY). Superinstructions
+ * execute the instructions decoded right after them, which are kept in the
+ * stream so that they remain valid jump targets. Stack operations that
+ * need not check the stack bounds use \see VM_STACK_KEY.
+ *
+ * @property iip the address of the instruction in code space
+ *
+ * @property nip the address of the next instruction in code space
+ *
+ * @property stk the stack space checked by an unchecked `call`, its frame
+ * and the pushes of the called function (\see VM_stack_analyze)
+ *
+ * @property nat the slot of the native function called by a pre-linked
+ * `ncall` or `ncallr` in \see VirtualMachine.natives
+ */
+typedef struct VirtualMachineDecodedInstruction {
+    Instruction instr;
+    u8  ka;
+    u8  kb;
+    u16 op;
+    u32 iip;
+    u32 nip;
+    union {
+        u32 stk;
+        u32 nat;
+    };
+} attr(aligned, 32) DecodedInstruction;
+
 /**
  * Holds information about the memory allocated for the virtual
  * machine
@@ -366,7 +806,18 @@ typedef struct VirtualMachineCodeHeader {
  * @property hlm heap limit, this marks the top of the total heap
  * memory. Heap allocations cannot be made past this address
  *
- * @property size the total size of memory allocated for the virtual machine
+ * @property size the total size of memory reserved for the virtual machine,
+ * only the heap up to \property hlm and the stack down to \property sb are
+ * committed, the gap between them is committed as either of them grows
+ * (\see VM_memory_grow_heap, VM_memory_grow_stack)
+ *
+ * @property reserved the size of the address space reserved at \property ptr,
+ * the whole 32-bit address space when built with guard pages
+ * (`CYN_VM_GUARD_PAGES`). Otherwise the memory plus the widest access,
+ * which is committed with the stack
+ *
+ * @property committed the number of bytes of \property reserved that are
+ * backed by memory
  */
 typedef struct VirtualMachineMemory {
     u8 *ptr;
@@ -376,6 +827,8 @@ typedef struct VirtualMachineMemory {
     u32 hb;
     u32 hlm;
     u32 size;
+    u64 reserved;
+    u64 committed;
 } Memory;
 
 typedef enum VirtualMachineExecFlags {
@@ -388,6 +841,11 @@ typedef enum VirtualMachineExecFlags {
 struct VirtualMachine;
 typedef ExecFlags (*VirtualMachineDebugger)(struct VirtualMachine *, u32, const Instruction *);
 
+/**
+* Declaration for a native function
+*/
+typedef void(*NativeCall)(struct VirtualMachine*, const Value*, u32);
+
 /**
  * Holds virtual machine state
  *
@@ -396,12 +854,47 @@ typedef ExecFlags (*VirtualMachineDebugger)(struct VirtualMachine *, u32, const
  * @property regs list of register used by the virtual machine
  *
  * @property ram virtual machine random access memory
+ *
+ * @property decoded the predecoded instruction stream, terminated by a `halt`
+ * at the end of code space (\see VM_decode)
+ *
+ * @property dmap maps every address in code space to the index of the
+ * instruction starting at that address in \property decoded
+ *
+ * @property jit native code compiled for the decoded instructions, `NULL`
+ * unless enabled (\see VM_jit_compile)
+ *
+ * @property tracer native code compiled for hot loops, `NULL` unless
+ * enabled (\see VM_jit_trace_init)
+ *
+ * @property stk the stack space needed by the code at the entry point,
+ * checked once before running it (\see VM_stack_analyze)
+ *
+ * @property ncallr set while running a native function called by `ncallr`,
+ * whose values are returned in registers (\see VM_returnx)
+ *
+ * @property natives the native functions called through an immediate value,
+ * resolved when decoding (\see VM_DECODE_NCALL)
+ *
+ * @property vregs the vector registers (\see VM_OP_VECTOR)
+ *
+ * @property guard the next virtual machine whose memory faults are reported
+ * when built with guard pages (`CYN_VM_GUARD_PAGES`)
  */
 typedef struct VirtualMachine {
     u64 flags;
     u64 regs[regCOUNT];
     Code *code;
     Memory ram;
+    DecodedInstruction *decoded;
+    u32 *dmap;
+    struct VirtualMachineJit *jit;
+    struct VirtualMachineJit *tracer;
+    u32 stk;
+    bool ncallr;
+    NativeCall *natives;
+    VectorReg vregs[VM_VREG_COUNT];
+    struct VirtualMachine *guard;
 #ifdef CYN_VM_DEBUG_TRACE
     u8 dbgTrace;
 #endif
@@ -416,22 +909,80 @@ typedef struct VirtualMachineHeapBlock {
     u32 addr;
 } attr(packed) HeapBlock;
 
+/**
+ * The allocators of the virtual machine heap (\see VM_heap_init_)
+ *
+ * `halList` first fit allocator tracking blocks with descriptors kept
+ * before the virtual machine memory, more are allocated outside of it
+ * when they are used up
+ *
+ * `halTlsf` two level segregated fit allocator, blocks are tracked by a
+ * tag kept in virtual machine memory right before them (\see HeapTag).
+ * Free blocks are binned by size, allocating and freeing take a constant
+ * time.
+ */
+typedef enum VirtualMachineHeapAllocator {
+    halList,
+    halTlsf
+} HeapAllocator;
+
+/**
+ * The second level of the `halTlsf` allocator splits every power of 2
+ * range of sizes into 2^VM_TLSF_SL_LOG2 bins, sizes smaller than
+ * \see VM_TLSF_SMALL are split linearly into the bins of the first row
+ */
+#define VM_TLSF_SL_LOG2  4
+#define VM_TLSF_SL_COUNT (1 << VM_TLSF_SL_LOG2)
+#define VM_TLSF_FL_SHIFT (VM_TLSF_SL_LOG2 + 3)
+#define VM_TLSF_FL_COUNT (32 - VM_TLSF_FL_SHIFT + 1)
+#define VM_TLSF_SMALL    (1 << VM_TLSF_FL_SHIFT)
+
+/**
+ * The tag placed before every block of the `halTlsf` allocator
+ *
+ * @property prev the address of the previous block in memory, only valid
+ * when that block is free (\see htgPrevFree)
+ *
+ * @property size the size of the block including its tag, which is a
+ * multiple of 8 whose low bits hold the flags of the block
+ *
+ * Free blocks link to the other blocks of their bin through the first two
+ * words following the tag, blocks are therefore never smaller than 16 bytes
+ */
+typedef struct VirtualMachineHeapTag {
+    u32 prev;
+    u32 size;
+} attr(packed) HeapTag;
+
+typedef enum {
+    htgFree     = BIT(0),
+    htgPrevFree = BIT(1),
+    htgFlags    = htgFree | htgPrevFree
+} HeapTagFlags;
+
 typedef struct VirtualMachineMemoryHeap {
-    HeapBlock *free;
-    HeapBlock *used;
-    HeapBlock *fresh;
+    union {
+        struct {
+            HeapBlock *free;
+            HeapBlock *used;
+            HeapBlock *fresh;
+            HeapBlock *chunks;
+            u32 nhbs;
+        };
+        struct {
+            u32 fl;
+            u32 sl[VM_TLSF_FL_COUNT];
+            u32 bins[VM_TLSF_FL_COUNT][VM_TLSF_SL_COUNT];
+        };
+    };
     u32   top;
     u32   sth;
     u32   lmt;
     u8    aln;
+    u8    alc;
     u8    mem[0];
 } attr(packed) Heap;
 
-/**
-* Declaration for a native function
-*/
-typedef void(*NativeCall)(VM*, const Value*, u32);
-
 /**
  * Should be invoked to exit the virtual. This will unconditionally
  * cause a an abnormal VM termination
@@ -457,15 +1008,36 @@ void VM_abort(VM *vm, const char *fmt, ...);
  */
 #define REG(V, R) (vm)->regs[(R)]
 
+/**
+ * Checks if the \param len bytes at \param addr are committed, either below
+ * the heap limit \param hlm or in the stack between the stack boundary
+ * \param sb and the end of the memory \param size. The accesses at the end of
+ * either reach at most `CYN_VM_ALIGNMENT` bytes past it
+ * (\see VM_memory_grow_heap, VM_memory_grow_stack).
+ */
+attr(always_inline)
+bool VM_memory_committed(u32 hlm, u32 sb, u32 size, u32 addr, u64 len)
+{
+    return (u64) addr + len <= (u64) hlm + CYN_VM_ALIGNMENT
+        || (u64) (u32) (addr - sb) + len <= (u64) (size - sb) + CYN_VM_ALIGNMENT;
+}
+
 /**
  * Macro used to access the virtual machine memory
- * at the given address
+ * at the given address.
+ *
+ * When built with guard pages (`CYN_VM_GUARD_PAGES`) the whole 32-bit
+ * address space of the virtual machine is reserved and the addresses past
+ * the memory committed are never mapped, accessing them faults and the
+ * fault aborts the virtual machine. The bounds check is omitted.
  */
 attr(always_inline)
 u8* MEM(VM *vm, u32 addr)
 {
-    if (addr > vm->ram.size)
+#ifndef CYN_VM_GUARD_PAGES
+    if (!VM_memory_committed(vm->ram.hlm, vm->ram.sb, vm->ram.size, addr, sizeof(Value)))
         VM_abort(vm, "Memory access violation %x/%x", addr, vm->ram.hlm);
+#endif
 
     return &vm->ram.base[addr];
 }
@@ -490,8 +1062,30 @@ typedef enum {
 #endif
 
 /**
- * Push the given \param data onto the VM's stack. VM will abort
- * if there is a stack overflow
+ * Commits more of the reserved memory to the stack, lowering the stack
+ * boundary below \param bottom. VM will abort if the stack would collide
+ * with the heap
+ *
+ * @param vm
+ * @param bottom the lowest address the stack is growing down to
+ */
+void VM_memory_grow_stack(VM *vm, u64 bottom);
+
+/**
+ * Commits more of the reserved memory to the heap, raising the heap
+ * limit to at least \param limit
+ *
+ * @param vm
+ * @param limit the heap limit needed
+ *
+ * @return true if the heap limit was raised, false if the heap would
+ * collide with the stack
+ */
+bool VM_memory_grow_heap(VM *vm, u64 limit);
+
+/**
+ * Push the given \param data onto the VM's stack. The stack grows if
+ * needed, VM will abort if there is a stack overflow
  *
  * @param vm
  * @param data the data to push onto the stack, if this value is `NULL`,
@@ -504,9 +1098,8 @@ attr(always_inline)
 Value* VM_pushn(VM *vm, const Value *data, u8 count)
 {
     u32 size = count << 3;
-    if (((REG(vm, sp) - size) <= vm->ram.sb)) {
-        VM_abort(vm, "VM stack memory overflow - collides with heap boundary");
-    }
+    if (((REG(vm, sp) - size) <= vm->ram.sb))
+        VM_memory_grow_stack(vm, REG(vm, sp) - size);
 
     REG(vm, sp) -= size;
     if (data != NULL)
@@ -553,9 +1146,19 @@ Value* VM_popn(VM *vm, Value *data, u8 count)
  */
 #define VM_pop(vm, T) ({ (T)VM_popn((vm), NULL, 1)->i; })
 
+// The registers (r0-r5) passing arguments to and values from `ncallr`
+#define VM_NCALLR_REGS 6
+
+// The register (r0) holding the number of bytes of `mcpy`, `mset`, `mcmp`
+// and `mchr`, `mchr` also writes its result to it
+#define VM_BULK_LEN r0
+
+// The register (r0) receiving the address allocated by `aalloc`
+#define VM_ARENA_ADDR r0
+
 /**
  * Used by native/sys calls to return values to
- * the system
+ * the system, in registers when called by `ncallr`
  *
  * @param vm
  * @param vals
@@ -578,11 +1181,15 @@ void VM_returnx(VM *vm, Value *vals, u32 count);
  *
  * @param vm The virtual machine to initialize
  * @param code The code to load onto the virtual machine
- * @param mem the total size of the ram to be allocated for the
- * virtual machine
- * @param ss the size of the stack
+ * @param mem the size of the ram committed for the virtual machine
+ * to begin with
+ * @param max the size of the ram reserved for the virtual machine, the heap
+ * and the stack grow into it on demand. It is raised to \param mem if smaller
+ * @param alc the heap allocator (\see HeapAllocator)
+ * @param nhbs the number of heap block descriptors of the `halList` allocator
+ * @param ss the size of the stack committed to begin with
  */
-void VM_init_(VM *vm, Code *code, u64 mem, u32 nhbs, u32 ss);
+void VM_init_(VM *vm, Code *code, u64 mem, u64 max, HeapAllocator alc, u32 nhbs, u32 ss);
 
 /**
  * Helper macro to initialize the virtual machine with the
@@ -593,7 +1200,8 @@ void VM_init_(VM *vm, Code *code, u64 mem, u32 nhbs, u32 ss);
  * @param S the total size of the ram to be allocated for the
  * virtual machine
  */
-#define VM_init(V, CD, S) VM_init_((V), (CD), (S), CYN_VM_HEAP_DEFAULT_NHBS, CYN_VM_DEFAULT_SS)
+#define VM_init(V, CD, S) \
+    VM_init_((V), (CD), (S), CYN_VM_DEFAULT_MX, CYN_VM_HEAP_DEFAULT_ALLOCATOR, CYN_VM_HEAP_DEFAULT_NHBS, CYN_VM_DEFAULT_SS)
 
 /**
  * Run the code loaded onto the virtual machine, parsing
@@ -607,6 +1215,99 @@ void VM_init_(VM *vm, Code *code, u64 mem, u32 nhbs, u32 ss);
  */
 void VM_run(VM *vm, int argc, char *argv[]);
 
+/**
+ * Prepares the registers and the stack of the virtual machine to run the
+ * code loaded onto it from its entry point, parsing in the given command
+ * line arguments. Invoked by \see VM_run before executing any instruction.
+ *
+ * @param vm The virtual machine to prepare
+ * @param argc the number of arguments to pass to
+ * the virtual machine
+ * @param argv an list of string arguments passed to the
+ * virtual machine
+ */
+void VM_enter(VM *vm, int argc, char *argv[]);
+
+/**
+ * Verifies the given bytecode before it is loaded onto a virtual machine.
+ * Every instruction must decode, use registers that exist and take as many
+ * arguments as its op code, jumps and calls through an immediate value must
+ * land on an instruction boundary.
+ *
+ * @param code the bytecode to verify
+ * @param es the stream to report the first error found to, can be `NULL`
+ *
+ * @return true if the bytecode is valid, false otherwise
+ */
+bool VM_verify(const Code *code, Stream *es);
+
+/**
+ * Decodes the code loaded onto the virtual machine into a cache aligned
+ * stream of fixed width instructions (\see VirtualMachineDecodedInstruction).
+ * This is done once at load time so that the interpreter does not have to
+ * decode instructions on every step.
+ *
+ * @param vm the virtual machine whose code should be decoded
+ */
+void VM_decode(VM *vm);
+
+/**
+ * Computes the stack usage of every function in the decoded instruction
+ * stream by walking its control flow graph. Functions are the targets of
+ * `call <imm>` and the entry point, their stack usage is known when every
+ * path pushes and pops the same number of values, `popn` and `ret` take
+ * immediate values and calls are preceded by a `push <nargs>`.
+ *
+ * Stack operations of such functions are dispatched to handlers that do
+ * not check the stack bounds (\see VM_STACK_KEY), the space needed by the
+ * function is checked once by the `call` into it. Nothing is changed if
+ * the code jumps or calls through a register or memory.
+ *
+ * @param vm the virtual machine whose code was decoded (\see VM_decode)
+ * @param count the number of decoded instructions
+ */
+void VM_stack_analyze(VM *vm, u32 count);
+
+/**
+ * Release the decoded instruction stream of the given virtual machine
+ *
+ * @param vm
+ */
+void VM_decode_release(VM *vm);
+
+/**
+ * Used to mark addresses in code space that are not instruction boundaries
+ */
+#define VM_DECODE_INVALID UINT32_MAX
+
+/**
+ * Get the decoded instruction at the given address in code space. The
+ * virtual machine is aborted if the address is not an instruction boundary
+ *
+ * @param vm
+ * @param addr the address of the instruction
+ */
+attr(always_inline)
+DecodedInstruction *VM_decoded_at(VM *vm, u64 addr)
+{
+    if (addr > Vector_len(vm->code))
+        VM_abort(vm, "execution goes beyond code space");
+    if (vm->dmap[addr] == VM_DECODE_INVALID)
+        VM_abort(vm, "execution jumps into the middle of an instruction at %08" PRIu64, addr);
+
+    return &vm->decoded[vm->dmap[addr]];
+}
+
+/**
+ * Executes a single decoded instruction, the instruction pointer is updated
+ * as it would be by the interpreter loop. Used by execution engines to run
+ * instructions they do not translate.
+ *
+ * @param vm
+ * @param di the instruction to execute
+ */
+void VM_step(VM *vm, const DecodedInstruction *di);
+
 /**
  * De-initialize the given virtual machine
  *
@@ -618,17 +1319,91 @@ void VM_deinit(VM *vm);
  * Initialize heap memory allocator
  *
  * @param vm the virtual whose memory allocator should be initialized
+ * @param alc the allocator to use (\see HeapAllocator)
+ * @param blocks the number of block descriptors of the `halList` allocator
+ * kept before the virtual machine memory
  * @param sth the memory split threshold for splitting chunks
- * @param alignment memory alignment
+ * @param alignment memory alignment, `halTlsf` aligns blocks to 8 bytes
  */
-void VM_heap_init_(VM *vm, u32 blocks, u32 sth, u8 alignment);
+void VM_heap_init_(VM *vm, HeapAllocator alc, u32 blocks, u32 sth, u8 alignment);
 
 /**
  * Helper macro to initialize the virtual machine heap with default
  * values
  */
-#define VM_heap_init(vm, NBS) \
-    VM_heap_init_(vm, (NBS), CYN_VM_HEAP_DEFAULT_STH, CYN_VM_ALIGNMENT)
+#define VM_heap_init(vm, ALC, NBS) \
+    VM_heap_init_(vm, (ALC), (NBS), CYN_VM_HEAP_DEFAULT_STH, CYN_VM_ALIGNMENT)
+
+/**
+ * An arena handing out memory from chunks allocated on the virtual
+ * machine heap, it lives in a heap block followed by its first chunk.
+ * Every other chunk starts with the address of the previous one.
+ *
+ * @property chunk the address of the current chunk, 0 for the first one
+ * @property top the next address allocated from the current chunk
+ * @property end the end of the current chunk
+ * @property csz the size of the chunks allocated when one fills up
+ */
+typedef struct VirtualMachineArena {
+    u32 chunk;
+    u32 top;
+    u32 end;
+    u32 csz;
+} attr(packed) Arena;
+
+/**
+ * Create an arena on the virtual machine heap
+ *
+ * @param vm
+ * @param size the size of the chunks of the arena
+ * @return the address of the arena, 0 if the heap is out of memory
+ */
+u32 VM_arena_new(VM *vm, u32 size);
+
+/**
+ * Allocate memory from an arena by bumping a pointer, a new chunk is
+ * allocated on the heap when the current one is full
+ *
+ * @param vm
+ * @param arena the address of the arena (\see VM_arena_new)
+ * @param size
+ * @return address of the memory, 0 if the heap is out of memory
+ */
+u32 VM_arena_alloc(VM *vm, u32 arena, u32 size);
+
+/**
+ * Release all the memory allocated from an arena at once, the chunks
+ * but the first one are freed
+ *
+ * @param vm
+ * @param arena
+ */
+void VM_arena_reset(VM *vm, u32 arena);
+
+/**
+ * Release an arena and all the memory allocated from it
+ *
+ * @param vm
+ * @param arena
+ */
+void VM_arena_free(VM *vm, u32 arena);
+
+/**
+ * Release the block descriptors allocated by the heap allocator outside
+ * of the virtual machine memory
+ *
+ * @param vm
+ */
+void VM_heap_deinit(VM *vm);
+
+/**
+ * The size of the heap bookkeeping kept before the virtual machine memory
+ *
+ * @param alc the allocator used (\see HeapAllocator)
+ * @param blocks the number of block descriptors of the `halList` allocator
+ */
+#define VM_heap_size(ALC, NBS) \
+    (sizeof(Heap) + (((ALC) == halList)? sizeof(HeapBlock) * (NBS) : 0))
 
 /**
  * Allocate memory from virtual machine's heap
@@ -640,6 +1415,20 @@ void VM_heap_init_(VM *vm, u32 blocks, u32 sth, u8 alignment);
  */
 u32  VM_alloc(VM *vm, u32 size);
 
+/**
+ * Resize memory allocated from the virtual machine's heap. The block is
+ * resized in place when it is at the top of the heap or when the block
+ * after it is free and large enough, otherwise it is moved.
+ *
+ * @param vm
+ * @param mem the address of the memory, 0 to allocate new memory
+ * @param size the new size
+ *
+ * @return the address of the memory, 0 if it could not be resized in which
+ * case \param mem is left allocated
+ */
+u32 VM_realloc(VM *vm, u32 mem, u32 size);
+
 /**
  * Free previously allocated memory
  *
@@ -725,6 +1514,38 @@ static void VM_write(void *dst, i64 src, Mode size)
     }
 }
 
+/**
+ * Reads the floating point value stored at the given address, `f32`
+ * values are read in mode `szWord` and `f64` values in mode `szQuad`
+ *
+ * @param src
+ * @param size
+ *
+ * @return the value read, widened to `f64`
+ */
+attr(always_inline)
+static f64 VM_fread(const void *src, Mode size)
+{
+    return (size == szWord)? (f64) *((f32 *) src) : *((f64 *) src);
+}
+
+/**
+ * Writes a floating point value to the given address, rounding it to
+ * `f32` in mode `szWord`
+ *
+ * @param dst
+ * @param src
+ * @param size
+ */
+attr(always_inline)
+static void VM_fwrite(void *dst, f64 src, Mode size)
+{
+    if (size == szWord)
+        *((f32 *) dst) = (f32) src;
+    else
+        *((f64 *) dst) = src;
+}
+
 void VM_code_append_(Code *code, const Instruction *seq, u32 sz);
 void* VM_code_append_data_(Code *code, const void *data, u32 sz);
 #define VM_code_append_data(C, D, N) \
@@ -243,7 +243,7 @@ static Mode Assembler_parse_modes_(AssemblerCtx *as, const Mode *modes, u8 len)
                         ext.count, ext.data);
     }
 
-    if (len > 0 && Assembler_find_mode(modes, len, mode)) {
+    if (len > 0 && !Assembler_find_mode(modes, len, mode)) {
 #define AppendMode(B, M) Buffer_appendCstr((B), vmModeNamesTbl[(M)])
         __destroy char *supported = join(modes, len, "/", AppendMode);
 #undef  AppendMode
@@ -286,6 +286,19 @@ static void Assembler_parse_label(AssemblerCtx *as)
 
 typedef Pair(bool, Register) IsMemRegPair;
 
+// The float width of immediate values given to argument B, -1 for integers
+static i32 Assembler_float_mode(const Instruction *instr)
+{
+    switch (instr->opc) {
+        case opFadd: case opFsub: case opFmul: case opFdiv: case opFcmp: case opFtoi:
+            return instr->imd;
+        case opFcvt:
+            return (instr->imd == szWord)? szQuad : szWord;
+        default:
+            return -1;
+    }
+}
+
 static IsMemRegPair Assembler_parse_instruction_arg(AssemblerCtx *as, Instruction *instr, bool isRb)
 {
     bool isMem, isNeg, isSizeOp;
@@ -315,7 +328,15 @@ static IsMemRegPair Assembler_parse_instruction_arg(AssemblerCtx *as, Instructio
             ITP_fail0(as, &tok.range, "+/- not allowed on variables/labels");
 
         sv = Range_view(&tok.range);
-        if ((rX = Vm_get_register_from_str_(sv.data, sv.count)) == regCOUNT) {
+        if (!isMem && (isRb? VM_OP_VECTOR_B(instr->opc) : VM_OP_VECTOR_A(instr->opc))) {
+            // vector instructions name vector registers unless referencing memory
+            u8 vX = Vm_get_vector_register_from_str_(sv.data, sv.count);
+            if (vX == VM_VREG_COUNT || isSizeOp)
+                ITP_fail0(as, &tok.range, "expecting a vector register v0-v%u", VM_VREG_COUNT - 1);
+            instr->rmd = amReg;
+            reg = vX;
+        }
+        else if ((rX = Vm_get_register_from_str_(sv.data, sv.count)) == regCOUNT) {
             instr->rmd = amImm;
             instr->iu = (isSizeOp ?
                          Assembler_get_variable_size(as, &tok.range) :
@@ -382,6 +403,14 @@ static IsMemRegPair Assembler_parse_instruction_arg(AssemblerCtx *as, Instructio
             instr->iea  = 1;
         }
     }
+    else if (isRb && (tok.kind == tokInteger || tok.kind == tokFloat) && Assembler_float_mode(instr) >= 0) {
+        // floating point immediates are encoded in the float width of the instruction
+        f64 value = (tok.kind == tokFloat)? Token_get(&tok, Float) : (f64) Token_get(&tok, Int);
+        if (isNeg) value = -value;
+        instr->rmd = amImm;
+        instr->ims = Assembler_float_mode(instr);
+        instr->iu = (instr->ims == szWord)? f2uX(value, 32) : f2uX(value, 64);
+    }
     else {
         instr->rmd = amImm;
         switch (tok.kind) {
@@ -390,8 +419,9 @@ static IsMemRegPair Assembler_parse_instruction_arg(AssemblerCtx *as, Instructio
                 instr->ims = SZ_(u32);
                 break;
             case tokFloat:
-                instr->iu = f2u(Token_get(&tok, Float));
+                instr->iu = f2u(isNeg? -Token_get(&tok, Float) : Token_get(&tok, Float));
                 instr->ims = SZ_(u64);
+                break;
             case tokInteger: {
                 union { i64 i; u64 u; } imm = {.u = Token_get(&tok, Int)};
                 instr->ims = VM_integer_size(imm.u);
@@ -410,6 +440,36 @@ static IsMemRegPair Assembler_parse_instruction_arg(AssemblerCtx *as, Instructio
     return make(IsMemRegPair, isMem, reg);
 }
 
+/**
+ * Parses the target of a compare and branch instruction, either a label
+ * or an offset relative to the instruction. Labels are patched through the
+ * target so the arguments of the instruction cannot reference one.
+ */
+static void Assembler_parse_branch_target(AssemblerCtx *as, Instruction *instr)
+{
+    u32 pos = Vector_len(&as->instructions);
+    union { i64 i; u64 u; } imm;
+    Token *tokP;
+    bool isNeg;
+
+    if (RbTree_find_(&as->patchWork.base, &make(Patch, .f = pos), 0) != NULL)
+        ITP_fail(as, "arguments of '%s' cannot reference labels, only its target can",
+                 vmInstructionNamesTbl[instr->opc]);
+
+    if (ITP_check(as, tokIdentifier)) {
+        tokP = ITP_advance(as);
+        instr->itg = (i32) Assembler_add_symbol_reference(as, pos, &tokP->range, true);
+        return;
+    }
+
+    isNeg = ITP_match(as, tokMinus);
+    if (!isNeg) ITP_match(as, tokPlus);
+    tokP = ITP_consume(as, tokInteger, "expecting a label or an integer as the target of a branch");
+    imm.u = Token_get(tokP, Int);
+    if (isNeg) imm.i = -imm.i;
+    instr->itg = (i32) imm.i;
+}
+
 static void Assembler_parse_instruction(AssemblerCtx *as)
 {
     Instruction instr = {0};
@@ -428,8 +488,12 @@ static void Assembler_parse_instruction(AssemblerCtx *as)
     instr.opc = opc.f;
     instr.imd = szQuad;
 
-    if (ITP_match(as, tokDot))
-        instr.imd = Assembler_parse_modes(as);
+    if (ITP_match(as, tokDot)) {
+        if (VM_OP_FLOAT(instr.opc))
+            instr.imd = Assembler_parse_modes(as, szWord, szQuad);
+        else
+            instr.imd = Assembler_parse_modes(as);
+    }
 
     if (opc.s >= 1) {
         unpack(isMem, reg, Assembler_parse_instruction_arg(as, &instr, false));
@@ -446,6 +510,9 @@ static void Assembler_parse_instruction(AssemblerCtx *as)
         instr.rb = reg;
     }
 
+    if (VM_OP_BRANCH(instr.opc))
+        Assembler_parse_branch_target(as, &instr);
+
     Vector_push(&as->instructions, instr);
 }
 
@@ -523,7 +590,8 @@ static void Assembler_parse_var_decl(AssemblerCtx *as)
                 if (isNeg) value = -value;
                 if (ITP_match(as, tokBackquote))
                     mode = Assembler_parse_modes(as, szWord, szQuad);
-                size = Assembler_append_integral_data(as, f2i(value), mode);
+                size = Assembler_append_integral_data(as,
+                                                      (mode == szWord)? f2uX(value, 32) : f2i(value), mode);
                 break;
             }
             case tokLBracket: {
@@ -594,8 +662,12 @@ static u32 Assembler_link(AssemblerCtx *as, Code *code)
         RbTreeNode *it;
         Instruction *instr = Vector_at(&as->instructions, i);
 
+        // compare and branch instructions reference labels through their target
         if (RbTree_find_(&as->patchWork.base, &make(Patch, .f = i), 0) != NULL) {
-            instr->ii -= ip;
+            if (VM_OP_BRANCH(instr->opc))
+                instr->itg -= ip;
+            else
+                instr->ii -= ip;
         }
 
         it = RbTree_find_(&refs.base, &make(RefList_t, .f = i), 0);
@@ -603,13 +675,21 @@ static u32 Assembler_link(AssemblerCtx *as, Code *code)
             RefList_t *rfl = RbTree_ref(&refs, it);
             Vector_foreach(&rfl->s, j) {
                 Instruction *ins = Vector_at(&as->instructions, j);
-                ins->ii += ip;
+                if (VM_OP_BRANCH(ins->opc))
+                    ins->itg += ip;
+                else
+                    ins->ii += ip;
             }
         }
 
         ip += instr->osz;
+        // extended op codes are preceded by VM_OP_EXT
+        if (instr->opc >= VM_OP_PAGE)
+            ip++;
         if (instr->rmd == amImm || instr->iea)
             ip += vmSizeTbl[instr->ims];
+        if (VM_OP_BRANCH(instr->opc))
+            ip += sizeof(i32);
     }
 
     VM_code_append_(code, Vector_begin(&as->instructions), Vector_len(&as->instructions));
@@ -647,9 +727,11 @@ void Assembler_init(Assembler *as, Lexer *lX)
     // the position of the number of function arguments in stack
     Assembler_define(ctx, "argc", 16);
     Assembler_define(ctx, "argv", 24);
+    // the position of the first argument in a frame pushed by `fcall`
+    Assembler_define(ctx, "fargs", 16);
 
     // define builtin variables
-#define XX(I, N) Assembler_define(ctx, "__"#N, (u64)bnc##I);
+#define XX(I, N, ...) Assembler_define(ctx, "__"#N, (u64)bnc##I);
 #define UU(...)
     VM_NATIVE_OS_FUNCS(XX, UU)
 #undef UU
@@ -14,8 +14,25 @@
 
 #include <math.h>
 
-void Codegen_generateCyn(Builder *cb, AstNode *node)
+// Caller saved registers holding the left hand side of binary expressions
+// while evaluating the right hand side, deeper expressions use the stack
+static const Register sCodegenTemps[] = { r6, r7, r8, r9, r10, r11 };
+
+/**
+ * The state of the code generator
+ *
+ * @property cb the builder the code is appended to
+ * @property depth the number of \see sCodegenTemps in use
+ */
+typedef struct {
+    Builder *cb;
+    u32 depth;
+} Codegen;
+
+static void Codegen_generate(Codegen *cg, AstNode *node)
 {
+    Builder *cb = cg->cb;
+
     switch (node->id) {
     case astStringLit:
         Builder_appendInstruction(cb,
@@ -46,7 +63,7 @@ void Codegen_generateCyn(Builder *cb, AstNode *node)
     case astFloatLit:
         Builder_appendInstruction(
             cb,
-            cMOV(rRa(r5), xIMb(f64, node->astFloat.value)));
+            cMOV(rRa(r5), fIMb(f64, node->astFloat.value)));
         break;
     case astVarExpr:
         Builder_appendInstruction(cb,
@@ -54,7 +71,7 @@ void Codegen_generateCyn(Builder *cb, AstNode *node)
         Builder_appendInstruction(cb, cMOV(rRa(r5), mRb(r4)));
         break;
     case astUnaryExpr:
-        Codegen_generateCyn(cb, node->astUnary.expr);
+        Codegen_generate(cg, node->astUnary.expr);
         if (node->astUnary.op == tokNot) {
             Builder_appendInstruction(cb, cNOT(rRa(r5)));
         }
@@ -68,7 +85,7 @@ void Codegen_generateCyn(Builder *cb, AstNode *node)
         break;
 
     case astPrefixExpr:
-        Codegen_generateCyn(cb, node->astPrefix.expr);
+        Codegen_generate(cg, node->astPrefix.expr);
         if (node->astUnary.op == tokPlusPlus) {
             Builder_appendInstruction(cb, cINC(mRa(r4)));
         }
@@ -82,7 +99,7 @@ void Codegen_generateCyn(Builder *cb, AstNode *node)
         break;
 
     case astPostfixExpr:
-        Codegen_generateCyn(cb, node->astPostfix.expr);
+        Codegen_generate(cg, node->astPostfix.expr);
         if (node->astUnary.op == tokPlusPlus) {
             Builder_appendInstruction(cb, cINC(mRa(r4)));
         }
@@ -93,94 +110,104 @@ void Codegen_generateCyn(Builder *cb, AstNode *node)
             unreachable();
         }
         break;
-    case astBinaryExpr:
-        Codegen_generateCyn(cb, node->astBinary.lhs);
-        Builder_appendInstruction(cb, cPUSH(rRa(r5)));
-        Codegen_generateCyn(cb, node->astBinary.rhs);
-        Builder_appendInstruction(cb, cPOP(rRa(r4)));
+    case astBinaryExpr: {
+        Register lhs = r4;
+        Codegen_generate(cg, node->astBinary.lhs);
+        if (cg->depth < sizeof__(sCodegenTemps)) {
+            lhs = sCodegenTemps[cg->depth++];
+            Builder_appendInstruction(cb, cMOV(rRa(lhs), rRb(r5)));
+            Codegen_generate(cg, node->astBinary.rhs);
+            cg->depth--;
+        }
+        else {
+            Builder_appendInstruction(cb, cPUSH(rRa(r5)));
+            Codegen_generate(cg, node->astBinary.rhs);
+            Builder_appendInstruction(cb, cPOP(rRa(r4)));
+        }
         switch (node->astBinary.op) {
             case tokPlus:
-                Builder_appendInstruction(cb, cADD(rRa(r5), rRb(r4)));
+                Builder_appendInstruction(cb, cADD(rRa(r5), rRb(lhs)));
                 break;
             case tokMinus:
-                Builder_appendInstruction(cb, cSUB(rRa(r5), rRb(r4)));
+                Builder_appendInstruction(cb, cSUB(rRa(r5), rRb(lhs)));
                 break;
             case tokMult:
-                Builder_appendInstruction(cb, cMUL(rRa(r5), rRb(r4)));
+                Builder_appendInstruction(cb, cMUL(rRa(r5), rRb(lhs)));
                 break;
             case tokDiv:
-                Builder_appendInstruction(cb, cDIV(rRa(r5), rRb(r4)));
+                Builder_appendInstruction(cb, cDIV(rRa(r5), rRb(lhs)));
                 break;
             case tokMod:
-                Builder_appendInstruction(cb, cMOD(rRa(r5), rRb(r4)));
+                Builder_appendInstruction(cb, cMOD(rRa(r5), rRb(lhs)));
                 break;
             case tokBitAnd:
-                Builder_appendInstruction(cb, cBAND(rRa(r5), rRb(r4)));
+                Builder_appendInstruction(cb, cBAND(rRa(r5), rRb(lhs)));
                 break;
             case tokBitOr:
-                Builder_appendInstruction(cb, cBOR(rRa(r5), rRb(r4)));
+                Builder_appendInstruction(cb, cBOR(rRa(r5), rRb(lhs)));
                 break;
             case tokBitXor:
-                Builder_appendInstruction(cb, cXOR(rRa(r5), rRb(r4)));
+                Builder_appendInstruction(cb, cXOR(rRa(r5), rRb(lhs)));
                 break;
             case tokSal:
-                Builder_appendInstruction(cb, cSAL(rRa(r5), rRb(r4)));
+                Builder_appendInstruction(cb, cSAL(rRa(r5), rRb(lhs)));
                 break;
             case tokSar:
-                Builder_appendInstruction(cb, cSAR(rRa(r5), rRb(r4)));
+                Builder_appendInstruction(cb, cSAR(rRa(r5), rRb(lhs)));
                 break;
             case tokLt:
-                Builder_appendInstruction(cb,
-                               cCMP(rRa(r5), rRb(r4)));
-                Builder_appendInstruction(cb,
-                              cBAND(rRa(flg), xIMb(u64, flgLess)));
+                Builder_appendInstruction(cb, cCMP(rRa(lhs), rRb(r5)));
+                Builder_appendInstruction(cb, cSETLT(rRa(r5)));
+                break;
             case tokLte:
-                Builder_appendInstruction(cb,
-                               cCMP(rRa(r5), rRb(r4)));
-                Builder_appendInstruction(cb,
-                              cBAND(rRa(flg), xIMb(u64, flgLess|flgZero)));
+                Builder_appendInstruction(cb, cCMP(rRa(lhs), rRb(r5)));
+                Builder_appendInstruction(cb, cSETLE(rRa(r5)));
+                break;
             case tokGt:
-                Builder_appendInstruction(cb,
-                               cCMP(rRa(r5), rRb(r4)));
-                Builder_appendInstruction(cb,
-                              cBAND(rRa(flg), xIMb(u64, flgGreater)));
+                Builder_appendInstruction(cb, cCMP(rRa(lhs), rRb(r5)));
+                Builder_appendInstruction(cb, cSETGT(rRa(r5)));
                 break;
             case tokGte:
-                Builder_appendInstruction(cb,
-                               cCMP(rRa(r5), rRb(r4)));
-                Builder_appendInstruction(cb,
-                              cBAND(rRa(flg), xIMb(u64, flgGreater|flgZero)));
+                Builder_appendInstruction(cb, cCMP(rRa(lhs), rRb(r5)));
+                Builder_appendInstruction(cb, cSETGE(rRa(r5)));
+                break;
+            case tokEqual:
+                Builder_appendInstruction(cb, cCMP(rRa(lhs), rRb(r5)));
+                Builder_appendInstruction(cb, cSETEQ(rRa(r5)));
+                break;
+            case tokNeq:
+                Builder_appendInstruction(cb, cCMP(rRa(lhs), rRb(r5)));
+                Builder_appendInstruction(cb, cSETNE(rRa(r5)));
                 break;
             default:
                 unreachable();
         }
         break;
+    }
 
     case astLogicExpr: {
         Ident label;
         u32 pos;
-        Codegen_generateCyn(cb, node->astLogic.lhs);
+        Codegen_generate(cg, node->astLogic.lhs);
         label = Ident_genLabel();
 
 #define Epilogue(INS) Builder_appendInstruction(cb, cPUSH(rRa(r5))); \
-        Codegen_generateCyn(cb, node->astLogic.lhs);                 \
+        Codegen_generate(cg, node->astLogic.lhs);                    \
         Builder_appendInstruction(cb, cPOP(rRa(r4)));                \
         Builder_appendInstruction(cb, INS(rRa(r5), rRb(r4)))
 
         if (node->astLogic.op == tokOr) {
-            Builder_appendInstruction(cb, cCMP(rRa(r5), xIMb(u8, 0)));
             pos = Builder_pos(cb);
             pos =
                 Builder_addSymbolReference(cb, pos, label, &node->range, true);
-            Builder_appendInstruction(cb, cJMPNZ(xIMb(u64, pos)));
+            Builder_appendInstruction(cb, cJNE(rRa(r5), xIMb(u8, 0), pos));
             Epilogue(cOR);
         }
         else if (node->astLogic.op == tokAnd) {
-            Builder_appendInstruction(cb, cCMP(rRa(r5), xIMb(u8, 0)));
             pos = Builder_pos(cb);
             pos =
                 Builder_addSymbolReference(cb, pos, label, &node->range, true);
-            Builder_appendInstruction(cb, cJMPZ(xIMb(u64, pos)));
+            Builder_appendInstruction(cb, cJEQ(rRa(r5), xIMb(u8, 0), pos));
             Epilogue(cAND);
         }
         else
@@ -202,4 +229,10 @@ void Codegen_generateCyn(Builder *cb, AstNode *node)
     }
 
     }
-}
\ No newline at end of file
+}
+
+void Codegen_generateCyn(Builder *cb, AstNode *node)
+{
+    Codegen cg = {.cb = cb, .depth = 0};
+    Codegen_generate(&cg, node);
+}
@@ -0,0 +1,567 @@
+/**
+ * Copyright (c) 2022 Suilteam, Carter Mbotho
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the MIT license. See LICENSE for details.
+ *
+ * @author Carter
+ * @date 2022-12-29
+ */
+
+#include "vm/aot.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+
+// The instruction is the target of a direct jump
+#define AOT_LABEL    BIT(0)
+// The instruction can be reached through the dispatch switch
+#define AOT_DISPATCH BIT(1)
+
+typedef char AotExpr[128];
+// An expression combining two operand expressions
+typedef char AotValue[2 * sizeof(AotExpr) + 32];
+
+/**
+ * State of the translation of bytecode to C
+ *
+ * @property fp the file the C program is written to
+ *
+ * @property vm a virtual machine holding the decoded code being translated,
+ * the virtual machine has no memory
+ *
+ * @property marks the labels needed by every decoded instruction
+ * (\see AOT_LABEL, AOT_DISPATCH)
+ */
+typedef struct VirtualMachineAot {
+    FILE *fp;
+    VM   *vm;
+    u8   *marks;
+} Aot;
+
+static const char *vmAotModeNamesTbl[] = {
+    "szByte", "szShort", "szWord", "szQuad"
+};
+
+static const char *vmAotModeTypesTbl[] = {
+    "i8", "i16", "i32", "i64"
+};
+
+static const char *vmAotModeMasksTbl[] = {
+    "0xFFu", "0xFFFFu", "0xFFFFFFFFu", ""
+};
+
+static const char *vmAotModeUTypesTbl[] = {
+    "u8", "u16", "u32", "u64"
+};
+
+static void VM_aot_int(AotExpr out, i64 value)
+{
+    if (value == INT64_MIN)
+        snprintf(out, sizeof(AotExpr), "INT64_MIN");
+    else if (value < INT32_MIN || value > INT32_MAX)
+        snprintf(out, sizeof(AotExpr), "%" PRId64 "LL", value);
+    else
+        snprintf(out, sizeof(AotExpr), "%" PRId64, value);
+}
+
+// Returns the index of the instruction at \param addr or VM_DECODE_INVALID
+static u32 VM_aot_index(const Aot *aot, u64 addr)
+{
+    if (addr > Vector_len(aot->vm->code))
+        return VM_DECODE_INVALID;
+    return aot->vm->dmap[addr];
+}
+
+static bool VM_aot_uses_ip(const DecodedInstruction *di)
+{
+    return ((di->ka == okReg || di->ka == okRegMem) && di->instr.ra == ip) ||
+           ((di->kb == okReg || di->kb == okRegMem) && di->instr.rb == ip);
+}
+
+// Instructions executed by \see VM_step in translated code
+static bool VM_aot_steps(const DecodedInstruction *di)
+{
+    if (di->op == VM_DECODE_TRAP || di->op == VM_DECODE_UNKNOWN || VM_aot_uses_ip(di))
+        return true;
+    // malformed instructions missing arguments
+    if (di->instr.osz != 1 && di->ka == okNone)
+        return true;
+    if (di->instr.osz == 3 && di->kb == okNone)
+        return true;
+
+    switch (di->instr.opc) {
+        case opAdd: case opSub: case opAnd: case opOr:
+        case opSar: case opSal: case opXor: case opBor:
+        case opBand: case opMul: case opDiv: case opMod:
+        case opMov: case opCmp:
+        case opNot: case opBNot: case opInc: case opDec:
+        case opPush: case opPop: case opPopn:
+        case opJmp: case opJmpz: case opJmpnz: case opJmpg: case opJmps:
+        case opJeq: case opJne: case opJlt: case opJle: case opJgt: case opJge:
+        case opJltu: case opJleu: case opJgtu: case opJgeu: case opDjnz:
+        case opSeteq: case opSetne: case opSetlt: case opSetle: case opSetgt: case opSetge:
+        case opCseleq: case opCselne: case opCsellt: case opCselle: case opCselgt: case opCselge:
+        case opHalt: case opDbg:
+            return false;
+        case opCall: case opFcall: case opFret:
+            return di->ka != okImm;
+        default:
+            return true;
+    }
+}
+
+// The target of a jump or call through an immediate value or of a compare and branch
+static u64 VM_aot_target(const DecodedInstruction *di)
+{
+    const Instruction *instr = &di->instr;
+    if (VM_OP_BRANCH(instr->opc))
+        return di->iip + instr->itg;
+    return di->iip + VM_read(&instr->iu, (instr->rmd == amReg)? instr->imd : instr->ims);
+}
+
+static void VM_aot_mark(Aot *aot, u32 count)
+{
+    VM *vm = aot->vm;
+    bool indirect = false;
+
+    for (u32 i = 0; i < count; i++) {
+        const DecodedInstruction *di = &vm->decoded[i];
+        u8 opc = di->instr.opc;
+
+        if (di->op == VM_DECODE_TRAP || di->op == VM_DECODE_UNKNOWN)
+            continue;
+
+        if (VM_aot_uses_ip(di)) {
+            indirect = true;
+        }
+        else if (opc == opCall || opc == opFcall || (opc >= opJmp && opc <= opJmps) ||
+                 VM_OP_BRANCH(opc)) {
+            if (di->ka == okImm || VM_OP_BRANCH(opc)) {
+                u32 target = VM_aot_index(aot, VM_aot_target(di));
+                if (target != VM_DECODE_INVALID)
+                    aot->marks[target] |= AOT_LABEL;
+            }
+            else {
+                indirect = true;
+            }
+        }
+
+        // return addresses
+        if (opc == opCall || opc == opFcall || opc == opNcall)
+            aot->marks[i + 1] |= AOT_DISPATCH;
+    }
+
+    // entry point and the return address of the entry point
+    aot->marks[0] |= AOT_DISPATCH;
+    aot->marks[count] |= AOT_DISPATCH;
+
+    if (indirect) {
+        for (u32 i = 0; i <= count; i++)
+            aot->marks[i] |= AOT_DISPATCH;
+    }
+}
+
+static void VM_aot_operand(Aot *aot, const DecodedInstruction *di, bool a)
+{
+    const Instruction *instr = &di->instr;
+    AotExpr off;
+
+    switch (a? di->ka : di->kb) {
+        case okRegMem:
+            if (a || instr->ii == 0) {
+                fprintf(aot->fp, "        void *p%c = MEM(vm, R_%s);\n",
+                        a? 'A' : 'B', vmRegisterNameTbl[a? instr->ra : instr->rb]);
+            }
+            else {
+                VM_aot_int(off, instr->ii);
+                fprintf(aot->fp, "        void *pB = MEM(vm, R_%s + (%s));\n",
+                        vmRegisterNameTbl[instr->rb], off);
+            }
+            break;
+        case okImmMem:
+            fprintf(aot->fp, "        void *p%c = MEM(vm, %" PRIu32 "u);\n",
+                    a? 'A' : 'B', (u32) instr->iu);
+            break;
+        default:
+            break;
+    }
+}
+
+// Resolves the memory operands of the instruction in the order the interpreter does
+static void VM_aot_operands(Aot *aot, const DecodedInstruction *di)
+{
+    VM_aot_operand(aot, di, true);
+    VM_aot_operand(aot, di, false);
+}
+
+static void VM_aot_read(const DecodedInstruction *di, bool a, Mode mode, AotExpr out)
+{
+    const Instruction *instr = &di->instr;
+
+    switch (a? di->ka : di->kb) {
+        case okReg:
+            if (mode == szQuad)
+                snprintf(out, sizeof(AotExpr), "(i64) R_%s", vmRegisterNameTbl[a? instr->ra : instr->rb]);
+            else
+                snprintf(out, sizeof(AotExpr), "(i64) (%s) R_%s",
+                         vmAotModeTypesTbl[mode], vmRegisterNameTbl[a? instr->ra : instr->rb]);
+            break;
+        case okRegMem:
+        case okImmMem:
+            snprintf(out, sizeof(AotExpr), "VM_read(p%c, %s)", a? 'A' : 'B', vmAotModeNamesTbl[mode]);
+            break;
+        case okImm:
+            VM_aot_int(out, VM_read(&instr->iu, mode));
+            break;
+        default:
+            unreachable();
+    }
+}
+
+// Writes the value \param value to argument A of the instruction
+static void VM_aot_write(Aot *aot, const DecodedInstruction *di, Mode mode, const char *value)
+{
+    const char *reg = vmRegisterNameTbl[di->instr.ra];
+
+    switch (di->ka) {
+        case okReg:
+            if (mode == szQuad)
+                fprintf(aot->fp, "        R_%s = (u64) (%s);\n", reg, value);
+            else
+                fprintf(aot->fp, "        R_%s = (R_%s & ~(u64) %s) | (%s) (%s);\n",
+                        reg, reg, vmAotModeMasksTbl[mode], vmAotModeUTypesTbl[mode], value);
+            break;
+        case okRegMem:
+        case okImmMem:
+            fprintf(aot->fp, "        VM_write(pA, %s, %s);\n", value, vmAotModeNamesTbl[mode]);
+            break;
+        case okImm:
+            // the interpreter writes to a copy of the immediate value
+            fprintf(aot->fp, "        (void) (%s);\n", value);
+            break;
+        default:
+            unreachable();
+    }
+}
+
+// Jumps to \param target if \param cond holds, \param cond is NULL for unconditional jumps
+static void VM_aot_goto(Aot *aot, u64 target, const char *cond)
+{
+    u32 idx = VM_aot_index(aot, target);
+
+    if (cond) fprintf(aot->fp, "    if (%s) ", cond);
+    else fputs("    ", aot->fp);
+
+    if (idx != VM_DECODE_INVALID)
+        fprintf(aot->fp, "goto L%" PRIu32 ";\n", aot->vm->decoded[idx].iip);
+    else
+        fprintf(aot->fp, "{ REG(vm, ip) = %" PRIu64 "u; goto vmDispatch; }\n", target);
+}
+
+static const char *VM_aot_cond(u8 opc)
+{
+    switch (opc) {
+        case opJmpz:  return "R_flg & flgZero";
+        case opJmpnz: return "!(R_flg & flgZero)";
+        case opJmpg:  return "R_flg & flgGreater";
+        case opJmps:  return "R_flg & flgLess";
+        default:      return NULL;
+    }
+}
+
+// The comparison of compare and branch instructions, unsigned ones compare in the width of the mode
+static const char *VM_aot_compare(u8 opc, bool *isUnsigned)
+{
+    *isUnsigned = opc >= opJltu;
+    switch (opc) {
+        case opJeq:  return "==";
+        case opJne:  return "!=";
+        case opJlt:
+        case opJltu: return "<";
+        case opJle:
+        case opJleu: return "<=";
+        case opJgt:
+        case opJgtu: return ">";
+        case opJge:
+        case opJgeu: return ">=";
+        default:
+            unreachable();
+    }
+}
+
+// The condition tested on the flags by `set<cc>` and `csel<cc>`
+static const char *VM_aot_select(u8 opc)
+{
+    switch (opc) {
+        case opSeteq: case opCseleq: return "(R_flg & flgZero) != 0";
+        case opSetne: case opCselne: return "(R_flg & flgZero) == 0";
+        case opSetlt: case opCsellt: return "(R_flg & flgLess) != 0";
+        case opSetle: case opCselle: return "(R_flg & (flgLess | flgZero)) != 0";
+        case opSetgt: case opCselgt: return "(R_flg & flgGreater) != 0";
+        case opSetge: case opCselge: return "(R_flg & (flgGreater | flgZero)) != 0";
+        default:
+            unreachable();
+    }
+}
+
+static const char *VM_aot_binary(u8 opc)
+{
+    switch (opc) {
+#define XX(N, O) case op##N: return #O;
+        XX(Add, +) XX(Sub, -) XX(And, &&) XX(Or, ||) XX(Sar, >>) XX(Sal, <<)
+        XX(Xor, ^) XX(Bor, |) XX(Band, &) XX(Mul, *) XX(Div, /) XX(Mod, %)
+#undef XX
+        default:
+            return NULL;
+    }
+}
+
+static void VM_aot_instruction(Aot *aot, u32 i)
+{
+    FILE *fp = aot->fp;
+    const DecodedInstruction *di = &aot->vm->decoded[i];
+    const Instruction *instr = &di->instr;
+    Mode ma = instr->imd, mb = (instr->rmd == amReg)? instr->imd : instr->ims;
+    AotExpr a, b;
+    AotValue value;
+
+    if (aot->marks[i])
+        fprintf(fp, "L%" PRIu32 ":\n", di->iip);
+    fprintf(fp, "    // %08" PRIu32 ": ", di->iip);
+    VM_code_print_instruction_(instr, fp);
+    fputc('\n', fp);
+
+    if (VM_aot_steps(di)) {
+        fprintf(fp, "    VM_AOT_STEP(%" PRIu32 ", %" PRIu32 "u);\n", i, di->nip);
+        return;
+    }
+
+    switch (instr->opc) {
+        case opHalt:
+            fprintf(fp, "    VM_AOT_SYNC();\n"
+                        "    REG(vm, ip) = %" PRIu32 "u;\n"
+                        "    vm->flags = eflHalt;\n"
+                        "    return;\n", di->nip);
+            return;
+
+        case opDbg:
+            return;
+
+        case opJmp: case opJmpz: case opJmpnz: case opJmpg: case opJmps:
+            if (di->ka == okImm) {
+                VM_aot_goto(aot, VM_aot_target(di), VM_aot_cond(instr->opc));
+                return;
+            }
+            fprintf(fp, "    if (%s) {\n", VM_aot_cond(instr->opc)?: "1");
+            VM_aot_operands(aot, di);
+            VM_aot_read(di, true, mb, a);
+            fprintf(fp, "        REG(vm, ip) = %" PRIu32 "u + %s;\n"
+                        "        goto vmDispatch;\n"
+                        "    }\n", di->iip, a);
+            return;
+
+        case opCall:
+        case opFcall:
+            fprintf(fp, "    VM_aot_push(vm, &R_sp, %" PRIu32 ");\n"
+                        "    VM_aot_push(vm, &R_sp, R_bp);\n"
+                        "    R_bp = R_sp;\n", di->nip);
+            VM_aot_goto(aot, VM_aot_target(di), NULL);
+            return;
+
+        case opFret:
+            fprintf(fp, "    {\n"
+                        "        u64 top = R_bp + %" PRIu32 "u;\n"
+                        "        if (top > vm->ram.size)\n"
+                        "            VM_abort(vm, \"VM stack memory underflow - escapes virtual machine memory\");\n"
+                        "        REG(vm, ip) = ((u64 *) MEM(vm, R_bp))[1];\n"
+                        "        R_bp = ((u64 *) MEM(vm, R_bp))[0];\n"
+                        "        R_sp = top;\n"
+                        "        goto vmDispatch;\n"
+                        "    }\n", 16 + (((u8) instr->ii) << 3));
+            return;
+
+        default:
+            break;
+    }
+
+    fputs("    {\n", fp);
+    VM_aot_operands(aot, di);
+    switch (instr->opc) {
+        case opMov:
+            VM_aot_read(di, false, mb, b);
+            VM_aot_write(aot, di, ma, b);
+            break;
+
+        case opCmp:
+            VM_aot_read(di, true, ma, a);
+            VM_aot_read(di, false, mb, b);
+            fprintf(fp, "        i64 a = %s, b = %s;\n"
+                        "        R_flg = (a == b)? flgZero : ((a < b)? flgLess : flgGreater);\n", a, b);
+            break;
+
+        case opJeq: case opJne: case opJlt: case opJle: case opJgt: case opJge:
+        case opJltu: case opJleu: case opJgtu: case opJgeu: {
+            bool isUnsigned;
+            const char *op = VM_aot_compare(instr->opc, &isUnsigned);
+            VM_aot_read(di, true, ma, a);
+            VM_aot_read(di, false, mb, b);
+            if (isUnsigned)
+                snprintf(value, sizeof(value), "(%s) (%s) %s (%s) (%s)", vmAotModeUTypesTbl[ma], a, op,
+                         vmAotModeUTypesTbl[ma], b);
+            else
+                snprintf(value, sizeof(value), "(%s) %s (%s)", a, op, b);
+            VM_aot_goto(aot, VM_aot_target(di), value);
+            break;
+        }
+
+        case opDjnz:
+            VM_aot_read(di, true, ma, a);
+            fprintf(fp, "        i64 v = %s - 1;\n", a);
+            VM_aot_write(aot, di, ma, "v");
+            snprintf(value, sizeof(value), "(%s) v != 0", vmAotModeUTypesTbl[ma]);
+            VM_aot_goto(aot, VM_aot_target(di), value);
+            break;
+
+        case opSeteq: case opSetne: case opSetlt: case opSetle: case opSetgt: case opSetge:
+            VM_aot_write(aot, di, ma, VM_aot_select(instr->opc));
+            break;
+
+        case opCseleq: case opCselne: case opCsellt: case opCselle: case opCselgt: case opCselge:
+            VM_aot_read(di, true, ma, a);
+            VM_aot_read(di, false, mb, b);
+            snprintf(value, sizeof(value), "(%s)? (%s) : (%s)", VM_aot_select(instr->opc), b, a);
+            VM_aot_write(aot, di, ma, value);
+            break;
+
+        case opNot: case opBNot: case opInc: case opDec:
+            VM_aot_read(di, true, mb, a);
+            snprintf(value, sizeof(value), "%s%s%s",
+                     (instr->opc == opNot)? "!" : (instr->opc == opBNot)? "~" : "",
+                     a,
+                     (instr->opc == opInc)? " + 1" : (instr->opc == opDec)? " - 1" : "");
+            VM_aot_write(aot, di, ma, value);
+            break;
+
+        case opPush:
+            VM_aot_read(di, true, mb, a);
+            fprintf(fp, "        VM_aot_push(vm, &R_sp, %s);\n", a);
+            break;
+
+        case opPop:
+            VM_aot_write(aot, di, mb, "VM_aot_pop(vm, &R_sp)");
+            break;
+
+        case opPopn:
+            VM_aot_read(di, true, mb, a);
+            fprintf(fp, "        VM_aot_popn(vm, &R_sp, (u8) (%s));\n", a);
+            break;
+
+        default:
+            VM_aot_read(di, true, ma, a);
+            VM_aot_read(di, false, mb, b);
+            snprintf(value, sizeof(value), "%s %s %s", a, VM_aot_binary(instr->opc), b);
+            VM_aot_write(aot, di, ma, value);
+            break;
+    }
+    fputs("    }\n", fp);
+}
+
+static void VM_aot_registers(FILE *fp, const char *fmt)
+{
+    for (Register r = r0; r < regCOUNT; r++) {
+        if (r == ip) continue;
+        fprintf(fp, fmt, vmRegisterNameTbl[r], vmRegisterNameTbl[r]);
+    }
+}
+
+void VM_aot_translate(Code *code, FILE *fp, u64 mem, u64 max, u32 ss)
+{
+    VM vm = {.code = code};
+    Aot aot = {.fp = fp, .vm = &vm};
+    u32 len = Vector_len(code), count;
+
+    VM_decode(&vm);
+    count = vm.dmap[len];
+    aot.marks = calloc(count + 1, sizeof(u8));
+    if (aot.marks == NULL)
+        VM_abort(&vm, "Out of memory, translating %u instructions failed", count);
+    VM_aot_mark(&aot, count);
+
+    fputs("/**\n"
+          " * Generated by cynvm aot, do not edit.\n"
+          " */\n\n"
+          "#include <vm/aot.h>\n\n", fp);
+
+    fprintf(fp, "static const u8 vmImage[%" PRIu32 "] = {", len);
+    for (u32 i = 0; i < len; i++)
+        fprintf(fp, "%s0x%02x,", (i % 16)? " " : "\n    ", *Vector_at(code, i));
+    fputs("\n};\n\n", fp);
+
+    fputs("// Copies the registers kept in locals to the virtual machine\n"
+          "#define VM_AOT_SYNC() \\\n", fp);
+    VM_aot_registers(fp, "    REG(vm, %s) = R_%s; \\\n");
+    fputs("\n// Reloads the registers kept in locals\n"
+          "#define VM_AOT_LOAD() \\\n", fp);
+    VM_aot_registers(fp, "    R_%s = REG(vm, %s); \\\n");
+    fputs("\n// Executes the instruction at index I in the interpreter\n"
+          "#define VM_AOT_STEP(I, NIP) \\\n"
+          "    VM_AOT_SYNC(); \\\n"
+          "    VM_step(vm, &vm->decoded[(I)]); \\\n"
+          "    VM_AOT_LOAD(); \\\n"
+          "    if (REG(vm, ip) != (NIP)) goto vmDispatch\n\n", fp);
+
+    fputs("static void vmEntry(VM *vm)\n{\n", fp);
+    VM_aot_registers(fp, "    u64 R_%s = REG(vm, %s);\n");
+    fputs("\n    goto vmDispatch;\n\n", fp);
+
+    // the last instruction is the halt at the end of code space
+    for (u32 i = 0; i <= count; i++)
+        VM_aot_instruction(&aot, i);
+
+    fputs("\nvmDispatch:\n"
+          "    switch (REG(vm, ip)) {\n", fp);
+    for (u32 i = 0; i <= count; i++) {
+        if (aot.marks[i] & AOT_DISPATCH)
+            fprintf(fp, "        case %" PRIu32 ": goto L%" PRIu32 ";\n", vm.decoded[i].iip, vm.decoded[i].iip);
+    }
+    fputs("        default:\n"
+          "            VM_AOT_SYNC();\n"
+          "            VM_aot_bad_target(vm);\n"
+          "    }\n"
+          "}\n\n", fp);
+
+    fprintf(fp, "int main(int argc, char *argv[])\n"
+                "{\n"
+                "    return VM_aot_main(vmImage, sizeof(vmImage), vmEntry,\n"
+                "                       %" PRIu64 "u, %" PRIu64 "u, %" PRIu32 "u, argc - 1, argv + 1);\n"
+                "}\n", mem, max, ss);
+
+    free(aot.marks);
+    VM_decode_release(&vm);
+}
+
+int VM_aot_main(const u8 *image, u32 size, VirtualMachineAotEntry entry,
+                u64 mem, u64 max, u32 ss, int argc, char *argv[])
+{
+    VM vm = {0};
+    Code code;
+
+    Vector_init(&code);
+    Vector_pushArr(&code, (u8 *) image, size);
+
+    VM_init_(&vm, &code, mem, max, CYN_VM_HEAP_DEFAULT_ALLOCATOR, CYN_VM_HEAP_DEFAULT_NHBS, ss);
+    VM_enter(&vm, argc, argv);
+    entry(&vm);
+
+    VM_deinit(&vm);
+    Vector_deinit(&code);
+    return EXIT_SUCCESS;
+}
+
+void VM_aot_bad_target(VM *vm)
+{
+    // aborts if the target is not an instruction boundary
+    VM_decoded_at(vm, REG(vm, ip));
+    VM_abort(vm, "execution jumps to %08" PRIu64 " which is not a known jump target", REG(vm, ip));
+}
@@ -213,8 +213,12 @@ u32 Builder_link(Builder *builder, Code *code)
         RbTreeNode *it;
         Instruction *instr = Vector_at(&builder->instructions, i);
 
+        // compare and branch instructions reference labels through their target
         if (RbTree_find_(&builder->patchWork.base, &make(Patch, .f = i), 0) != NULL) {
-            instr->ii -= ip;
+            if (VM_OP_BRANCH(instr->opc))
+                instr->itg -= ip;
+            else
+                instr->ii -= ip;
         }
 
         it = RbTree_find_(&refs.base, &make(RefList_t, .f = i), 0);
@@ -222,13 +226,21 @@ u32 Builder_link(Builder *builder, Code *code)
             RefList_t *rfl = RbTree_ref(&refs, it);
             Vector_foreach(&rfl->s, j) {
                 Instruction *ins = Vector_at(&builder->instructions, j);
-                ins->ii += ip;
+                if (VM_OP_BRANCH(ins->opc))
+                    ins->itg += ip;
+                else
+                    ins->ii += ip;
             }
         }
 
         ip += instr->osz;
+        // extended op codes are preceded by VM_OP_EXT
+        if (instr->opc >= VM_OP_PAGE)
+            ip++;
         if (instr->rmd == amImm || instr->iea)
             ip += vmSizeTbl[instr->ims];
+        if (VM_OP_BRANCH(instr->opc))
+            ip += sizeof(i32);
     }
 
     VM_code_append_(code, Vector_begin(&builder->instructions), Vector_len(&builder->instructions));
@@ -256,9 +268,11 @@ static void Builder_init(Builder *builder, Log *L)
     // the position of the number of function arguments in stack
     Builder_define(builder, "argc", 16);
     Builder_define(builder, "argv", 24);
+    // the position of the first argument in a frame pushed by `fcall`
+    Builder_define(builder, "fargs", 16);
 
     // define builtin variables
-#define XX(I, N) Builder_define(builder, "__"#N, (u64)bnc##I);
+#define XX(I, N, ...) Builder_define(builder, "__"#N, (u64)bnc##I);
 #define UU(...)
     VM_NATIVE_OS_FUNCS(XX, UU)
 #undef UU
@@ -22,8 +22,8 @@
 
 #include <sys/socket.h>
 
-#define XX(I, N) static void vmBnc##I (VM *vm, const Value *args, u32 nargs);
-#define UU(I, N) void vmBnc##I (VM *vm, const Value *args, u32 nargs)    \
+#define XX(I, N, ...) static void vmBnc##I (VM *vm, const Value *args, u32 nargs);
+#define UU(I, N, ...) void vmBnc##I (VM *vm, const Value *args, u32 nargs)    \
 {                                                                        \
     VM_assert(vm, false, "Builtin native call '" #N "' not implemented"); \
 }
@@ -34,20 +34,45 @@ VM_NATIVE_OS_FUNCS(XX, UU)
 #undef XX
 
 NativeCall vmNativeBuiltinCallTbl[] = {
-#define XX(I, N) vmBnc##I,
+#define XX(I, N, ...) vmBnc##I,
     VM_NATIVE_OS_FUNCS(XX, XX)
     NULL,
 #undef XX
 };
 
+const NativeSignature vmNativeBuiltinSignatureTbl[] = {
+#define XX(I, N, MIN, MAX) { .min = MIN, .max = MAX },
+    VM_NATIVE_OS_FUNCS(XX, XX)
+    { 0 },
+#undef XX
+};
+
+static const char *vmNativeBuiltinNamesTbl[] = {
+#define XX(I, N, ...) #N,
+    VM_NATIVE_OS_FUNCS(XX, XX)
+    NULL,
+#undef XX
+};
+
+void VM_native_check(VM *vm, uptr id, u32 nargs)
+{
+    const NativeSignature *sig;
+    if (id >= bncCOUNT)
+        return;
+
+    sig = &vmNativeBuiltinSignatureTbl[id];
+    if (nargs < sig->min || nargs > sig->max) {
+        VM_abort(vm, "Builtin native call '%s' takes %u to %u arguments, got %u",
+                 vmNativeBuiltinNamesTbl[id], sig->min, sig->max, nargs);
+    }
+}
+
 void vmBncWrite(VM *vm, const Value *args, u32 nargs)
 {
     int fd;
     void *src;
     ssize_t size;
 
-    VM_assert(vm, nargs == 3, "BncWrite requires at 3 arguments");
-
     fd = v2i(args[0]);
     src = (void *) v2p(args[-1]);
     size = v2i(args[-2]);
@@ -62,8 +87,6 @@ void vmBncRead(VM *vm, const Value *args, u32 nargs)
     void *src;
     ssize_t size;
 
-    VM_assert(vm, nargs == 3, "BncRead requires at 3 arguments");
-
     fd = v2i(args[0]);
     src = (void *)v2p(args[-1]);
     size = v2i(args[-2]);
@@ -79,8 +102,6 @@ void vmBncOpen(VM *vm, const Value *args, u32 nargs)
     int flags;
     mode_t mode = 0640;
 
-    VM_assert(vm, nargs == 2 || nargs == 3, "BncOpen requires at least 2 arguments");
-
     path = (void *)v2p(args[0]);
     flags = v2i(args[-1]);
     if (nargs == 3) mode = v2i(args[-2]);
@@ -94,8 +115,6 @@ void vmBncClose(VM *vm, const Value *args, u32 nargs)
 {
     int fd;
 
-    VM_assert(vm, nargs == 1, "BncClose requires 1 argument");
-
     fd = v2i(args[0]);
     fd = close(fd);
 
@@ -108,8 +127,6 @@ void vmBncStat(VM *vm, const Value *args, u32 nargs)
     void *path;
     struct stat *st;
 
-    VM_assert(vm, nargs == 2, "BncStat requires 2 arguments");
-
     path = (void *)v2p(args[0]);
     st = (struct stat*) v2p(args[-1]);
 
@@ -124,8 +141,6 @@ void vmBncLstat(VM *vm, const Value *args, u32 nargs)
     void *path;
     struct stat *st;
 
-    VM_assert(vm, nargs == 2, "BncLstat requires 2 arguments");
-
     path = (void *)v2p(args[0]);
     st = (struct stat*) v2p(args[-1]);
 
@@ -139,8 +154,6 @@ void vmBncFstat(VM *vm, const Value *args, u32 nargs)
     int fd;
     struct stat *st;
 
-    VM_assert(vm, nargs == 2, "BncFstat requires 2 arguments");
-
     fd = v2i(args[0]);
     st = (struct stat*) v2p(args[-1]);
 
@@ -155,8 +168,6 @@ void vmBncPoll(VM *vm, const Value *args, u32 nargs)
     nfds_t nfds;
     int timeout, ret;
 
-    VM_assert(vm, nargs == 3, "BncPoll requires 3 arguments");
-
     fds = (struct pollfd *) v2i(args[0]);
     nfds = v2i(args[-1]);
     timeout = v2i(args[-2]);
@@ -172,8 +183,6 @@ void vmBncLseek(VM *vm, const Value *args, u32 nargs)
     off_t offset;
     int whence;
 
-    VM_assert(vm, nargs == 3, "BncLseek requires 3 arguments");
-
     fd = v2i(args[0]);
     offset = v2i(args[-1]);
     whence = v2i(args[-2]);
@@ -187,8 +196,6 @@ void vmBncPipe(VM *vm, const Value *args, u32 nargs)
 {
     int *pipefd, ret;
 
-    VM_assert(vm, nargs == 1, "BncPipe requires 1 argument");
-
     pipefd =  (void *) v2p(args[0]);;
 
     ret = pipe(pipefd);
@@ -202,8 +209,6 @@ void vmBncSelect(VM *vm, const Value *args, u32 nargs)
     fd_set *readfds, *writefds, *exceptfds;
     struct timeval *timeout;
 
-    VM_assert(vm, nargs == 5, "BncSelect requires 5 arguments");
-
     nfds = v2i(args[0]);;
     readfds = (void *)v2p(args[-1]);
     writefds = (void *)v2p(args[-2]);
@@ -219,8 +224,6 @@ void vmBncDup(VM *vm, const Value *args, u32 nargs)
 {
     int fd;
 
-    VM_assert(vm, nargs == 1, "BncDup requires 1 argument");
-
     fd =  v2i(args[0]);;
 
     fd = dup(fd);
@@ -232,8 +235,6 @@ void vmBncDup2(VM *vm, const Value *args, u32 nargs)
 {
     int fd, newfd;
 
-    VM_assert(vm, nargs == 1, "BncDup2 requires 1 argument");
-
     fd =  v2i(args[0]);;
     newfd =  v2i(args[-1]);;
 
@@ -244,8 +245,6 @@ void vmBncDup2(VM *vm, const Value *args, u32 nargs)
 
 void vmBncGetpid(VM *vm, const Value *args, u32 nargs)
 {
-    VM_assert(vm, nargs == 0, "BncGetpid requires 0 arguments");
-
     VM_return(vm, u2v(getpid()));
 }
 
@@ -257,8 +256,6 @@ void vmBncSendfile(VM *vm, const Value *args, u32 nargs)
     off_t *offset;
     size_t count;
 
-    VM_assert(vm, nargs == 4, "BncSendfile requires 4 argument");
-
     outfd = v2i(args[0]);
     infd = v2i(args[-1]);
     offset = (void *)v2p(args[-2]);
@@ -276,8 +273,6 @@ void vmBncSocket(VM *vm, const Value *args, u32 nargs)
 {
     int fd, domain, type, protocol;
 
-    VM_assert(vm, nargs == 3, "BncSocket requires 3 arguments");
-
     domain = v2i(args[0]);
     type = v2i(args[-1]);
     protocol = v2i(args[-2]);
@@ -292,8 +287,6 @@ void vmBncConnect(VM *vm, const Value *args, u32 nargs)
     struct sockaddr *addr;
     socklen_t addrlen;
 
-    VM_assert(vm, nargs == 3, "BncConnect requires 3 arguments");
-
     fd = v2i(args[0]);
     addr = (void *)v2p(args[-1]);
     addrlen = v2u(args[-2]);
@@ -309,8 +302,6 @@ void vmBncAccept(VM *vm, const Value *args, u32 nargs)
     struct sockaddr *addr;
     socklen_t *addrlen;
 
-    VM_assert(vm, nargs == 3, "BncConnect requires 3 arguments");
-
     fd = v2i(args[0]);
     addr = (void *)v2p(args[-1]);
     addrlen = (void *)v2u(args[-2]);
@@ -331,7 +322,6 @@ void vmBncSendto(VM *vm, const Value *args, u32 nargs)
     socklen_t addrlen;
 
 
-    VM_assert(vm, nargs == 6, "BncSendto requires 6 arguments");
 
     sock = v2i(args[0]);
     message = (void *) v2p(args[-1]);
@@ -356,7 +346,6 @@ void vmBncRecvfrom(VM *vm, const Value *args, u32 nargs)
     socklen_t *addrlen;
 
 
-    VM_assert(vm, nargs == 6, "BncRecvfrom requires 6 arguments");
 
     sock = v2i(args[0]);
     message = (void *) v2p(args[-1]);
@@ -374,8 +363,6 @@ void vmBncShutdown(VM *vm, const Value *args, u32 nargs)
 {
     int fd, how;
 
-    VM_assert(vm, nargs == 2, "BncShutdown requires 2 arguments");
-
     fd = v2i(args[0]);
     how = v2i(args[-1]);
 
@@ -390,8 +377,6 @@ void vmBncBind(VM *vm, const Value *args, u32 nargs)
     struct sockaddr *addr;
     socklen_t addrlen;
 
-    VM_assert(vm, nargs == 3, "BncBind requires 3 arguments");
-
     fd = v2i(args[0]);
     addr = (void *)v2p(args[-1]);
     addrlen = v2u(args[-2]);
@@ -405,8 +390,6 @@ void vmBncListen(VM *vm, const Value *args, u32 nargs)
 {
     int fd, backlog;
 
-    VM_assert(vm, nargs == 2, "BncListen requires 2 arguments");
-
     fd = v2i(args[0]);
     backlog = v2i(args[-1]);
 
@@ -421,8 +404,6 @@ void vmBncGetsockname(VM *vm, const Value *args, u32 nargs)
     struct sockaddr *addr;
     socklen_t *addrlen;
 
-    VM_assert(vm, nargs == 3, "BncGetsockname requires 3 arguments");
-
     fd = v2i(args[0]);
     addr = (void *)v2p(args[-1]);
     addrlen = (void *)v2p(args[-2]);
@@ -438,8 +419,6 @@ void vmBncGetpeername(VM *vm, const Value *args, u32 nargs)
     struct sockaddr *addr;
     socklen_t *addrlen;
 
-    VM_assert(vm, nargs == 3, "BncGetpeername requires 3 arguments");
-
     fd = v2i(args[0]);
     addr = (void *)v2p(args[-1]);
     addrlen = (void *)v2p(args[-2]);
@@ -453,8 +432,6 @@ void vmBncFcntl(VM *vm, const Value *args, u32 nargs)
 {
     int fd, cmd;
 
-    VM_assert(vm, nargs == 2 || nargs == 3, "BncFcntl requires 2 or 3 arguments");
-
     fd = v2i(args[0]);
     cmd = v2i(args[-1]);
     if (nargs == 2) {
@@ -14,6 +14,8 @@ void VM_code_append_(Code *code, const Instruction *seq, u32 sz)
 {
     for (int i  = 0; i < sz; i++) {
         const Instruction *ins = &seq[i];
+        if (ins->opc >= VM_OP_PAGE)
+            Vector_push(code, VM_OP_EXT);
         Vector_push(code, ins->b1);
         if (ins->osz > 1)
             Vector_push(code, ins->b2);
@@ -25,6 +27,10 @@ void VM_code_append_(Code *code, const Instruction *seq, u32 sz)
             void *dst = Vector_expand(code, vmSizeTbl[ims]);
             VM_write(dst, ins->ii, ims);
         }
+
+        // compare and branch instructions end with the target of the branch
+        if (VM_OP_BRANCH(ins->opc))
+            memcpy(Vector_expand(code, sizeof(i32)), &ins->itg, sizeof(i32));
     }
 }
 
@@ -58,20 +64,28 @@ void VM_code_disassemble_(Code *code, FILE *fp, bool showAddr)
 
 u32 VM_code_instruction_at(const Code *code, Instruction *instr, u32 iip) {
     u32 start = iip;
+    bool ext;
     if (iip + 1 > Vector_len(code)) {
         instr->osz = 0;
         return 0;
     }
 
+    ext = *Vector_at(code, iip) == VM_OP_EXT;
+    if (ext && ++iip + 1 > Vector_len(code)) {
+        instr->osz = 0;
+        return 0;
+    }
+
     instr->b1 = *Vector_at(code, iip++);
+    instr->opc = (instr->opc & (VM_OP_PAGE - 1)) | (ext? VM_OP_PAGE : 0);
 
-    if ((start + instr->osz) > Vector_len(code)) {
+    if ((iip - 1 + instr->osz) > Vector_len(code)) {
         instr->osz = 0;
         return 0;
     }
 
     if (instr->osz <= 1)
-        return instr->osz;
+        return instr->osz? iip - start : 0;
 
     instr->b2 = *Vector_at(code, iip++);
     if (instr->osz == 2 && instr->rmd == amImm) {
@@ -84,6 +98,11 @@ u32 VM_code_instruction_at(const Code *code, Instruction *instr, u32 iip) {
     }
 
     if (instr->rmd == amImm || instr->iea) {
+        if ((iip + vmSizeTbl[instr->ims]) > Vector_len(code)) {
+            instr->osz = 0;
+            return 0;
+        }
+
         switch (instr->ims) {
             case szByte:
                 instr->ii = (i64) *((i8 *) Vector_at(code, iip));
@@ -105,6 +124,15 @@ u32 VM_code_instruction_at(const Code *code, Instruction *instr, u32 iip) {
                 unreachable();
         }
     }
+
+    if (VM_OP_BRANCH(instr->opc)) {
+        if ((iip + sizeof(i32)) > Vector_len(code)) {
+            instr->osz = 0;
+            return 0;
+        }
+        memcpy(&instr->itg, Vector_at(code, iip), sizeof(i32));
+        iip += sizeof(i32);
+    }
     return iip - start;
 }
 
@@ -0,0 +1,362 @@
+/**
+ * Copyright (c) 2022 Suilteam, Carter Mbotho
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the MIT license. See LICENSE for details.
+ *
+ * @author Carter
+ * @date 2022-12-20
+ */
+
+#include "vm/vm.h"
+#include "vm/instr.h"
+#include "vm/builtins.h"
+
+#include <stdlib.h>
+
+#define VM_DECODE_ALIGNMENT 64
+
+static i32 VM_decode_specialized_op(u8 opc)
+{
+    switch (opc) {
+#define XX(N) case op##N: return sop##N;
+        VM_SPECIALIZED_OPS(XX, XX)
+#undef XX
+        default:
+            return -1;
+    }
+}
+
+/**
+ * Selects the handler specialized for the mode and operand forms of
+ * the given instruction if there is one. Immediate values are sign extended
+ * to 64-bits when decoded, so `ims` is not part of the form.
+ */
+static void VM_decode_specialize(DecodedInstruction *di)
+{
+    i32 sop = VM_decode_specialized_op(di->instr.opc);
+    i32 form = -1;
+
+    if (sop < 0) return;
+
+    if (di->instr.osz == 3) {
+        u8 a = di->ka == okReg? 0 : 3;
+        switch (di->kb) {
+            case okReg: form = sfRR + a; break;
+            case okRegMem: form = sfRM + a; break;
+            case okImm: form = sfRI + a; break;
+            default: return;
+        }
+    }
+    else if (di->instr.osz == 2) {
+        switch (di->ka) {
+            case okReg: form = sfR; break;
+            case okRegMem: form = sfM; break;
+            case okImm: form = sfI; break;
+            default: return;
+        }
+    }
+    else return;
+
+    di->op = VM_SPEC_KEY(sop, di->instr.imd, form);
+}
+
+static i32 VM_decode_fused_jump(const DecodedInstruction *di)
+{
+    // only jumps whose target was checked (\see VM_decode_targets)
+    if (di->ka != okImm || di->op < VM_SPEC_KEY(0, 0, 0)) return -1;
+    switch (di->instr.opc) {
+#define XX(N) case op##N: return fj##N;
+        VM_FUSED_JUMPS(XX)
+#undef XX
+        default:
+            return -1;
+    }
+}
+
+static bool VM_decode_is(const DecodedInstruction *di, u8 opc, u8 ka)
+{
+    return di->op != VM_DECODE_TRAP && di->op != VM_DECODE_UNKNOWN &&
+           di->op != VM_DECODE_STEP && di->instr.opc == opc && di->ka == ka;
+}
+
+static bool VM_decode_is_quad(const DecodedInstruction *di, u8 opc, u8 ka)
+{
+    return VM_decode_is(di, opc, ka) && di->instr.imd == szQuad;
+}
+
+// Whether `ncall` passing \param nargs arguments to \param id can run unchecked
+static bool VM_decode_arity(u64 nargs, u64 id)
+{
+    if (id >= bncCOUNT)
+        return true;
+    return nargs >= vmNativeBuiltinSignatureTbl[id].min &&
+           nargs <= vmNativeBuiltinSignatureTbl[id].max;
+}
+
+/**
+ * Replaces the dispatch key of instructions starting a known sequence with
+ * the key of the superinstruction executing the whole sequence. Only the
+ * first instruction is changed, the other instructions are left as is so
+ * that jumping into the middle of a sequence still works.
+ */
+static void VM_decode_fuse(DecodedInstruction *code, u32 count)
+{
+    const u16 cmp = VM_SPEC_KEY(sopCmp, 0, 0);
+
+    for (u32 i = 0; i + 1 < count; i++) {
+        DecodedInstruction *di = &code[i];
+        i32 fj;
+
+        if (di->op >= cmp && di->op < VM_SPEC_KEY(sopCmp + 1, 0, 0)) {
+            // compare followed by a conditional jump
+            if ((fj = VM_decode_fused_jump(&di[1])) >= 0)
+                di->op = VM_FUSE_CMP_KEY(fj, di->instr.imd, (di->op - cmp) % sfCOUNT);
+        }
+        else if (VM_decode_is(di, opPush, okImm) &&
+                 VM_decode_is(&di[1], opNcall, okImm) &&
+                 VM_decode_arity(di->instr.iu, di[1].instr.iu))
+        {
+            di->op = VM_FUSE_KEY(fsPushNcall);
+        }
+        else if (VM_decode_is(di, opPopn, okImm) &&
+                 VM_decode_is(&di[1], opPop, okReg))
+        {
+            di->op = VM_FUSE_KEY(fsPopnPop);
+        }
+        else if (i + 2 < count &&
+                 VM_decode_is_quad(di, opPush, okReg) &&
+                 VM_decode_is_quad(&di[1], opMov, okReg) &&
+                 (di[1].kb == okReg || di[1].kb == okImm) &&
+                 VM_decode_is_quad(&di[2], opPop, okReg))
+        {
+            di->op = VM_FUSE_KEY(fsPushMovPop);
+        }
+    }
+}
+
+static bool VM_decode_cached(u8 reg)
+{
+    return reg == ip || reg == sp || reg == bp || reg == flg;
+}
+
+/**
+ * The interpreter keeps `ip`, `sp`, `bp` and `flg` in locals, it writes `ip`
+ * back to the virtual machine lazily and the others as soon as they change.
+ * Instructions reading `ip` or changing any of them through an operand are
+ * executed by \see VM_step (\see VM_DECODE_STEP).
+ */
+static bool VM_decode_steps(const DecodedInstruction *di)
+{
+    const Instruction *instr = &di->instr;
+    bool a = di->ka == okRegMem || (di->ka == okReg && !VM_OP_VECTOR_A(instr->opc));
+    bool b = di->kb == okRegMem || (di->kb == okReg && !VM_OP_VECTOR_B(instr->opc));
+
+    if ((a && instr->ra == ip) || (b && instr->rb == ip))
+        return true;
+    return VM_OP_WRITES_A(instr->opc) && di->ka == okReg && VM_decode_cached(instr->ra);
+}
+
+static u32 VM_decode_instruction(const Code *code, DecodedInstruction *di, u32 iip)
+{
+    Instruction *instr = &di->instr;
+    u32 size;
+
+    memset(di, 0, sizeof(*di));
+    di->iip = iip;
+
+    size = VM_code_instruction_at(code, instr, iip);
+    if (size == 0) {
+        // truncated or invalid instruction, trap if it ever gets executed
+        di->op  = VM_DECODE_TRAP;
+        di->nip = Vector_len(code);
+        return 0;
+    }
+
+    di->nip = iip + size;
+    if (instr->opc >= opcCOUNT) {
+        di->op = VM_DECODE_UNKNOWN;
+        return size;
+    }
+
+    di->op  = instr->opc << 1;
+
+    switch (instr->osz) {
+        case 1:
+            break;
+        case 2:
+            if (instr->rmd == amReg) {
+                di->op |= 1;
+                di->ka = instr->iam? okRegMem : okReg;
+            }
+            else {
+                di->ka = instr->iam? okImmMem : okImm;
+            }
+            break;
+        case 3:
+            di->ka = instr->iam? okRegMem : okReg;
+            if (instr->rmd == amReg) {
+                di->op |= 1;
+                di->kb = instr->ibm? okRegMem : okReg;
+                // effective address offset only applies to memory references
+                if (!(instr->ibm && instr->iea))
+                    instr->ii = 0;
+            }
+            else {
+                di->kb = instr->ibm? okImmMem : okImm;
+            }
+            break;
+        default:
+            unreachable();
+    }
+
+    if (((di->ka == okReg || di->ka == okRegMem) && instr->ra >= regCOUNT) ||
+        ((di->kb == okReg || di->kb == okRegMem) && instr->rb >= regCOUNT))
+    {
+        // executing it would access registers that do not exist
+        di->op = VM_DECODE_UNKNOWN;
+        return size;
+    }
+
+    if (VM_OP_VECTOR(instr->opc) &&
+        (di->ka != okReg || (instr->opc == opVred && di->kb != okReg) ||
+         (VM_OP_VECTOR_A(instr->opc) && instr->ra >= VM_VREG_COUNT) ||
+         (di->kb == okReg && VM_OP_VECTOR_B(instr->opc) && instr->rb >= VM_VREG_COUNT)))
+    {
+        // vector registers that do not exist or operands in the wrong form
+        di->op = VM_DECODE_UNKNOWN;
+        return size;
+    }
+
+    // the frame pushed by `fcall`, the pushes of the called function are
+    // added when known (\see VM_stack_analyze)
+    if (instr->opc == opFcall)
+        di->stk = 16;
+
+    if (VM_decode_steps(di)) {
+        di->op = VM_DECODE_STEP;
+        return size;
+    }
+
+    VM_decode_specialize(di);
+    return size;
+}
+
+/**
+ * Specialized handlers of jumps through an immediate value and of compare
+ * and branch instructions do not check their target (\see VM_NEXT_DIRECT),
+ * those whose target is not an instruction boundary are handled by the
+ * generic handler instead.
+ */
+static void VM_decode_targets(VM *vm, u32 count)
+{
+    u32 len = Vector_len(vm->code);
+
+    for (u32 i = 0; i < count; i++) {
+        DecodedInstruction *di = &vm->decoded[i];
+        u64 target;
+
+        if (di->op >= VM_SPEC_KEY(sopJeq, 0, 0) && di->op < VM_SPEC_KEY(sopDjnz + 1, 0, 0))
+            target = di->iip + di->instr.itg;
+        else if (di->op >= VM_SPEC_KEY(sopJmp, 0, 0) && di->op < VM_SPEC_KEY(sopCOUNT, 0, 0) &&
+                 di->ka == okImm)
+            target = di->iip + di->instr.ii;
+        else
+            continue;
+
+        if (target > len || vm->dmap[target] == VM_DECODE_INVALID)
+            di->op = (di->instr.opc << 1) | (di->instr.rmd == amReg);
+    }
+}
+
+/**
+ * Resolves the native functions called through an immediate value into
+ * \see VirtualMachine.natives, so that calls need not look up builtins
+ */
+static void VM_decode_link(VM *vm, u32 count)
+{
+    u32 n = 0;
+
+    for (u32 i = 0; i < count; i++) {
+        DecodedInstruction *di = &vm->decoded[i];
+        if (VM_decode_is(di, opNcall, okImm) || VM_decode_is(di, opNcallr, okImm))
+            n++;
+    }
+    if (n == 0)
+        return;
+
+    vm->natives = malloc(sizeof(NativeCall) * n);
+    if (vm->natives == NULL)
+        VM_abort(vm, "Out of memory, linking %u native calls failed", n);
+
+    n = 0;
+    for (u32 i = 0; i < count; i++) {
+        DecodedInstruction *di = &vm->decoded[i];
+        uptr id;
+
+        if (!VM_decode_is(di, opNcall, okImm) && !VM_decode_is(di, opNcallr, okImm))
+            continue;
+
+        id = di->instr.iu;
+        vm->natives[n] = (id < bncCOUNT)? vmNativeBuiltinCallTbl[id] : (NativeCall) id;
+        di->nat = n++;
+        di->op = (di->instr.opc == opNcall)? VM_DECODE_NCALL : VM_DECODE_NCALLR;
+    }
+}
+
+void VM_decode(VM *vm)
+{
+    CodeHeader *header = (CodeHeader *) Vector_at(vm->code, 0);
+    u32 len = Vector_len(vm->code), count = 0, ip, i = 0;
+    DecodedInstruction tmp;
+
+    // First pass counts the number of instructions in code space
+    for (ip = header->db; ip < len; count++) {
+        u32 size = VM_decode_instruction(vm->code, &tmp, ip);
+        ip = size? ip + size : len;
+    }
+
+    vm->decoded = aligned_alloc(VM_DECODE_ALIGNMENT,
+                                CynAlign(sizeof(DecodedInstruction) * (count + 1), VM_DECODE_ALIGNMENT));
+    vm->dmap = malloc(sizeof(u32) * (len + 1));
+    if (vm->decoded == NULL || vm->dmap == NULL)
+        VM_abort(vm, "Out of memory, decoding %u instructions failed", count);
+
+    for (ip = 0; ip <= len; ip++)
+        vm->dmap[ip] = VM_DECODE_INVALID;
+
+    for (ip = header->db; ip < len; i++) {
+        u32 size = VM_decode_instruction(vm->code, &vm->decoded[i], ip);
+        vm->dmap[ip] = i;
+        ip = size? ip + size : len;
+    }
+
+    VM_decode_targets(vm, i);
+    VM_decode_link(vm, i);
+    vm->dmap[len] = i;
+
+#if !defined(CYN_VM_DEBUGGER)
+    // The debugger needs to see every instruction
+    VM_decode_fuse(vm->decoded, i);
+#endif
+
+    // Running past the last instruction stops the virtual machine
+    memset(&vm->decoded[i], 0, sizeof(DecodedInstruction));
+    vm->decoded[i].instr = cHALT();
+    vm->decoded[i].op    = opHalt << 1;
+    vm->decoded[i].iip   = len;
+    vm->decoded[i].nip   = len;
+    vm->dmap[len] = i;
+
+    VM_stack_analyze(vm, i);
+}
+
+void VM_decode_release(VM *vm)
+{
+    if (vm->decoded) free(vm->decoded);
+    if (vm->dmap) free(vm->dmap);
+    if (vm->natives) free(vm->natives);
+    vm->decoded = NULL;
+    vm->dmap = NULL;
+    vm->natives = NULL;
+}
@@ -0,0 +1,1272 @@
+/**
+ * Copyright (c) 2022 Suilteam, Carter Mbotho
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the MIT license. See LICENSE for details.
+ *
+ * @author Carter
+ * @date 2022-12-27
+ */
+
+#ifndef _GNU_SOURCE
+// names of the registers saved in signal contexts (\see VM_jit_fault_context)
+#define _GNU_SOURCE
+#endif
+
+#include "vm/jit.h"
+#include "vm/builtins.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+
+#if defined(CYN_VM_JIT) && defined(__x86_64__)
+
+#include <sys/mman.h>
+#include <ucontext.h>
+
+// Upper bound of the number of bytes a single instruction translates to
+#define VM_JIT_MAX_TEMPLATE 256
+
+typedef struct VirtualMachineJitFixup {
+    u32 pos;
+    u32 idx;
+} JitFixup;
+
+/**
+ * Native code compiled for a virtual machine
+ *
+ * @property code executable memory holding the native code
+ *
+ * @property size the size of \property code
+ *
+ * @property len the number of bytes used in \property code
+ *
+ * @property addr the offset of the code of every decoded instruction
+ * in \property code
+ *
+ * @property fixups jumps whose target is only known when done compiling
+ *
+ * @property entry the offset of the code used to enter compiled code
+ * (\see VM_jit_entry)
+ *
+ * @property exit, dispatch, fault, overflow, underflow offsets of the
+ * code shared by all instructions (\see VM_jit_stubs)
+ *
+ * @property trace true when compiling traces of hot loops, in which case
+ * the instruction pointer is guarded against the recorded path and the
+ * dispatcher exits compiled code (\see VM_jit_trace)
+ *
+ * @property next the address of the instruction executed after the one
+ * being compiled, the next instruction or the next recorded one
+ *
+ * @property after the address of the instruction executed after
+ * \property next
+ *
+ * @property hot the number of times each instruction was the target of
+ * a backward jump
+ *
+ * @property traces the offset of the trace starting at each instruction,
+ * `VM_TRACE_NONE` if there is none
+ *
+ * @property rec the instructions of the trace being recorded
+ */
+typedef struct VirtualMachineJit {
+    u8  *code;
+    u32 size;
+    u32 len;
+    u32 *addr;
+    JitFixup *fixups;
+    u32 nfixups;
+    u32 entry;
+    u32 exit;
+    u32 dispatch;
+    u32 fault[2];
+    u32 overflow;
+    u32 underflow;
+    bool trace;
+    u32 next;
+    u32 after;
+    u16 *hot;
+    u32 *traces;
+    u32 *rec;
+} Jit;
+
+// Marks instructions that do not start a trace
+#define VM_TRACE_NONE       0
+// Marks instructions whose trace cannot be compiled
+#define VM_TRACE_REJECTED   UINT32_MAX
+
+typedef void (*JitEntry)(VM *vm, void *target);
+
+/**
+ * x86-64 registers. `rbx` holds the virtual machine and `r12` the base
+ * of its memory while running compiled code, the registers pinned to
+ * virtual machine registers are listed in \see vmJitPinned and every other
+ * register is scratch.
+ */
+typedef enum X64Register {
+    xRAX, xRCX, xRDX, xRBX, xRSP, xRBP, xRSI, xRDI,
+    xR8, xR9, xR10, xR11, xR12, xR13, xR14, xR15,
+    xNONE = 0xFF
+} X64Reg;
+
+// Condition codes of jcc, setcc and cmovcc
+typedef enum X64Condition {
+    xccB  = 0x2,
+    xccAE = 0x3,
+    xccE  = 0x4,
+    xccNE = 0x5,
+    xccBE = 0x6,
+    xccA  = 0x7,
+    xccL  = 0xC,
+    xccGE = 0xD,
+    xccLE = 0xE,
+    xccG  = 0xF
+} X64Cond;
+
+#define X64_W   BIT(0)      // 64-bit operand size
+#define X64_16  BIT(1)      // 16-bit operand size
+
+#define JIT_REG(R)  ((i32)(offsetof(VM, regs) + ((R) * sizeof(u64))))
+#define JIT_RAM(F)  ((i32)offsetof(VM, ram.F))
+
+/**
+ * Virtual machine registers kept in host registers while running compiled
+ * code, the others are accessed in the virtual machine. Pinned registers are
+ * written back to the virtual machine before calling code that reads them,
+ * the interpreter, native functions and the stubs leaving compiled code, and
+ * loaded again after the call (\see VM_jit_sync). The caller saved `r8`-`r11`
+ * are only clobbered by those calls or preserved (\see VM_jit_stubs).
+ */
+static const struct {
+    u8 vm;
+    u8 host;
+} vmJitPinned[] = {
+    {sp, xRBP}, {bp, xR13}, {r0, xR14}, {r1, xR15},
+    {r2, xR8},  {r3, xR9},  {r4, xR10}, {r5, xR11}
+};
+
+// Sign extending moves of a value of the given mode
+static const u32 x64Movsx[] = { 0x0FBE, 0x0FBF, 0x63, 0x8B };
+
+static void X64_byte(Jit *jit, u8 b)
+{
+    jit->code[jit->len++] = b;
+}
+
+static void X64_u32(Jit *jit, u32 v)
+{
+    memcpy(&jit->code[jit->len], &v, sizeof(v));
+    jit->len += sizeof(v);
+}
+
+static void X64_u64(Jit *jit, u64 v)
+{
+    memcpy(&jit->code[jit->len], &v, sizeof(v));
+    jit->len += sizeof(v);
+}
+
+static void X64_prefix(Jit *jit, u8 flags, u32 opc, u8 reg, u8 index, u8 base)
+{
+    u8 rex = 0x40;
+    if (flags & X64_W) rex |= 0x08;
+    if (reg & 8) rex |= 0x04;
+    if (index != xNONE && (index & 8)) rex |= 0x02;
+    if (base & 8) rex |= 0x01;
+
+    if (flags & X64_16) X64_byte(jit, 0x66);
+    if (rex != 0x40) X64_byte(jit, rex);
+    if (opc > 0xFF) X64_byte(jit, opc >> 8);
+    X64_byte(jit, opc & 0xFF);
+}
+
+/**
+ * Emits instruction \param opc with a register direct ModRM,
+ * \param reg can be an op code extension
+ */
+static void X64_rr(Jit *jit, u8 flags, u32 opc, u8 reg, u8 rm)
+{
+    X64_prefix(jit, flags, opc, reg, xNONE, rm);
+    X64_byte(jit, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+/**
+ * Emits instruction \param opc with a `[base + index + disp32]` memory
+ * operand, \param reg can be an op code extension
+ */
+static void X64_rm(Jit *jit, u8 flags, u32 opc, u8 reg, u8 base, u8 index, i32 disp)
+{
+    X64_prefix(jit, flags, opc, reg, index, base);
+    if (index == xNONE && (base & 7) != xRSP) {
+        X64_byte(jit, 0x80 | ((reg & 7) << 3) | (base & 7));
+    }
+    else {
+        X64_byte(jit, 0x84 | ((reg & 7) << 3));
+        X64_byte(jit, (((index == xNONE)? xRSP : (index & 7)) << 3) | (base & 7));
+    }
+    X64_u32(jit, disp);
+}
+
+static void X64_mov_ri(Jit *jit, u8 reg, u64 value)
+{
+    if (value <= UINT32_MAX) {
+        X64_prefix(jit, 0, 0xB8 + (reg & 7), 0, xNONE, reg);
+        X64_u32(jit, value);
+    }
+    else if ((i64) value == (i32) value) {
+        X64_rr(jit, X64_W, 0xC7, 0, reg);
+        X64_u32(jit, value);
+    }
+    else {
+        X64_prefix(jit, X64_W, 0xB8 + (reg & 7), 0, xNONE, reg);
+        X64_u64(jit, value);
+    }
+}
+
+// Calls the function at \param fn, the stack is 16 bytes aligned in compiled code
+static void X64_call(Jit *jit, const void *fn)
+{
+    X64_mov_ri(jit, xRAX, (uptr) fn);
+    X64_rr(jit, 0, 0xFF, 2, xRAX);
+}
+
+static void X64_rel32(Jit *jit, u32 target)
+{
+    X64_u32(jit, target - (jit->len + 4));
+}
+
+static void X64_jmp(Jit *jit, u32 target)
+{
+    X64_byte(jit, 0xE9);
+    X64_rel32(jit, target);
+}
+
+static void X64_jcc(Jit *jit, X64Cond cc, u32 target)
+{
+    X64_byte(jit, 0x0F);
+    X64_byte(jit, 0x80 | cc);
+    X64_rel32(jit, target);
+}
+
+// Emits a forward jcc whose target is set later \see X64_patch
+static u32 X64_jcc_fwd(Jit *jit, X64Cond cc)
+{
+    X64_jcc(jit, cc, jit->len + 6);
+    return jit->len - 4;
+}
+
+static void X64_patch(Jit *jit, u32 pos)
+{
+    u32 rel = jit->len - (pos + 4);
+    memcpy(&jit->code[pos], &rel, sizeof(rel));
+}
+
+// Sign extending load of a value of the given mode
+static void X64_load(Jit *jit, Mode mode, u8 dst, u8 base, u8 index, i32 disp)
+{
+    X64_rm(jit, X64_W, x64Movsx[mode], dst, base, index, disp);
+}
+
+// Zero extends the value in \param reg from the width of the given mode
+static void X64_zext(Jit *jit, Mode mode, u8 reg)
+{
+    switch (mode) {
+        case szByte:  X64_rr(jit, 0, 0x0FB6, reg, reg); break;
+        case szShort: X64_rr(jit, 0, 0x0FB7, reg, reg); break;
+        case szWord:  X64_rr(jit, 0, 0x89, reg, reg); break;
+        default: break;
+    }
+}
+
+// Stores the value in `rax` using the given mode
+static void X64_store(Jit *jit, Mode mode, u8 base, u8 index, i32 disp)
+{
+    static const u8 flags[] = { 0, X64_16, 0, X64_W };
+    X64_rm(jit, flags[mode], mode == szByte? 0x88 : 0x89, xRAX, base, index, disp);
+}
+
+// The host register pinned to register \param r, `xNONE` if it is not pinned
+static u8 VM_jit_host(u8 r)
+{
+    for (int i = 0; i < sizeof__(vmJitPinned); i++) {
+        if (vmJitPinned[i].vm == r)
+            return vmJitPinned[i].host;
+    }
+    return xNONE;
+}
+
+// Writes the pinned registers back to the virtual machine or loads them from it
+static void VM_jit_sync(Jit *jit, bool save)
+{
+    for (int i = 0; i < sizeof__(vmJitPinned); i++)
+        X64_rm(jit, X64_W, save? 0x89 : 0x8B, vmJitPinned[i].host, xRBX, xNONE, JIT_REG(vmJitPinned[i].vm));
+}
+
+// Loads register \param r sign extended from the given mode into \param dst
+static void VM_jit_get(Jit *jit, Mode mode, u8 dst, u8 r)
+{
+    u8 host = VM_jit_host(r);
+    if (host == xNONE)
+        X64_load(jit, mode, dst, xRBX, xNONE, JIT_REG(r));
+    else
+        X64_rr(jit, X64_W, x64Movsx[mode], dst, host);
+}
+
+/**
+ * Stores \param src into register \param r using the given mode, modes
+ * narrower than `szQuad` store `rax` and keep the upper bits of the register.
+ * Clobbers `rdx` when merging the bits into a pinned register.
+ */
+static void VM_jit_set(Jit *jit, Mode mode, u8 r, u8 src)
+{
+    u8 host = VM_jit_host(r);
+    csAssert0(mode == szQuad || src == xRAX);
+    if (host == xNONE) {
+        if (mode == szQuad) X64_rm(jit, X64_W, 0x89, src, xRBX, xNONE, JIT_REG(r));
+        else X64_store(jit, mode, xRBX, xNONE, JIT_REG(r));
+    }
+    else if (mode == szQuad) {
+        X64_rr(jit, X64_W, 0x89, src, host);
+    }
+    else {
+        // host ^= (host ^ rax) & mask
+        X64_rr(jit, X64_W, 0x89, host, xRDX);
+        X64_rr(jit, X64_W, 0x31, xRAX, xRDX);
+        X64_zext(jit, mode, xRDX);
+        X64_rr(jit, X64_W, 0x31, xRDX, host);
+    }
+}
+
+/**
+ * Jumps to the code of the decoded instruction \param idx, which is resolved
+ * when all instructions are compiled
+ */
+static void VM_jit_jump(Jit *jit, i32 cc, u32 idx)
+{
+    if (cc < 0) X64_jmp(jit, 0);
+    else X64_jcc(jit, cc, 0);
+
+    if ((jit->nfixups & 0xFF) == 0) {
+        jit->fixups = realloc(jit->fixups, sizeof(JitFixup) * (jit->nfixups + 0x100));
+        if (jit->fixups == NULL) {
+            fputs("error: out of memory\n", stderr);
+            abort();
+        }
+    }
+    jit->fixups[jit->nfixups++] = (JitFixup){.pos = jit->len - 4, .idx = idx};
+}
+
+/**
+ * Emits a jump to address \param addr in code space. The jump goes through
+ * the dispatcher when the address is not the start of an instruction so
+ * that the virtual machine is aborted if it is ever taken.
+ *
+ * Traces continue on the recorded path and exit compiled code when the
+ * other path is taken, \param nip is the address of the instruction
+ * following the jump.
+ */
+static void VM_jit_branch(Jit *jit, VM *vm, i32 cc, u64 addr, u32 nip)
+{
+    if (jit->trace && addr == jit->next) {
+        if (cc < 0) return;
+        cc ^= 1;
+        addr = nip;
+    }
+
+    if (!jit->trace && addr <= Vector_len(vm->code) && vm->dmap[addr] != VM_DECODE_INVALID) {
+        VM_jit_jump(jit, cc, vm->dmap[addr]);
+    }
+    else {
+        u32 skip = 0;
+        if (cc >= 0) skip = X64_jcc_fwd(jit, cc ^ 1);
+        X64_mov_ri(jit, xRAX, addr);
+        X64_rm(jit, X64_W, 0x89, xRAX, xRBX, xNONE, JIT_REG(ip));
+        X64_jmp(jit, jit->dispatch);
+        if (cc >= 0) X64_patch(jit, skip);
+    }
+}
+
+/**
+ * Zero extends the 32-bit address in register \param reg and checks
+ * that it is within the committed virtual machine memory, below the heap
+ * limit or above the stack boundary (\see MEM)
+ */
+static void VM_jit_check(Jit *jit, u8 reg)
+{
+    X64_rr(jit, 0, 0x89, reg, reg);
+#ifndef CYN_VM_GUARD_PAGES
+    u32 stack;
+    X64_rm(jit, 0, 0x3B, reg, xRBX, xNONE, JIT_RAM(size));
+    X64_jcc(jit, xccA, jit->fault[reg == xRDI]);
+    X64_rm(jit, 0, 0x3B, reg, xRBX, xNONE, JIT_RAM(sb));
+    stack = X64_jcc_fwd(jit, xccAE);
+    X64_rm(jit, 0, 0x3B, reg, xRBX, xNONE, JIT_RAM(hlm));
+    X64_jcc(jit, xccA, jit->fault[reg == xRDI]);
+    X64_patch(jit, stack);
+#endif
+}
+
+/**
+ * Loads the address of a memory operand into \param dst, `rsi`
+ * for argument A and `rdi` for argument B
+ */
+static void VM_jit_address(Jit *jit, const DecodedInstruction *di, bool isB, u8 dst)
+{
+    const Instruction *instr = &di->instr;
+    switch (isB? di->kb : di->ka) {
+        case okRegMem: {
+            u8 r = isB? instr->rb : instr->ra, host = VM_jit_host(r);
+            if (host == xNONE) X64_rm(jit, 0, 0x8B, dst, xRBX, xNONE, JIT_REG(r));
+            else X64_rr(jit, 0, 0x89, host, dst);
+            if (isB && instr->ii) {
+                X64_rr(jit, 0, 0x81, 0, dst);
+                X64_u32(jit, (u32) instr->ii);
+            }
+            break;
+        }
+        case okImmMem:
+            X64_mov_ri(jit, dst, (u32) instr->iu);
+            break;
+        default:
+            unreachable();
+    }
+    VM_jit_check(jit, dst);
+}
+
+/**
+ * Mode used to read an argument of the given kind, immediate values are
+ * sign extended when decoded (\see VM_decode_specialize)
+ */
+static Mode VM_jit_mode(const DecodedInstruction *di, u8 kind)
+{
+    switch (kind) {
+        case okImm: return szQuad;
+        case okImmMem: return di->instr.ims;
+        default: return di->instr.imd;
+    }
+}
+
+// Loads argument A into `rax` or argument B into `rcx`
+static void VM_jit_load(Jit *jit, const DecodedInstruction *di, bool isB, Mode mode)
+{
+    const Instruction *instr = &di->instr;
+    u8 dst = isB? xRCX : xRAX, adr = isB? xRDI : xRSI;
+
+    switch (isB? di->kb : di->ka) {
+        case okReg:
+            VM_jit_get(jit, mode, dst, isB? instr->rb : instr->ra);
+            break;
+        case okImm:
+            X64_mov_ri(jit, dst, instr->iu);
+            break;
+        default:
+            VM_jit_address(jit, di, isB, adr);
+            X64_load(jit, mode, dst, xR12, adr, 0);
+            break;
+    }
+}
+
+// Stores `rax` into argument A, the address of memory arguments is in `rsi`
+static void VM_jit_store(Jit *jit, const DecodedInstruction *di, Mode mode)
+{
+    switch (di->ka) {
+        case okReg:
+            VM_jit_set(jit, mode, di->instr.ra, xRAX);
+            break;
+        case okImm:
+            // writes to a temporary in the interpreter
+            break;
+        default:
+            X64_store(jit, mode, xR12, xRSI, 0);
+            break;
+    }
+}
+
+// Pushes `rax` onto the virtual machine stack, growing the stack if needed \see VM_pushn
+static void VM_jit_push(Jit *jit)
+{
+    VM_jit_get(jit, szQuad, xRSI, sp);
+    X64_rr(jit, X64_W, 0x83, 5, xRSI);
+    X64_byte(jit, 8);
+    X64_rm(jit, 0, 0x8B, xRCX, xRBX, xNONE, JIT_RAM(sb));
+    X64_rr(jit, X64_W, 0x39, xRCX, xRSI);
+    X64_jcc(jit, xccA, jit->len + 6 + 5);
+    X64_byte(jit, 0xE8);
+    X64_rel32(jit, jit->overflow);
+    VM_jit_set(jit, szQuad, sp, xRSI);
+    VM_jit_check(jit, xRSI);
+    X64_rm(jit, X64_W, 0x89, xRAX, xR12, xRSI, 0);
+}
+
+// Pops \param count values off the virtual machine stack, the first one into `rax`
+static void VM_jit_pop(Jit *jit, u8 count)
+{
+    VM_jit_get(jit, szQuad, xRSI, sp);
+    X64_rm(jit, X64_W, 0x8D, xRDX, xRSI, xNONE, count << 3);
+    X64_rm(jit, 0, 0x8B, xRCX, xRBX, xNONE, JIT_RAM(size));
+    X64_rr(jit, X64_W, 0x39, xRCX, xRDX);
+    X64_jcc(jit, xccA, jit->underflow);
+    VM_jit_check(jit, xRSI);
+    X64_rm(jit, X64_W, 0x8B, xRAX, xR12, xRSI, 0);
+    VM_jit_set(jit, szQuad, sp, xRDX);
+}
+
+// Jumps to the dispatcher if the instruction pointer is not the next expected one
+static void VM_jit_check_ip(Jit *jit)
+{
+    X64_rm(jit, X64_W, 0x81, 7, xRBX, xNONE, JIT_REG(ip));
+    X64_u32(jit, jit->next);
+    X64_jcc(jit, xccNE, jit->dispatch);
+}
+
+static void VM_jit_store_ip(Jit *jit, u32 nip)
+{
+    X64_rm(jit, X64_W, 0xC7, 0, xRBX, xNONE, JIT_REG(ip));
+    X64_u32(jit, nip);
+}
+
+// Executes the instruction in the interpreter
+static void VM_jit_step(Jit *jit, const DecodedInstruction *di)
+{
+    VM_jit_sync(jit, true);
+    X64_rr(jit, X64_W, 0x89, xRBX, xRDI);
+    X64_mov_ri(jit, xRSI, (uptr) di);
+    X64_call(jit, VM_step);
+    VM_jit_sync(jit, false);
+    VM_jit_check_ip(jit);
+}
+
+static void *VM_jit_target(VM *vm)
+{
+    DecodedInstruction *di = VM_decoded_at(vm, REG(vm, ip));
+    return vm->jit->code + vm->jit->addr[di - vm->decoded];
+}
+
+attr(noreturn)
+static void VM_jit_fault(VM *vm, u32 addr)
+{
+    VM_abort(vm, "Memory access violation %x/%x", addr, vm->ram.hlm);
+}
+
+attr(noreturn)
+static void VM_jit_underflow(VM *vm)
+{
+    VM_abort(vm, "VM stack memory underflow - escapes virtual machine memory");
+}
+
+static void VM_jit_ncall(VM *vm, NativeCall fn, uptr id)
+{
+    Value *nargs = (Value *) MEM(vm, REG(vm, sp));
+    VM_native_check(vm, id, nargs->u);
+    Value *argv = (nargs->i == 0)? NULL :
+                  ((Value *) MEM(vm, (REG(vm, sp) + (nargs->i << 3))));
+    VM_push(vm, REG(vm, ip));
+    VM_push(vm, REG(vm, bp));
+    REG(vm, bp) = REG(vm, sp);
+    fn(vm, argv, nargs->i);
+}
+
+/**
+ * Emits the code shared by all instructions, entering and exiting compiled
+ * code, dispatching to the code of the instruction at `ip` and aborting
+ * the virtual machine.
+ */
+static void VM_jit_stubs(Jit *jit)
+{
+    static const u8 saved[] = { xRBX, xRBP, xR12, xR13, xR14, xR15 };
+    // an odd count keeps the host stack aligned on calls
+    static const u8 clobbered[] = { xRAX, xRCX, xRDX, xRSI, xRDI, xR8, xR9, xR10, xR11 };
+
+    // void entry(VM *vm, void *target)
+    jit->entry = jit->len;
+    for (int i = 0; i < sizeof__(saved); i++)
+        X64_prefix(jit, 0, 0x50 + (saved[i] & 7), 0, xNONE, saved[i]);
+    X64_rr(jit, X64_W, 0x83, 5, xRSP);
+    X64_byte(jit, 8);
+    X64_rr(jit, X64_W, 0x89, xRDI, xRBX);
+    X64_rm(jit, X64_W, 0x8B, xR12, xRBX, xNONE, JIT_RAM(base));
+    VM_jit_sync(jit, false);
+    X64_rr(jit, 0, 0xFF, 4, xRSI);
+
+    jit->exit = jit->len;
+    VM_jit_sync(jit, true);
+    X64_rr(jit, X64_W, 0x83, 0, xRSP);
+    X64_byte(jit, 8);
+    for (int i = sizeof__(saved) - 1; i >= 0; i--)
+        X64_prefix(jit, 0, 0x58 + (saved[i] & 7), 0, xNONE, saved[i]);
+    X64_byte(jit, 0xC3);
+
+    // the registers are written back in case resolving the target aborts
+    jit->dispatch = jit->len;
+    VM_jit_sync(jit, true);
+    X64_rr(jit, X64_W, 0x89, xRBX, xRDI);
+    X64_call(jit, VM_jit_target);
+    VM_jit_sync(jit, false);
+    X64_rr(jit, 0, 0xFF, 4, xRAX);
+
+    jit->fault[1] = jit->len;
+    X64_rr(jit, 0, 0x89, xRDI, xRSI);
+    jit->fault[0] = jit->len;
+    VM_jit_sync(jit, true);
+    X64_rr(jit, X64_W, 0x89, xRBX, xRDI);
+    X64_call(jit, VM_jit_fault);
+
+    // void overflow(u64 sp), called with the new stack pointer in `rsi`,
+    // preserves the registers clobbered by the call
+    jit->overflow = jit->len;
+    for (int i = 0; i < sizeof__(clobbered); i++)
+        X64_prefix(jit, 0, 0x50 + (clobbered[i] & 7), 0, xNONE, clobbered[i]);
+    VM_jit_sync(jit, true);
+    X64_rr(jit, X64_W, 0x89, xRBX, xRDI);
+    X64_call(jit, VM_memory_grow_stack);
+    for (int i = sizeof__(clobbered) - 1; i >= 0; i--)
+        X64_prefix(jit, 0, 0x58 + (clobbered[i] & 7), 0, xNONE, clobbered[i]);
+    X64_byte(jit, 0xC3);
+
+    jit->underflow = jit->len;
+    VM_jit_sync(jit, true);
+    X64_rr(jit, X64_W, 0x89, xRBX, xRDI);
+    X64_call(jit, VM_jit_underflow);
+}
+
+static bool VM_jit_uses_ip(const DecodedInstruction *di)
+{
+    return ((di->ka == okReg || di->ka == okRegMem) && di->instr.ra == ip) ||
+           ((di->kb == okReg || di->kb == okRegMem) && di->instr.rb == ip);
+}
+
+// Sets the flags register from the flags of a host `cmp`, host flags are preserved
+static void VM_jit_flags(Jit *jit)
+{
+    X64_mov_ri(jit, xRDX, flgGreater);
+    X64_mov_ri(jit, xRSI, flgLess);
+    X64_rr(jit, X64_W, 0x0F40 | xccL, xRDX, xRSI);
+    X64_mov_ri(jit, xRSI, flgZero);
+    X64_rr(jit, X64_W, 0x0F40 | xccE, xRDX, xRSI);
+    X64_rm(jit, X64_W, 0x89, xRDX, xRBX, xNONE, JIT_REG(flg));
+}
+
+static i32 VM_jit_jump_cond(u8 opc, bool host)
+{
+    switch (opc) {
+        case opJmp:   return -1;
+        case opJmpz:  return host? xccE : xccNE;
+        case opJmpnz: return host? xccNE : xccE;
+        case opJmpg:  return host? xccG : xccNE;
+        case opJmps:  return host? xccL : xccNE;
+        default:
+            unreachable();
+    }
+}
+
+static u8 VM_jit_jump_flag(u8 opc)
+{
+    switch (opc) {
+        case opJmpz:
+        case opJmpnz: return flgZero;
+        case opJmpg:  return flgGreater;
+        case opJmps:  return flgLess;
+        default:
+            unreachable();
+    }
+}
+
+// A compare immediately followed by a conditional jump can branch on host flags
+static bool VM_jit_fusable(const Jit *jit, const DecodedInstruction *di)
+{
+    const DecodedInstruction *jmp = di + 1;
+    if (jmp->op == VM_DECODE_TRAP || jmp->op == VM_DECODE_UNKNOWN)
+        return false;
+    if (jmp->instr.opc < opJmpz || jmp->instr.opc > opJmps || jmp->ka != okImm)
+        return false;
+    if (VM_jit_uses_ip(di))
+        return false;
+    return !jit->trace || (jit->next == jmp->iip && jit->after != VM_DECODE_INVALID);
+}
+
+/**
+ * Compiles the binary instruction at index \param i, argument A is
+ * loaded into `rax` and argument B into `rcx`. Returns the number of
+ * instructions compiled.
+ */
+static u32 VM_jit_binary(Jit *jit, VM *vm, u32 i)
+{
+    const DecodedInstruction *di = &vm->decoded[i];
+    u8 opc = di->instr.opc;
+    Mode ma = di->instr.imd;
+
+    VM_jit_load(jit, di, true, VM_jit_mode(di, di->kb));
+    if (opc == opMov) {
+        if (di->ka != okReg) VM_jit_address(jit, di, false, xRSI);
+        X64_rr(jit, X64_W, 0x89, xRCX, xRAX);
+        VM_jit_store(jit, di, ma);
+        return 1;
+    }
+
+    VM_jit_load(jit, di, false, ma);
+    switch (opc) {
+        case opAdd:  X64_rr(jit, X64_W, 0x01, xRCX, xRAX); break;
+        case opSub:  X64_rr(jit, X64_W, 0x29, xRCX, xRAX); break;
+        case opBor:  X64_rr(jit, X64_W, 0x09, xRCX, xRAX); break;
+        case opBand: X64_rr(jit, X64_W, 0x21, xRCX, xRAX); break;
+        case opXor:  X64_rr(jit, X64_W, 0x31, xRCX, xRAX); break;
+        case opMul:  X64_rr(jit, X64_W, 0x0FAF, xRAX, xRCX); break;
+        case opSal:  X64_rr(jit, X64_W, 0xD3, 4, xRAX); break;
+        case opSar:  X64_rr(jit, X64_W, 0xD3, 7, xRAX); break;
+        case opDiv:
+        case opMod:
+            X64_byte(jit, 0x48);
+            X64_byte(jit, 0x99);
+            X64_rr(jit, X64_W, 0xF7, 7, xRCX);
+            if (opc == opMod) X64_rr(jit, X64_W, 0x89, xRDX, xRAX);
+            break;
+        case opAnd:
+            X64_rr(jit, X64_W, 0x85, xRAX, xRAX);
+            X64_rr(jit, 0, 0x0F90 | xccNE, 0, xRAX);
+            X64_rr(jit, X64_W, 0x85, xRCX, xRCX);
+            X64_rr(jit, 0, 0x0F90 | xccNE, 0, xRCX);
+            X64_rr(jit, 0, 0x20, xRCX, xRAX);
+            X64_rr(jit, 0, 0x0FB6, xRAX, xRAX);
+            break;
+        case opOr:
+            X64_rr(jit, X64_W, 0x09, xRCX, xRAX);
+            X64_rr(jit, 0, 0x0F90 | xccNE, 0, xRAX);
+            X64_rr(jit, 0, 0x0FB6, xRAX, xRAX);
+            break;
+        case opCmp: {
+            const DecodedInstruction *jmp = di + 1;
+            u32 next = jit->next;
+            X64_rr(jit, X64_W, 0x39, xRCX, xRAX);
+            VM_jit_flags(jit);
+            if (!VM_jit_fusable(jit, di))
+                return 1;
+
+            // the conditional jump following the compare uses host flags
+            jit->next = jit->after;
+            VM_jit_branch(jit, vm, VM_jit_jump_cond(jmp->instr.opc, true),
+                          jmp->iip + jmp->instr.ii, jmp->nip);
+            jit->next = next;
+            if (jit->trace)
+                return 2;
+            VM_jit_jump(jit, -1, i + 2);
+            return 1;
+        }
+        default:
+            unreachable();
+    }
+    VM_jit_store(jit, di, ma);
+    return 1;
+}
+
+static X64Cond VM_jit_branch_cond(u8 opc)
+{
+    switch (opc) {
+        case opJeq:  return xccE;
+        case opJne:  return xccNE;
+        case opJlt:  return xccL;
+        case opJle:  return xccLE;
+        case opJgt:  return xccG;
+        case opJge:  return xccGE;
+        case opJltu: return xccB;
+        case opJleu: return xccBE;
+        case opJgtu: return xccA;
+        case opJgeu: return xccAE;
+        case opDjnz: return xccNE;
+        default:
+            unreachable();
+    }
+}
+
+/**
+ * Compiles a compare and branch instruction, argument A is loaded into
+ * `rax` and argument B into `rcx`. Unsigned compares zero extend both from
+ * the width of the mode, the flags register is not written.
+ */
+static void VM_jit_compare(Jit *jit, VM *vm, const DecodedInstruction *di)
+{
+    const Instruction *instr = &di->instr;
+    Mode ma = instr->imd;
+
+    if (instr->opc == opDjnz) {
+        VM_jit_load(jit, di, false, ma);
+        X64_rr(jit, X64_W, 0x83, 5, xRAX);
+        X64_byte(jit, 1);
+        VM_jit_store(jit, di, ma);
+        X64_zext(jit, ma, xRAX);
+        X64_rr(jit, X64_W, 0x85, xRAX, xRAX);
+    }
+    else {
+        VM_jit_load(jit, di, true, VM_jit_mode(di, di->kb));
+        VM_jit_load(jit, di, false, ma);
+        if (instr->opc >= opJltu) {
+            X64_zext(jit, ma, xRAX);
+            X64_zext(jit, ma, xRCX);
+        }
+        X64_rr(jit, X64_W, 0x39, xRCX, xRAX);
+    }
+    VM_jit_branch(jit, vm, VM_jit_branch_cond(instr->opc), di->iip + instr->itg, di->nip);
+}
+
+/**
+ * Compiles `set<cc>` and `csel<cc>` without branching, the condition is
+ * tested on the flags register. For `csel<cc>` argument A is loaded into
+ * `rax` and argument B into `rcx`.
+ */
+static void VM_jit_select(Jit *jit, const DecodedInstruction *di)
+{
+    static const u8 flags[] = {
+        flgZero, flgZero, flgLess, flgLess | flgZero, flgGreater, flgGreater | flgZero
+    };
+    const Instruction *instr = &di->instr;
+    bool csel = instr->opc >= opCseleq;
+    u8 cond = instr->opc - (csel? opCseleq : opSeteq);
+    X64Cond cc = (instr->opc == opSetne || instr->opc == opCselne)? xccE : xccNE;
+
+    if (csel) {
+        VM_jit_load(jit, di, true, VM_jit_mode(di, di->kb));
+        VM_jit_load(jit, di, false, instr->imd);
+    }
+    else if (di->ka != okReg && di->ka != okImm) {
+        VM_jit_address(jit, di, false, xRSI);
+    }
+
+    X64_rm(jit, 0, 0xF6, 0, xRBX, xNONE, JIT_REG(flg));
+    X64_byte(jit, flags[cond]);
+    if (csel) {
+        X64_rr(jit, X64_W, 0x0F40 | cc, xRAX, xRCX);
+    }
+    else {
+        X64_rr(jit, 0, 0x0F90 | cc, 0, xRAX);
+        X64_rr(jit, 0, 0x0FB6, xRAX, xRAX);
+    }
+    VM_jit_store(jit, di, instr->imd);
+}
+
+static void VM_jit_unary(Jit *jit, VM *vm, u32 i)
+{
+    const DecodedInstruction *di = &vm->decoded[i];
+    const Instruction *instr = &di->instr;
+    Mode mb = VM_jit_mode(di, di->ka);
+
+    switch (instr->opc) {
+        case opNot:
+        case opBNot:
+        case opInc:
+        case opDec:
+            VM_jit_load(jit, di, false, mb);
+            if (instr->opc == opNot) {
+                X64_rr(jit, X64_W, 0x85, xRAX, xRAX);
+                X64_rr(jit, 0, 0x0F90 | xccE, 0, xRAX);
+                X64_rr(jit, 0, 0x0FB6, xRAX, xRAX);
+            }
+            else if (instr->opc == opBNot) {
+                X64_rr(jit, X64_W, 0xF7, 2, xRAX);
+            }
+            else {
+                X64_rr(jit, X64_W, 0x83, instr->opc == opInc? 0 : 5, xRAX);
+                X64_byte(jit, 1);
+            }
+            VM_jit_store(jit, di, instr->imd);
+            break;
+
+        case opPush:
+            VM_jit_load(jit, di, false, mb);
+            VM_jit_push(jit);
+            break;
+
+        case opPop:
+            if (di->ka != okReg && di->ka != okImm) {
+                VM_jit_address(jit, di, false, xRDI);
+                VM_jit_pop(jit, 1);
+                X64_rr(jit, X64_W, 0x89, xRDI, xRSI);
+            }
+            else {
+                VM_jit_pop(jit, 1);
+            }
+            VM_jit_store(jit, di, mb);
+            break;
+
+        case opJmp:
+        case opJmpz:
+        case opJmpnz:
+        case opJmpg:
+        case opJmps: {
+            i32 cc = VM_jit_jump_cond(instr->opc, false);
+            if (cc >= 0) {
+                X64_rm(jit, 0, 0xF6, 0, xRBX, xNONE, JIT_REG(flg));
+                X64_byte(jit, VM_jit_jump_flag(instr->opc));
+            }
+
+            if (di->ka == okImm) {
+                VM_jit_branch(jit, vm, cc, di->iip + instr->ii, di->nip);
+            }
+            else if (jit->trace) {
+                VM_jit_step(jit, di);
+            }
+            else {
+                u32 skip = 0;
+                if (cc >= 0) skip = X64_jcc_fwd(jit, cc ^ 1);
+                VM_jit_load(jit, di, false, mb);
+                X64_mov_ri(jit, xRCX, di->iip);
+                X64_rr(jit, X64_W, 0x01, xRCX, xRAX);
+                X64_rm(jit, X64_W, 0x89, xRAX, xRBX, xNONE, JIT_REG(ip));
+                X64_jmp(jit, jit->dispatch);
+                if (cc >= 0) X64_patch(jit, skip);
+            }
+            break;
+        }
+        default:
+            unreachable();
+    }
+}
+
+/**
+ * Compiles the decoded instruction at index \param i, returns the number
+ * of instructions compiled
+ */
+static u32 VM_jit_instruction(Jit *jit, VM *vm, u32 i)
+{
+    const DecodedInstruction *di = &vm->decoded[i];
+    const Instruction *instr = &di->instr;
+    bool usesIp = VM_jit_uses_ip(di);
+    u32 n = 1;
+
+    if (di->op == VM_DECODE_TRAP || di->op == VM_DECODE_UNKNOWN) {
+        VM_jit_step(jit, di);
+        return 1;
+    }
+
+    if (usesIp) VM_jit_store_ip(jit, di->nip);
+
+    switch (instr->opc) {
+        case opAdd: case opSub: case opAnd: case opOr:
+        case opSar: case opSal: case opXor: case opBor:
+        case opBand: case opMul: case opDiv: case opMod:
+        case opMov: case opCmp:
+            n = VM_jit_binary(jit, vm, i);
+            break;
+
+        case opNot: case opBNot: case opInc: case opDec:
+        case opPush: case opPop:
+            VM_jit_unary(jit, vm, i);
+            break;
+
+        case opJmp: case opJmpz: case opJmpnz: case opJmpg: case opJmps:
+            VM_jit_unary(jit, vm, i);
+            return 1;
+
+        case opJeq: case opJne: case opJlt: case opJle: case opJgt: case opJge:
+        case opJltu: case opJleu: case opJgtu: case opJgeu: case opDjnz:
+            if (usesIp) {
+                VM_jit_step(jit, di);
+                return 1;
+            }
+            VM_jit_compare(jit, vm, di);
+            return 1;
+
+        case opSeteq: case opSetne: case opSetlt: case opSetle: case opSetgt: case opSetge:
+        case opCseleq: case opCselne: case opCsellt: case opCselle: case opCselgt: case opCselge:
+            VM_jit_select(jit, di);
+            break;
+
+        case opPopn:
+            if (di->ka != okImm) {
+                VM_jit_step(jit, di);
+                return 1;
+            }
+            VM_jit_pop(jit, VM_read(&instr->ii, instr->ims));
+            break;
+
+        case opCall:
+        case opFcall:
+            if (di->ka != okImm || usesIp) {
+                VM_jit_step(jit, di);
+                return 1;
+            }
+            X64_mov_ri(jit, xRAX, di->nip);
+            VM_jit_push(jit);
+            VM_jit_get(jit, szQuad, xRAX, bp);
+            VM_jit_push(jit);
+            VM_jit_get(jit, szQuad, xRAX, sp);
+            VM_jit_set(jit, szQuad, bp, xRAX);
+            VM_jit_branch(jit, vm, -1, di->iip + VM_read(&instr->ii, instr->ims), di->nip);
+            return 1;
+
+        case opNcall: {
+            uptr id = (uptr) VM_read(&instr->ii, instr->ims);
+            if (di->ka != okImm) {
+                VM_jit_step(jit, di);
+                return 1;
+            }
+            // builtins are resolved when compiling
+            VM_jit_store_ip(jit, di->nip);
+            VM_jit_sync(jit, true);
+            X64_rr(jit, X64_W, 0x89, xRBX, xRDI);
+            X64_mov_ri(jit, xRSI, (id < bncCOUNT)? (uptr) vmNativeBuiltinCallTbl[id] : id);
+            X64_mov_ri(jit, xRDX, id);
+            X64_call(jit, VM_jit_ncall);
+            VM_jit_sync(jit, false);
+            VM_jit_check_ip(jit);
+            return 1;
+        }
+
+        case opHalt:
+            VM_jit_store_ip(jit, di->nip);
+            X64_rm(jit, X64_W, 0xC7, 0, xRBX, xNONE, (i32) offsetof(VM, flags));
+            X64_u32(jit, eflHalt);
+            X64_jmp(jit, jit->exit);
+            return 1;
+
+        case opDbg:
+            break;
+
+        default:
+            VM_jit_step(jit, di);
+            return 1;
+    }
+
+    if (usesIp) VM_jit_check_ip(jit);
+    return n;
+}
+
+static Jit *VM_jit_create(u32 size)
+{
+    Jit *jit = calloc(1, sizeof(Jit));
+    if (jit == NULL) return NULL;
+
+    jit->size = CynAlign(size, 4096);
+    jit->code = mmap(NULL, jit->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit->code == MAP_FAILED) {
+        free(jit);
+        return NULL;
+    }
+    VM_jit_stubs(jit);
+    return jit;
+}
+
+static void VM_jit_free(Jit *jit)
+{
+    munmap(jit->code, jit->size);
+    free(jit->addr);
+    free(jit->fixups);
+    free(jit->hot);
+    free(jit->traces);
+    free(jit->rec);
+    free(jit);
+}
+
+bool VM_jit_compile(VM *vm)
+{
+    Jit *jit;
+    u32 count = vm->dmap[Vector_len(vm->code)] + 1;
+
+    jit = VM_jit_create(count * VM_JIT_MAX_TEMPLATE + 1024);
+    if (jit == NULL) return false;
+
+    jit->addr = malloc(sizeof(u32) * count);
+    if (jit->addr == NULL) {
+        VM_jit_free(jit);
+        return false;
+    }
+
+    for (u32 i = 0; i < count; i++) {
+        jit->addr[i] = jit->len;
+        jit->next = vm->decoded[i].nip;
+        VM_jit_instruction(jit, vm, i);
+        csAssert0(jit->len - jit->addr[i] <= VM_JIT_MAX_TEMPLATE);
+    }
+
+    for (u32 i = 0; i < jit->nfixups; i++) {
+        JitFixup *fx = &jit->fixups[i];
+        u32 rel = jit->addr[fx->idx] - (fx->pos + 4);
+        memcpy(&jit->code[fx->pos], &rel, sizeof(rel));
+    }
+
+    if (mprotect(jit->code, jit->size, PROT_READ | PROT_EXEC) != 0) {
+        VM_jit_free(jit);
+        return false;
+    }
+
+    vm->jit = jit;
+    return true;
+}
+
+void VM_jit_run(VM *vm)
+{
+    JitEntry entry = (JitEntry) (vm->jit->code + vm->jit->entry);
+    entry(vm, VM_jit_target(vm));
+}
+
+void VM_jit_release(VM *vm)
+{
+    if (vm->jit) VM_jit_free(vm->jit);
+    if (vm->tracer) VM_jit_free(vm->tracer);
+    vm->jit = NULL;
+    vm->tracer = NULL;
+}
+
+bool VM_jit_trace_init(VM *vm)
+{
+    u32 count = vm->dmap[Vector_len(vm->code)] + 1;
+    Jit *jit = VM_jit_create(CYN_VM_TRACE_CACHE);
+    if (jit == NULL) return false;
+
+    jit->trace = true;
+    // traces leave compiled code when they go off the recorded path
+    jit->dispatch = jit->exit;
+    jit->hot = calloc(count, sizeof(u16));
+    jit->traces = calloc(count, sizeof(u32));
+    jit->rec = malloc(sizeof(u32) * CYN_VM_TRACE_MAX);
+    if (jit->hot == NULL || jit->traces == NULL || jit->rec == NULL ||
+        mprotect(jit->code, jit->size, PROT_READ | PROT_EXEC) != 0)
+    {
+        VM_jit_free(jit);
+        return false;
+    }
+
+    vm->tracer = jit;
+    return true;
+}
+
+static bool VM_jit_traceable(const DecodedInstruction *di)
+{
+    return di->op != VM_DECODE_TRAP &&
+           di->op != VM_DECODE_UNKNOWN &&
+           di->instr.opc != opHalt;
+}
+
+/**
+ * Records the instructions executed by one iteration of the loop starting
+ * at \param header, the instructions are executed while recording. Returns
+ * the number of instructions recorded or 0 if the loop cannot be traced,
+ * \param resume is set to the next instruction to execute.
+ */
+static u32 VM_jit_trace_record(VM *vm, DecodedInstruction *header, DecodedInstruction **resume)
+{
+    Jit *jit = vm->tracer;
+    DecodedInstruction *di = header;
+    u32 n = 0;
+
+    do {
+        if (n == CYN_VM_TRACE_MAX || !VM_jit_traceable(di)) {
+            *resume = di;
+            return 0;
+        }
+
+        jit->rec[n++] = di - vm->decoded;
+        VM_step(vm, di);
+        di = (REG(vm, ip) == di->nip)? di + 1 : VM_decoded_at(vm, REG(vm, ip));
+    } while (di != header);
+
+    *resume = header;
+    return n;
+}
+
+// The address of the \param k'th recorded instruction, wrapping around once
+static u32 VM_jit_trace_addr(VM *vm, u32 n, u32 k)
+{
+    const u32 *rec = vm->tracer->rec;
+    if (k < n) return vm->decoded[rec[k]].iip;
+    return (k == n)? vm->decoded[rec[0]].iip : VM_DECODE_INVALID;
+}
+
+static u32 VM_jit_trace_compile(VM *vm, u32 n)
+{
+    Jit *jit = vm->tracer;
+    u32 start = jit->len;
+
+    if (jit->size - jit->len < (n + 1) * VM_JIT_MAX_TEMPLATE)
+        return VM_TRACE_REJECTED;
+    if (mprotect(jit->code, jit->size, PROT_READ | PROT_WRITE) != 0)
+        return VM_TRACE_REJECTED;
+
+    for (u32 k = 0; k < n;) {
+        jit->next = VM_jit_trace_addr(vm, n, k + 1);
+        jit->after = VM_jit_trace_addr(vm, n, k + 2);
+        k += VM_jit_instruction(jit, vm, jit->rec[k]);
+    }
+    X64_jmp(jit, start);
+
+    if (mprotect(jit->code, jit->size, PROT_READ | PROT_EXEC) != 0)
+        VM_abort(vm, "protecting compiled traces failed");
+    return start;
+}
+
+DecodedInstruction *VM_jit_trace(VM *vm, DecodedInstruction *header)
+{
+    Jit *jit = vm->tracer;
+    u32 h = header - vm->decoded, trace = jit->traces[h];
+
+    if (trace == VM_TRACE_NONE) {
+        DecodedInstruction *resume;
+        u32 n;
+
+        if (++jit->hot[h] < CYN_VM_TRACE_THRESHOLD)
+            return header;
+
+        n = VM_jit_trace_record(vm, header, &resume);
+        trace = n? VM_jit_trace_compile(vm, n) : VM_TRACE_REJECTED;
+        jit->traces[h] = trace;
+        if (trace == VM_TRACE_REJECTED)
+            return resume;
+    }
+    else if (trace == VM_TRACE_REJECTED) {
+        return header;
+    }
+
+    ((JitEntry) (jit->code + jit->entry))(vm, jit->code + trace);
+    return VM_decoded_at(vm, REG(vm, ip));
+}
+
+static bool VM_jit_owns(const Jit *jit, const u8 *pc)
+{
+    return jit != NULL && pc >= jit->code && pc < jit->code + jit->len;
+}
+
+void VM_jit_fault_context(VM *vm, void *ctx)
+{
+    // the mcontext registers in the order of their encoding
+    static const u8 greg[] = {
+        REG_RAX, REG_RCX, REG_RDX, REG_RBX, REG_RSP, REG_RBP, REG_RSI, REG_RDI,
+        REG_R8, REG_R9, REG_R10, REG_R11, REG_R12, REG_R13, REG_R14, REG_R15
+    };
+    greg_t *gregs = ((ucontext_t *) ctx)->uc_mcontext.gregs;
+    const u8 *pc = (const u8 *) gregs[REG_RIP];
+
+    if (!VM_jit_owns(vm->jit, pc) && !VM_jit_owns(vm->tracer, pc))
+        return;
+    for (int i = 0; i < sizeof__(vmJitPinned); i++)
+        REG(vm, vmJitPinned[i].vm) = gregs[greg[vmJitPinned[i].host]];
+}
+
+#else
+
+bool VM_jit_compile(VM *vm)
+{
+    return false;
+}
+
+void VM_jit_run(VM *vm)
+{
+    unreachable("VM not compiled");
+}
+
+void VM_jit_release(VM *vm)
+{
+}
+
+bool VM_jit_trace_init(VM *vm)
+{
+    return false;
+}
+
+DecodedInstruction *VM_jit_trace(VM *vm, DecodedInstruction *header)
+{
+    return header;
+}
+
+void VM_jit_fault_context(VM *vm, void *ctx)
+{
+}
+
+#endif
@@ -9,7 +9,9 @@
  */
 
 
+#include "vm/aot.h"
 #include "vm/builtins.h"
+#include "vm/jit.h"
 #include "args.h"
 #include "file.h"
 
@@ -38,6 +40,18 @@ Command(dassem, "disassembles the given bytecode file instead of running it",
 
 void cmdDassem(CmdCommand *cmd, int argc, char **argv);
 
+Command(aot, "translates the given bytecode file to a C program, the program "
+             "should be built with the virtual machine library (cynvm-lib)",
+    Positionals(Str("file", "Path to the file containing the bytecode to translate")),
+    Str(Name("output"), Sf('o'),
+        Help("Path to the output file, if not specified the program will be dumped to console"), Def("")),
+    Bytes(Name("Xss"), Help("The virtual machine stack size of the translated program"), Def("8K")),
+    Bytes(Name("Xms"), Help("The total memory to allocate for the translated program"), Def("1M")),
+    Bytes(Name("Xmx"), Help("The memory the heap and stack of the translated program can grow to"), Def("64M"))
+);
+
+void cmdAot(CmdCommand *cmd, int argc, char **argv);
+
 Command(run, "runs the given bytecode file, parsing any command line arguments "
              "following the '--' marker to the program.",
     Positionals(Str("path", "Path to the file containing the bytecode to run")),
@@ -46,7 +60,23 @@ Command(run, "runs the given bytecode file, parsing any command line arguments "
           Help("Adjust the total memory to allocate for the virtual machine. This "
                "value should be larger that the stack size as the stack is chunked "
                "from the total allocated memory."),
-          Def("1M"))
+          Def("1M")),
+    Bytes(Name("Xmx"),
+          Help("Adjust the memory reserved for the virtual machine, only the memory set "
+               "by Xms is committed to begin with, the heap and the stack grow into the rest "
+               "when they run out."),
+          Def("64M")),
+    Opt(Name("stats"), Help("Print the committed and reserved virtual machine memory on exit")),
+    Opt(Name("jit"), Help("Compile the bytecode to native code before running it")),
+    Opt(Name("jit-loops"), Help("Compile hot loops to native code while interpreting the bytecode")),
+    Str(Name("Xheap"),
+        Help("The heap allocator, 'tlsf' for the two level segregated fit allocator "
+             "or 'list' for the first fit allocator"),
+        Def("tlsf")),
+    Int(Name("Xheap-blocks"),
+        Help("The number of heap block descriptors reserved with the virtual machine memory "
+             "by the 'list' heap allocator, more are allocated when they are used up"),
+        Def(CynSTR(CYN_VM_HEAP_DEFAULT_NHBS)))
 #ifdef CYN_VM_DEBUG_TRACE
     ,Use(vmCmdParseDebugTraceFlags,
         Name("trace"),
@@ -62,8 +92,9 @@ int main(int argc, char *argv[])
 {
     char *eArgv[argc];
 
+    Streams_init();
     Parser(CYN_APPLICATION_NAME, CYN_APPLICATION_VERSION,
-           Commands(AddCmd(run), AddCmd(dassem)),
+           Commands(AddCmd(run), AddCmd(dassem), AddCmd(aot)),
            DefaultCmd(run));
 
 
@@ -72,6 +103,9 @@ int main(int argc, char *argv[])
     if (selected == CMD_dassem) {
         cmdDassem(&dassem.meta, argc, argv);
     }
+    else if (selected == CMD_aot) {
+        cmdAot(&aot.meta, argc, argv);
+    }
     else if (selected == CMD_run) {
         cmdRun(&run.meta, argc, argv);
     }
@@ -87,6 +121,16 @@ int main(int argc, char *argv[])
     return EXIT_SUCCESS;
 }
 
+// The memory reserved must fit the memory committed and the stack
+static void vmCmdCheckMemory(u64 ss, u64 ms, u64 mx)
+{
+    if (mx < ms || mx < ss) {
+        fprintf(stderr, "error: --Xmx %" PRIu64 " is smaller than --Xms %" PRIu64 " or --Xss %" PRIu64 "\n",
+                mx, ms, ss);
+        exit(EXIT_FAILURE);
+    }
+}
+
 void cmdDassem(CmdCommand *cmd, int argc, char **argv)
 {
     FILE *fp = stdout;
@@ -112,29 +156,85 @@ void cmdDassem(CmdCommand *cmd, int argc, char **argv)
     Vector_deinit(&code);
 }
 
+void cmdAot(CmdCommand *cmd, int argc, char **argv)
+{
+    FILE *fp = stdout;
+    Code code;
+    CmdFlagValue *input =  cmdGetPositional(cmd, 0);
+    CmdFlagValue *output = cmdGetFlag(cmd, 0);
+    u32 ss = (u32)cmdGetFlag(cmd, 1)->num;
+    u64 ms = cmdGetFlag(cmd, 2)->num;
+    u64 mx = cmdGetFlag(cmd, 3)->num;
+
+    vmCmdCheckMemory(ss, ms, mx);
+    Vector_init(&code);
+    if (!File_read_all0(input->str, (Buffer *)&code, Stderr) || !VM_verify(&code, Stderr))
+        exit(EXIT_FAILURE);
+
+    if (output) {
+        fp = fopen(output->str, "w");
+        if (fp == NULL) {
+            fprintf(stderr, "error: opening output file '%s' failed\n", output->str);
+            Vector_deinit(&code);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    VM_aot_translate(&code, fp, ms, mx, ss);
+    if (fp != stdout) fclose(fp);
+    Vector_deinit(&code);
+}
+
 void cmdRun(CmdCommand *cmd, int argc, char **argv)
 {
     VM vm = {0};
     Code code;
     CmdFlagValue *input =  cmdGetPositional(cmd, 0);
     u32 ss = (u32)cmdGetFlag(cmd, 0)->num;
-    u32 ms = (u32)cmdGetFlag(cmd, 1)->num;
+    u64 ms = cmdGetFlag(cmd, 1)->num;
+    u64 mx = cmdGetFlag(cmd, 2)->num;
+    bool stats = (bool)cmdGetFlag(cmd, 3)->num;
+    bool jit = (bool)cmdGetFlag(cmd, 4)->num;
+    bool loops = (bool)cmdGetFlag(cmd, 5)->num;
+    const char *heap = cmdGetFlag(cmd, 6)->str;
+    i64 nhbs = (i64)cmdGetFlag(cmd, 7)->num;
+    HeapAllocator alc;
 
 #if defined(CYN_VM_DEBUG_TRACE)
-    u32 trc = (u32) cmdGetFlag(cmd, 2)->num;
+    u32 trc = (u32) cmdGetFlag(cmd, 8)->num;
 #endif
 
+    vmCmdCheckMemory(ss, ms, mx);
+    if (strcmp(heap, "tlsf") == 0)
+        alc = halTlsf;
+    else if (strcmp(heap, "list") == 0)
+        alc = halList;
+    else {
+        fprintf(stderr, "error: unknown heap allocator '%s', expecting 'tlsf' or 'list'\n", heap);
+        exit(EXIT_FAILURE);
+    }
+    if (nhbs < 0 || nhbs > UINT32_MAX / sizeof(HeapBlock)) {
+        fprintf(stderr, "error: --Xheap-blocks %" PRIi64 " is out of range\n", nhbs);
+        exit(EXIT_FAILURE);
+    }
 
     Vector_init(&code);
-    if (!File_read_all0(input->str, (Buffer *)&code, Stderr))
+    if (!File_read_all0(input->str, (Buffer *)&code, Stderr) || !VM_verify(&code, Stderr))
         exit(EXIT_FAILURE);
 
-    VM_init_(&vm, &code, ms, CYN_VM_HEAP_DEFAULT_NHBS, ss);
+    VM_init_(&vm, &code, ms, mx, alc, (u32) nhbs, ss);
+    if (jit && !VM_jit_compile(&vm))
+        fputs("warning: compiling to native code is not supported, interpreting\n", stderr);
+    else if (loops && !jit && !VM_jit_trace_init(&vm))
+        fputs("warning: compiling loops to native code is not supported\n", stderr);
 #if defined(CYN_VM_DEBUG_TRACE)
     vm.dbgTrace = trc;
 #endif
 
     VM_run(&vm, argc, argv);
+    if (stats)
+        fprintf(stderr, "memory: %" PRIu64 " bytes committed, %" PRIu64 " bytes reserved\n",
+                vm.ram.committed, vm.ram.reserved);
     VM_deinit(&vm);
     Vector_deinit(&code);
 }
\ No newline at end of file
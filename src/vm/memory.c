@@ -10,6 +10,8 @@
 
 #include "vm/vm.h"
 
+#include <stdlib.h>
+
 #define vmHEAP(vm) (Heap *)(vm)->ram.ptr
 
 static void VM_heap_insert_heap_block(VM *vm, Heap *heap, HeapBlock *block)
@@ -85,6 +87,45 @@ static void VM_heap_compact(VM *vm, Heap *heap)
 }
 #endif
 
+/**
+ * Links \param count descriptors starting at \param blocks into the list
+ * of fresh descriptors
+ */
+static void VM_heap_add_heap_blocks(Heap *heap, HeapBlock *blocks, u32 count)
+{
+    for (u32 i = 0; i < count; i++)
+        blocks[i].next = (i + 1 < count)? &blocks[i + 1] : heap->fresh;
+    if (count)
+        heap->fresh = blocks;
+    heap->nhbs += count;
+}
+
+/**
+ * Takes a fresh descriptor. Once the descriptors kept before the virtual
+ * machine memory are used up, as many more are allocated outside of it
+ * so that the number of blocks tracked is only limited by the heap size.
+ */
+static HeapBlock *VM_heap_fresh_heap_block(VM *vm, Heap *heap)
+{
+    HeapBlock *block;
+
+    if (heap->fresh == NULL) {
+        u32 count = MAX(heap->nhbs, CYN_VM_HEAP_DEFAULT_NHBS);
+        // the first descriptor of a chunk links the chunks to release them
+        HeapBlock *chunk = malloc(sizeof(HeapBlock) * (count + 1));
+        if (chunk == NULL)
+            return NULL;
+        VM_dbg_trace(vm, trcHEAP, printf("heap: %u more blocks\n", count));
+        chunk->next  = heap->chunks;
+        heap->chunks = chunk;
+        VM_heap_add_heap_blocks(heap, chunk + 1, count);
+    }
+
+    block = heap->fresh;
+    heap->fresh = block->next;
+    return block;
+}
+
 static HeapBlock *VM_heap_alloc_heap_block(VM *vm, Heap *heap, u32 size)
 {
     HeapBlock *ptr  = heap->free;
@@ -107,12 +148,11 @@ static HeapBlock *VM_heap_alloc_heap_block(VM *vm, Heap *heap, u32 size)
                 ptr->size = size;
                 heap->top = ptr->addr + size;
 #ifndef CYN_HA_DISABLE_SPLIT
-            } else if (heap->fresh != NULL) {
+            } else {
                 u32 excess = ptr->size - size;
-                if (excess >= heap->sth) {
+                HeapBlock *split;
+                if (excess >= heap->sth && (split = VM_heap_fresh_heap_block(vm, heap)) != NULL) {
                     ptr->size    = size;
-                    HeapBlock *split = heap->fresh;
-                    heap->fresh  = split->next;
                     split->addr  = ptr->addr + size;
                     VM_dbg_trace(vm, trcHEAP, printf("heap: split %u\n", split->addr));
                     split->size = excess;
@@ -130,9 +170,7 @@ static HeapBlock *VM_heap_alloc_heap_block(VM *vm, Heap *heap, u32 size)
     }
 
     u32 newTop = top + size;
-    if (heap->fresh != NULL && newTop <= heap->lmt) {
-        ptr         = heap->fresh;
-        heap->fresh = ptr->next;
+    if (newTop <= heap->lmt && (ptr = VM_heap_fresh_heap_block(vm, heap)) != NULL) {
         ptr->addr   = top;
         ptr->next   = heap->used;
         ptr->size   = size;
@@ -143,42 +181,325 @@ static HeapBlock *VM_heap_alloc_heap_block(VM *vm, Heap *heap, u32 size)
     return NULL;
 }
 
-void VM_heap_init_(VM *vm, u32 blocks, u32 sth, u8 alignment)
+#define vmTAG(vm, A)   ((HeapTag *) &(vm)->ram.base[(A)])
+#define vmLINKS(vm, A) ((u32 *) &(vm)->ram.base[(A) + sizeof(HeapTag)])
+
+#define VM_TLSF_ALIGNMENT 8
+#define VM_TLSF_MIN       (2 * sizeof(HeapTag))
+
+static inline u32 VM_tlsf_msb(u32 v)
+{
+    return 31 - __builtin_clz(v);
+}
+
+// The bin holding free blocks of \param size bytes
+static void VM_tlsf_mapping(u32 size, u32 *fl, u32 *sl)
+{
+    if (size < VM_TLSF_SMALL) {
+        *fl = 0;
+        *sl = size / (VM_TLSF_SMALL / VM_TLSF_SL_COUNT);
+    }
+    else {
+        u32 msb = VM_tlsf_msb(size);
+        *sl = (size >> (msb - VM_TLSF_SL_LOG2)) ^ VM_TLSF_SL_COUNT;
+        *fl = msb - VM_TLSF_FL_SHIFT + 1;
+    }
+}
+
+static void VM_tlsf_insert(VM *vm, Heap *heap, u32 block, u32 size)
+{
+    u32 *links = vmLINKS(vm, block), next = block + size, fl, sl;
+
+    VM_tlsf_mapping(size, &fl, &sl);
+    links[0] = heap->bins[fl][sl];
+    links[1] = 0;
+    if (links[0] != 0)
+        vmLINKS(vm, links[0])[1] = block;
+    heap->bins[fl][sl] = block;
+    heap->fl |= 1u << fl;
+    heap->sl[fl] |= 1u << sl;
+
+    // free blocks are never next to the top of the heap, they are merged
+    vmTAG(vm, block)->size = size | htgFree;
+    vmTAG(vm, next)->prev = block;
+    vmTAG(vm, next)->size |= htgPrevFree;
+}
+
+static void VM_tlsf_remove(VM *vm, Heap *heap, u32 block)
+{
+    u32 *links = vmLINKS(vm, block), fl, sl;
+
+    VM_tlsf_mapping(vmTAG(vm, block)->size & ~htgFlags, &fl, &sl);
+    if (links[0] != 0)
+        vmLINKS(vm, links[0])[1] = links[1];
+    if (links[1] != 0) {
+        vmLINKS(vm, links[1])[0] = links[0];
+    }
+    else {
+        heap->bins[fl][sl] = links[0];
+        if (links[0] == 0) {
+            heap->sl[fl] &= ~(1u << sl);
+            if (heap->sl[fl] == 0)
+                heap->fl &= ~(1u << fl);
+        }
+    }
+}
+
+/**
+ * Finds a free block of at least \param size bytes. The size is rounded
+ * up to the next bin so that any block of the bin found fits.
+ */
+static u32 VM_tlsf_find(Heap *heap, u32 size)
+{
+    u32 fl, sl, map;
+
+    if (size >= VM_TLSF_SMALL)
+        size += (1u << (VM_tlsf_msb(size) - VM_TLSF_SL_LOG2)) - 1;
+    VM_tlsf_mapping(size, &fl, &sl);
+
+    map = heap->sl[fl] & (~0u << sl);
+    if (map == 0) {
+        map = heap->fl & (~0u << (fl + 1));
+        if (map == 0)
+            return 0;
+        fl = __builtin_ctz(map);
+        map = heap->sl[fl];
+    }
+    return heap->bins[fl][__builtin_ctz(map)];
+}
+
+/**
+ * Shrinks the block at \param block, which spans \param bsize bytes, to
+ * \param size bytes. The rest is given back to the heap if it is worth
+ * splitting, merged with the next block if that one is free.
+ */
+static void VM_tlsf_trim(VM *vm, Heap *heap, u32 block, u32 size, u32 bsize)
+{
+    HeapTag *tag = vmTAG(vm, block);
+    u32 rest = block + size, next = block + bsize;
+
+    if (bsize - size < MAX(heap->sth, VM_TLSF_MIN)) {
+        tag->size = bsize | (tag->size & htgPrevFree);
+        if (next != heap->top)
+            vmTAG(vm, next)->size &= ~htgPrevFree;
+        return;
+    }
+
+    VM_dbg_trace(vm, trcHEAP, printf("heap: split %u\n", rest));
+    tag->size = size | (tag->size & htgPrevFree);
+    if (next == heap->top) {
+        heap->top = rest;
+        return;
+    }
+    if (vmTAG(vm, next)->size & htgFree) {
+        VM_tlsf_remove(vm, heap, next);
+        bsize += vmTAG(vm, next)->size & ~htgFlags;
+    }
+    VM_tlsf_insert(vm, heap, rest, block + bsize - rest);
+}
+
+// The size of the block holding \param size bytes, 0 if it cannot fit in the heap
+static u32 VM_tlsf_size(Heap *heap, u32 size)
+{
+    if (size > heap->lmt)
+        return 0;
+    return MAX(CynAlign(size + sizeof(HeapTag), VM_TLSF_ALIGNMENT), VM_TLSF_MIN);
+}
+
+static u32 VM_tlsf_alloc(VM *vm, Heap *heap, u32 size)
+{
+    u32 block;
+
+    size = VM_tlsf_size(heap, size);
+    if (size == 0)
+        return 0;
+
+    block = VM_tlsf_find(heap, size);
+    if (block != 0) {
+        VM_tlsf_remove(vm, heap, block);
+        VM_tlsf_trim(vm, heap, block, size, vmTAG(vm, block)->size & ~htgFlags);
+        return block + sizeof(HeapTag);
+    }
+
+    if (size > heap->lmt - heap->top)
+        return 0;
+    block = heap->top;
+    heap->top += size;
+    vmTAG(vm, block)->size = size;
+    return block + sizeof(HeapTag);
+}
+
+// The block allocated at \param mem, 0 if there is none
+static u32 VM_tlsf_block(VM *vm, Heap *heap, u32 mem)
+{
+    u32 block = mem - sizeof(HeapTag), size;
+    HeapTag *tag;
+
+    if ((mem & (VM_TLSF_ALIGNMENT - 1)) || block < vm->ram.hb || mem >= heap->top)
+        return 0;
+    tag = vmTAG(vm, block);
+    size = tag->size & ~htgFlags;
+    if ((tag->size & htgFree) || size < VM_TLSF_MIN || size > heap->top - block)
+        return 0;
+    return block;
+}
+
+// Coalesces the block with its free neighbours, no list is searched
+static bool VM_tlsf_free(VM *vm, Heap *heap, u32 mem)
+{
+    u32 block = VM_tlsf_block(vm, heap, mem), size, next;
+    HeapTag *tag;
+
+    if (block == 0)
+        return false;
+    tag = vmTAG(vm, block);
+    size = tag->size & ~htgFlags;
+    next = block + size;
+    if (next != heap->top && (vmTAG(vm, next)->size & htgFree)) {
+        VM_dbg_trace(vm, trcHEAP, printf("heap: merge %u\n", next));
+        VM_tlsf_remove(vm, heap, next);
+        size += vmTAG(vm, next)->size & ~htgFlags;
+        next = block + size;
+    }
+    if (tag->size & htgPrevFree) {
+        VM_dbg_trace(vm, trcHEAP, printf("heap: merge %u\n", block));
+        block = tag->prev;
+        VM_tlsf_remove(vm, heap, block);
+        size += vmTAG(vm, block)->size & ~htgFlags;
+    }
+
+    if (next == heap->top) {
+        VM_dbg_trace(vm, trcHEAP, printf("heap: new top %u\n", block));
+        heap->top = block;
+    }
+    else {
+        VM_tlsf_insert(vm, heap, block, size);
+    }
+    return true;
+}
+
+/**
+ * Resizes the block allocated at \param mem in place when it is at the top
+ * of the heap or when the next block is free and large enough, otherwise
+ * moves it to a new block
+ */
+static u32 VM_tlsf_realloc(VM *vm, Heap *heap, u32 mem, u32 size)
+{
+    u32 block = VM_tlsf_block(vm, heap, mem), need = VM_tlsf_size(heap, size), bsize, next, moved;
+    HeapTag *tag;
+
+    if (block == 0 || need == 0)
+        return 0;
+    tag = vmTAG(vm, block);
+    bsize = tag->size & ~htgFlags;
+    next = block + bsize;
+
+    if (next == heap->top && need <= heap->lmt - block) {
+        VM_dbg_trace(vm, trcHEAP, printf("heap: resize top block\n"));
+        tag->size = need | (tag->size & htgPrevFree);
+        heap->top = block + need;
+        return mem;
+    }
+    if (need > bsize && next != heap->top && (vmTAG(vm, next)->size & htgFree) &&
+        bsize + (vmTAG(vm, next)->size & ~htgFlags) >= need) {
+        VM_dbg_trace(vm, trcHEAP, printf("heap: merge %u\n", next));
+        VM_tlsf_remove(vm, heap, next);
+        bsize += vmTAG(vm, next)->size & ~htgFlags;
+    }
+    if (need <= bsize) {
+        VM_tlsf_trim(vm, heap, block, need, bsize);
+        return mem;
+    }
+
+    moved = VM_tlsf_alloc(vm, heap, size);
+    if (moved == 0)
+        return 0;
+    memmove(&vm->ram.base[moved], &vm->ram.base[mem], bsize - sizeof(HeapTag));
+    VM_tlsf_free(vm, heap, mem);
+    return moved;
+}
+
+void VM_heap_init_(VM *vm, HeapAllocator alc, u32 blocks, u32 sth, u8 alignment)
 {
     Heap *heap = vmHEAP(vm);
+    heap->alc = alc;
     heap->sth = sth;
     heap->aln = alignment;
     heap->lmt = vm->ram.hlm;
 
+    if (alc == halTlsf) {
+        heap->fl = 0;
+        memset(heap->sl, 0, sizeof(heap->sl));
+        memset(heap->bins, 0, sizeof(heap->bins));
+        heap->top = CynAlign(vm->ram.hb, VM_TLSF_ALIGNMENT);
+        return;
+    }
+
     heap->free   = NULL;
     heap->used   = NULL;
-    heap->fresh  = (HeapBlock *) &heap->mem[0];
+    heap->fresh  = NULL;
+    heap->chunks = NULL;
+    heap->nhbs   = 0;
     heap->top    = vm->ram.hb;
 
-    HeapBlock *block = heap->fresh;
-    size_t i  = blocks - 1;
-    while (i--) {
-        block->next = block + 1;
-        block++;
-    }
-    block->next = NULL;
+    VM_heap_add_heap_blocks(heap, (HeapBlock *) &heap->mem[0], blocks);
 }
 
-u32 VM_alloc(VM *vm, u32 size)
+void VM_heap_deinit(VM *vm)
 {
     Heap *heap = vmHEAP(vm);
-    HeapBlock *block = VM_heap_alloc_heap_block(vm, heap, size);
+    HeapBlock *chunk;
+
+    if (heap->alc != halList)
+        return;
+    while ((chunk = heap->chunks) != NULL) {
+        heap->chunks = chunk->next;
+        free(chunk);
+    }
+}
+
+// Raises the heap limit so that a block of \param size bytes fits past the top of the heap
+static bool VM_heap_grow(VM *vm, Heap *heap, u32 size)
+{
+    u64 limit = (u64) heap->top + size + sizeof(HeapTag) + MAX(heap->aln, VM_TLSF_ALIGNMENT);
+    if (!VM_memory_grow_heap(vm, limit))
+        return false;
+    heap->lmt = vm->ram.hlm;
+    return true;
+}
+
+static u32 VM_heap_alloc(VM *vm, Heap *heap, u32 size)
+{
+    HeapBlock *block;
+
+    if (heap->alc == halTlsf)
+        return VM_tlsf_alloc(vm, heap, size);
+
+    block = VM_heap_alloc_heap_block(vm, heap, size);
     if (block != NULL) {
         return block->addr;
     }
     return 0;
 }
 
+u32 VM_alloc(VM *vm, u32 size)
+{
+    Heap *heap = vmHEAP(vm);
+    u32 mem = VM_heap_alloc(vm, heap, size);
+
+    if (mem == 0 && VM_heap_grow(vm, heap, size))
+        mem = VM_heap_alloc(vm, heap, size);
+    return mem;
+}
+
 bool VM_free(VM *vm, u32 mem)
 {
     if (mem == 0) return 0;
 
     Heap *heap = vmHEAP(vm);
+    if (heap->alc == halTlsf)
+        return VM_tlsf_free(vm, heap, mem);
+
     HeapBlock *block = heap->used;
     HeapBlock *prev  = NULL;
     while (block != NULL) {
@@ -200,6 +521,168 @@ bool VM_free(VM *vm, u32 mem)
     return false;
 }
 
+/**
+ * Grows the block allocated at \param mem in place, into the free block
+ * right after it or past the top of the heap, otherwise moves it
+ */
+static u32 VM_heap_realloc(VM *vm, Heap *heap, u32 mem, u32 size)
+{
+    HeapBlock *block = heap->used, *next = heap->free, *prev = NULL;
+    u32 end, moved;
+
+    while (block != NULL && block->addr != mem)
+        block = block->next;
+    if (block == NULL)
+        return 0;
+
+    size = CynAlign(size, heap->aln);
+    end = block->addr + block->size;
+    if (end >= heap->top && size <= heap->lmt - block->addr) {
+        VM_dbg_trace(vm, trcHEAP, printf("heap: resize top block\n"));
+        block->size = size;
+        heap->top = block->addr + size;
+        return mem;
+    }
+    if (size <= block->size)
+        return mem;
+
+    while (next != NULL && next->addr != end) {
+        prev = next;
+        next = next->next;
+    }
+    if (next != NULL) {
+        bool isTop = (next->addr + next->size >= heap->top) && (block->addr + size <= heap->lmt);
+        u32 avail = block->size + next->size;
+        if (!isTop && avail >= size && avail - size >= heap->sth) {
+            VM_dbg_trace(vm, trcHEAP, printf("heap: shrink %u\n", next->addr));
+            next->addr = block->addr + size;
+            next->size = avail - size;
+            block->size = size;
+            return mem;
+        }
+        if (isTop || avail >= size) {
+            VM_dbg_trace(vm, trcHEAP, printf("heap: merge %u\n", next->addr));
+            if (prev != NULL)
+                prev->next = next->next;
+            else
+                heap->free = next->next;
+            next->next  = heap->fresh;
+            heap->fresh = next;
+            block->size = isTop? size : avail;
+            if (isTop)
+                heap->top = block->addr + size;
+            return mem;
+        }
+    }
+
+    moved = VM_alloc(vm, size);
+    if (moved == 0)
+        return 0;
+    memmove(&vm->ram.base[moved], &vm->ram.base[mem], block->size);
+    VM_free(vm, mem);
+    return moved;
+}
+
+static u32 VM_heap_resize(VM *vm, Heap *heap, u32 mem, u32 size)
+{
+    if (heap->alc == halTlsf)
+        return VM_tlsf_realloc(vm, heap, mem, size);
+    return VM_heap_realloc(vm, heap, mem, size);
+}
+
+u32 VM_realloc(VM *vm, u32 mem, u32 size)
+{
+    Heap *heap = vmHEAP(vm);
+    u32 moved;
+
+    if (mem == 0)
+        return VM_alloc(vm, size);
+    moved = VM_heap_resize(vm, heap, mem, size);
+    if (moved == 0 && VM_heap_grow(vm, heap, size))
+        moved = VM_heap_resize(vm, heap, mem, size);
+    return moved;
+}
+
+#define vmARENA(vm, A) ((Arena *) MEM((vm), (A)))
+
+static Arena *VM_arena_at(VM *vm, u32 arena)
+{
+    if (arena == 0 || arena > vm->ram.hlm - sizeof(Arena))
+        VM_abort(vm, "Invalid arena %08x", arena);
+    return vmARENA(vm, arena);
+}
+
+u32 VM_arena_new(VM *vm, u32 size)
+{
+    u32 arena;
+    Arena *a;
+
+    size = CynAlign(MAX(size, CYN_VM_ALIGNMENT), CYN_VM_ALIGNMENT);
+    if (size > vm->ram.size)
+        return 0;
+    arena = VM_alloc(vm, sizeof(Arena) + size);
+    if (arena == 0)
+        return 0;
+
+    a = vmARENA(vm, arena);
+    a->chunk = 0;
+    a->top = CynAlign(arena + sizeof(Arena), CYN_VM_ALIGNMENT);
+    a->end = arena + sizeof(Arena) + size;
+    a->csz = size;
+    return arena;
+}
+
+u32 VM_arena_alloc(VM *vm, u32 arena, u32 size)
+{
+    Arena *a = VM_arena_at(vm, arena);
+    u32 chunk, csz, mem;
+
+    size = CynAlign(size, CYN_VM_ALIGNMENT);
+    if (size <= a->end - a->top) {
+        mem = a->top;
+        a->top += size;
+        return mem;
+    }
+
+    // allocations larger than the chunks get a chunk of their own
+    csz = MAX(a->csz, size) + CYN_VM_ALIGNMENT;
+    if (size > vm->ram.size || (chunk = VM_alloc(vm, csz)) == 0)
+        return 0;
+    VM_dbg_trace(vm, trcHEAP, printf("heap: arena %u chunk %u\n", arena, chunk));
+    a = vmARENA(vm, arena);
+    *(u32 *) MEM(vm, chunk) = a->chunk;
+    a->chunk = chunk;
+    mem = chunk + CYN_VM_ALIGNMENT;
+    a->top = mem + size;
+    a->end = chunk + csz;
+    return mem;
+}
+
+static void VM_arena_release(VM *vm, Arena *a)
+{
+    u32 chunk = a->chunk;
+    while (chunk != 0) {
+        u32 prev = *(u32 *) MEM(vm, chunk);
+        VM_free(vm, chunk);
+        chunk = prev;
+    }
+    a->chunk = 0;
+}
+
+void VM_arena_reset(VM *vm, u32 arena)
+{
+    Arena *a = VM_arena_at(vm, arena);
+    VM_arena_release(vm, a);
+    a->top = CynAlign(arena + sizeof(Arena), CYN_VM_ALIGNMENT);
+    a->end = arena + sizeof(Arena) + a->csz;
+}
+
+void VM_arena_free(VM *vm, u32 arena)
+{
+    VM_arena_release(vm, VM_arena_at(vm, arena));
+    VM_free(vm, arena);
+}
+
 u32 VM_cstring_dup_(VM *vm, const char *s, u32 len)
 {
     u32 mem = VM_alloc(vm, len + 1);
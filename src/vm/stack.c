@@ -0,0 +1,460 @@
+/**
+ * Copyright (c) 2022 Suilteam, Carter Mbotho
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the MIT license. See LICENSE for details.
+ *
+ * @author Carter
+ * @date 2022-12-31
+ */
+
+#include "vm/vm.h"
+#include "vm/builtins.h"
+
+#include <stdlib.h>
+
+#define VM_STACK_NONE UINT32_MAX
+
+// Functions pushing more than this are left to the checked handlers
+#define VM_STACK_MAX_DEPTH (1u << 20)
+
+// The number of values returned or arguments dropped by a function is not known
+#define VM_STACK_UNKNOWN    -1
+// None of the `ret` (or `fret`) instructions of a function have been seen yet
+#define VM_STACK_UNSEEN     -2
+
+/**
+ * A function found in the decoded instruction stream
+ *
+ * @property entry the index of the first instruction of the function
+ *
+ * @property grow the number of bytes the function pushes below the
+ * stack pointer it was entered with
+ *
+ * @property nret the number of values returned by every `ret` of the function
+ *
+ * @property nargs the number of arguments dropped by every `fret` of the function
+ *
+ * @property ok true if the stack usage of the function is known
+ */
+typedef struct VirtualMachineStackFunction {
+    u32 entry;
+    u32 grow;
+    i32 nret;
+    i32 nargs;
+    bool ok;
+} StackFunction;
+
+/**
+ * The stack at an instruction of a function, relative to the stack
+ * pointer the function was entered with
+ *
+ * @property depth the number of bytes pushed by the function
+ *
+ * @property top the value on top of the stack, valid if \property known
+ */
+typedef struct VirtualMachineStackState {
+    i32 depth;
+    i64 top;
+    bool known;
+    bool seen;
+} StackState;
+
+typedef struct VirtualMachineStackAnalysis {
+    VM *vm;
+    u32 count;
+    StackFunction *funcs;
+    u32 nfuncs;
+    u32 *fid;
+    u32 *owner;
+    u32 *mark;
+    u32 *work;
+    StackState *states;
+} StackAnalysis;
+
+static bool VM_stack_writes_reg(const DecodedInstruction *di, u8 reg)
+{
+    return VM_OP_WRITES_A(di->instr.opc) && di->ka == okReg && di->instr.ra == reg;
+}
+
+static bool VM_stack_is_jump(const DecodedInstruction *di)
+{
+    return di->instr.opc >= opJmp && di->instr.opc <= opJmps;
+}
+
+static bool VM_stack_is_call(const DecodedInstruction *di)
+{
+    return di->instr.opc == opCall || di->instr.opc == opFcall;
+}
+
+static bool VM_stack_ends(const DecodedInstruction *di)
+{
+    return di->op == VM_DECODE_TRAP || di->op == VM_DECODE_UNKNOWN ||
+           di->instr.opc == opHalt || di->instr.opc == opRet || di->instr.opc == opFret;
+}
+
+/**
+ * Gets the index of the instruction targeted by a jump or call through an
+ * immediate value or by a compare and branch instruction,
+ * \see VM_DECODE_INVALID if the target is not valid
+ */
+static u32 VM_stack_target(const VM *vm, const DecodedInstruction *di)
+{
+    u64 target = di->iip + (VM_OP_BRANCH(di->instr.opc)? di->instr.itg : di->instr.ii);
+    if (target > Vector_len(vm->code))
+        return VM_DECODE_INVALID;
+    return vm->dmap[target];
+}
+
+static u32 VM_stack_successors(const StackAnalysis *sa, u32 i, u32 next[2])
+{
+    const DecodedInstruction *di = &sa->vm->decoded[i];
+    u32 n = 0, target;
+
+    if (VM_stack_ends(di))
+        return 0;
+
+    if (VM_stack_is_jump(di) || VM_OP_BRANCH(di->instr.opc)) {
+        // jumps to invalid targets abort the virtual machine
+        target = VM_stack_target(sa->vm, di);
+        if (target != VM_DECODE_INVALID)
+            next[n++] = target;
+        if (di->instr.opc == opJmp)
+            return n;
+    }
+
+    next[n++] = i + 1;
+    return n;
+}
+
+/**
+ * Functions are entered with `call <imm>`, changing the control flow in any
+ * other way would skip the stack check done on entry
+ */
+static bool VM_stack_functions(StackAnalysis *sa)
+{
+    DecodedInstruction *code = sa->vm->decoded;
+
+    sa->fid[0] = 0;
+    sa->funcs[sa->nfuncs++] = (StackFunction) {
+        .entry = 0, .ok = true, .nret = VM_STACK_UNSEEN, .nargs = VM_STACK_UNSEEN
+    };
+
+    for (u32 i = 0; i < sa->count; i++) {
+        DecodedInstruction *di = &code[i];
+        u32 target;
+
+        if (di->op == VM_DECODE_TRAP || di->op == VM_DECODE_UNKNOWN)
+            continue;
+        if ((VM_stack_is_jump(di) || VM_stack_is_call(di)) && di->ka != okImm)
+            return false;
+        if (VM_stack_writes_reg(di, ip))
+            return false;
+        if (!VM_stack_is_call(di))
+            continue;
+
+        target = VM_stack_target(sa->vm, di);
+        if (target >= sa->count || sa->fid[target] != VM_STACK_NONE)
+            continue;
+
+        sa->fid[target] = sa->nfuncs;
+        sa->funcs[sa->nfuncs++] = (StackFunction) {
+            .entry = target, .ok = true, .nret = VM_STACK_UNSEEN, .nargs = VM_STACK_UNSEEN
+        };
+    }
+
+    return true;
+}
+
+static void VM_stack_count(i32 *count, const DecodedInstruction *di)
+{
+    i32 n = (di->ka == okImm)? (u8) di->instr.ii : VM_STACK_UNKNOWN;
+    if (*count == VM_STACK_UNSEEN)
+        *count = n;
+    else if (*count != n)
+        *count = VM_STACK_UNKNOWN;
+}
+
+/**
+ * Finds the instructions reachable from the entry of function \param f and
+ * the number of values it returns. Functions sharing instructions can be
+ * entered without a call, their stack usage is not known.
+ */
+static void VM_stack_body(StackAnalysis *sa, u32 f)
+{
+    StackFunction *fn = &sa->funcs[f];
+    u32 nwork = 0, next[2], n;
+
+    sa->work[nwork++] = fn->entry;
+    while (nwork) {
+        u32 i = sa->work[--nwork];
+        const DecodedInstruction *di = &sa->vm->decoded[i];
+
+        // running past the last instruction halts
+        if (i >= sa->count || sa->mark[i] == f)
+            continue;
+        sa->mark[i] = f;
+
+        if (sa->owner[i] == VM_STACK_NONE)
+            sa->owner[i] = f;
+        else if (sa->owner[i] != f) {
+            fn->ok = false;
+            sa->funcs[sa->owner[i]].ok = false;
+        }
+
+        if (VM_stack_writes_reg(di, sp))
+            fn->ok = false;
+
+        if (VM_stack_writes_reg(di, bp)) {
+            // returning restores the caller's stack from `bp`
+            fn->nret = fn->nargs = VM_STACK_UNKNOWN;
+        }
+        else if (di->op != VM_DECODE_TRAP && di->op != VM_DECODE_UNKNOWN) {
+            if (di->instr.opc == opRet)
+                VM_stack_count(&fn->nret, di);
+            else if (di->instr.opc == opFret)
+                VM_stack_count(&fn->nargs, di);
+        }
+
+        n = VM_stack_successors(sa, i, next);
+        for (u32 j = 0; j < n; j++)
+            sa->work[nwork++] = next[j];
+    }
+}
+
+/**
+ * Applies the effect of the instruction at index \param i on the stack,
+ * returns false if the effect is not known
+ */
+static bool VM_stack_apply(const StackAnalysis *sa, u32 i, StackState *st)
+{
+    const DecodedInstruction *di = &sa->vm->decoded[i];
+    const Instruction *instr = &di->instr;
+    i32 nargs, nret;
+    u32 target;
+    StackFunction *callee;
+
+    switch (instr->opc) {
+        case opPush:
+            st->depth += 8;
+            st->known = di->ka == okImm;
+            st->top = instr->ii;
+            break;
+        case opPop:
+            st->depth -= 8;
+            st->known = false;
+            break;
+        case opPopn:
+            if (di->ka != okImm)
+                return false;
+            st->depth -= ((u8) instr->ii) << 3;
+            st->known = false;
+            break;
+        case opAlloca:
+            return false;
+        case opNcallr:
+            // native functions can write anywhere
+            st->known = false;
+            break;
+        case opVst:
+        case opMcpy:
+        case opMset:
+            // store to the memory referenced by their arguments
+            st->known = false;
+            break;
+        case opFcall:
+            if (di->ka != okImm)
+                return false;
+            target = VM_stack_target(sa->vm, di);
+            if (target >= sa->count)
+                return false;
+
+            // the function drops its own arguments, values are returned in registers
+            callee = &sa->funcs[sa->fid[target]];
+            if (callee->nret != VM_STACK_UNSEEN || callee->nargs < 0 ||
+                st->depth < (callee->nargs << 3))
+                return false;
+            st->depth -= callee->nargs << 3;
+            st->known = false;
+            break;
+        case opCall:
+        case opNcall:
+            if (!st->known || di->ka != okImm)
+                return false;
+
+            if (instr->opc == opCall) {
+                // calls to invalid targets abort the virtual machine
+                target = VM_stack_target(sa->vm, di);
+                if (target >= sa->count)
+                    return false;
+                callee = &sa->funcs[sa->fid[target]];
+                nret = (callee->nargs == VM_STACK_UNSEEN)? callee->nret : VM_STACK_UNKNOWN;
+            }
+            else
+                // every builtin returns a single value
+                nret = (instr->iu < bncCOUNT)? 1 : VM_STACK_UNKNOWN;
+            if (nret < 0)
+                return false;
+
+            // the arguments and their count are popped on return, the
+            // returned values and their count pushed
+            nargs = (u8) st->top;
+            if (st->depth < ((nargs + 1) << 3))
+                return false;
+            st->depth += (nret - nargs) << 3;
+            st->known = true;
+            st->top = nret;
+            break;
+        default:
+            if (VM_OP_WRITES_A(instr->opc) && (di->ka == okRegMem || di->ka == okImmMem))
+                st->known = false;
+            break;
+    }
+
+    return st->depth >= 0 && st->depth <= VM_STACK_MAX_DEPTH;
+}
+
+/**
+ * Computes the number of bytes pushed by function \param f, every path
+ * reaching an instruction must do so with the same number of bytes pushed
+ */
+static void VM_stack_depth(StackAnalysis *sa, u32 f)
+{
+    StackFunction *fn = &sa->funcs[f];
+    u32 nwork = 0, next[2], n;
+
+    sa->states[fn->entry] = (StackState) { .seen = true };
+    sa->work[nwork++] = fn->entry;
+    while (nwork && fn->ok) {
+        u32 i = sa->work[--nwork];
+        StackState st = sa->states[i];
+
+        if (VM_stack_ends(&sa->vm->decoded[i]))
+            continue;
+
+        if (!VM_stack_apply(sa, i, &st)) {
+            fn->ok = false;
+            break;
+        }
+        fn->grow = MAX(fn->grow, (u32) st.depth);
+
+        n = VM_stack_successors(sa, i, next);
+        for (u32 j = 0; j < n; j++) {
+            StackState *to;
+            if (next[j] >= sa->count)
+                continue;
+
+            to = &sa->states[next[j]];
+            if (!to->seen) {
+                *to = st;
+                to->seen = true;
+            }
+            else if (to->depth != st.depth) {
+                fn->ok = false;
+                break;
+            }
+            else if (to->known && (!st.known || to->top != st.top)) {
+                // only ever forgets the top of the stack, so this terminates
+                to->known = false;
+            }
+            else continue;
+
+            sa->work[nwork++] = next[j];
+        }
+    }
+}
+
+static u16 VM_stack_unchecked_key(const DecodedInstruction *di)
+{
+    if (di->op == VM_SPEC_KEY(sopPush, szQuad, sfR))
+        return VM_STACK_KEY(usPushR);
+    // pushing an immediate value always pushes 64-bits
+    if (di->op >= VM_SPEC_KEY(sopPush, 0, 0) && di->op < VM_SPEC_KEY(sopPush + 1, 0, 0) &&
+        (di->op - VM_SPEC_KEY(sopPush, 0, 0)) % sfCOUNT == sfI)
+        return VM_STACK_KEY(usPushI);
+    if (di->op == VM_SPEC_KEY(sopPop, szQuad, sfR))
+        return VM_STACK_KEY(usPopR);
+    if (di->op == (opPopn << 1) && di->ka == okImm)
+        return VM_STACK_KEY(usPopn);
+    return di->op;
+}
+
+static void VM_stack_apply_keys(StackAnalysis *sa)
+{
+    for (u32 i = 0; i < sa->count; i++) {
+        DecodedInstruction *di = &sa->vm->decoded[i];
+
+        if (di->op == (opCall << 1) && di->ka == okImm) {
+            u32 target = VM_stack_target(sa->vm, di);
+            StackFunction *fn;
+            if (target >= sa->count)
+                continue;
+
+            // the call frame is pushed right before entering the function
+            fn = &sa->funcs[sa->fid[target]];
+            if (fn->ok) {
+                di->op = VM_STACK_KEY(usCall);
+                di->stk = fn->grow + 16;
+            }
+        }
+        else if (di->op == (opFcall << 1) && di->ka == okImm) {
+            u32 target = VM_stack_target(sa->vm, di);
+            StackFunction *fn;
+            if (target >= sa->count)
+                continue;
+
+            // checked by `fcall` along with the frame
+            fn = &sa->funcs[sa->fid[target]];
+            if (fn->ok)
+                di->stk = fn->grow + 16;
+        }
+        else if (sa->owner[i] != VM_STACK_NONE && sa->funcs[sa->owner[i]].ok) {
+            di->op = VM_stack_unchecked_key(di);
+        }
+    }
+
+    if (sa->funcs[0].ok)
+        sa->vm->stk = sa->funcs[0].grow;
+}
+
+void VM_stack_analyze(VM *vm, u32 count)
+{
+    StackAnalysis sa = {.vm = vm, .count = count};
+
+    vm->stk = 0;
+    if (count == 0)
+        return;
+
+    sa.funcs = calloc(count, sizeof(StackFunction));
+    sa.fid = malloc(sizeof(u32) * count);
+    sa.owner = malloc(sizeof(u32) * count);
+    sa.mark = malloc(sizeof(u32) * count);
+    // every instruction is queued at most twice per successor
+    sa.work = malloc(sizeof(u32) * (4 * count + 2));
+    sa.states = calloc(count, sizeof(StackState));
+    if (!sa.funcs || !sa.fid || !sa.owner || !sa.mark || !sa.work || !sa.states)
+        goto done;
+
+    for (u32 i = 0; i < count; i++)
+        sa.fid[i] = sa.owner[i] = sa.mark[i] = VM_STACK_NONE;
+
+    if (!VM_stack_functions(&sa))
+        goto done;
+
+    for (u32 f = 0; f < sa.nfuncs; f++)
+        VM_stack_body(&sa, f);
+    for (u32 f = 0; f < sa.nfuncs; f++) {
+        if (sa.funcs[f].ok)
+            VM_stack_depth(&sa, f);
+    }
+
+    VM_stack_apply_keys(&sa);
+
+done:
+    free(sa.funcs);
+    free(sa.fid);
+    free(sa.owner);
+    free(sa.mark);
+    free(sa.work);
+    free(sa.states);
+}
@@ -16,6 +16,7 @@ const char* vmModeNamesTbl[] = {".b", ".s", ".w", ".q"};
 
 const char *vmRegisterNameTbl[] = {
         "r0", "r1", "r2", "r3", "r4", "r5",
+        "r6", "r7", "r8", "r9", "r10", "r11",
         "sp", "ip", "bp", "flg"
 };
 
@@ -77,13 +78,31 @@ Register Vm_get_register_from_str_(const char *str, u32 len)
         case 'f':
             return (str[1] == 'l' && len == 3 && str[2] == 'g') ? flg : regCOUNT;
         case 'r':
-            if (str[1] < '0' || str[1] > '5' || len != 2) return regCOUNT;
-            return r0 + str[1] - '0';
+            if (str[1] < '0' || str[1] > '9') return regCOUNT;
+            if (len == 2) return r0 + str[1] - '0';
+            // r10 and r11
+            if (str[1] != '1' || str[2] < '0' || str[2] > '1') return regCOUNT;
+            return r10 + str[2] - '0';
         default:
             return regCOUNT;
     }
 }
 
+u8 Vm_get_vector_register_from_str_(const char *str, u32 len)
+{
+    if (len != 2 || str[0] != 'v' || str[1] < '0' || str[1] >= '0' + VM_VREG_COUNT)
+        return VM_VREG_COUNT;
+    return str[1] - '0';
+}
+
+static void VM_code_print_register(u8 reg, bool vector, FILE *fp)
+{
+    if (vector)
+        fprintf(fp, "v%u", reg);
+    else
+        fputs(vmRegisterNameTbl[reg], fp);
+}
+
 void VM_code_print_instruction_(const Instruction* instr, FILE *fp)
 {
     if (instr->osz == 0) {
@@ -119,7 +138,7 @@ void VM_code_print_instruction_(const Instruction* instr, FILE *fp)
         case 3:
             if (instr->iam)
                 fputc('[', fp);
-            fputs(vmRegisterNameTbl[instr->ra], fp);
+            VM_code_print_register(instr->ra, !instr->iam && VM_OP_VECTOR_A(instr->opc), fp);
             if (instr->iam)
                 fputc(']', fp);
 
@@ -128,10 +147,12 @@ void VM_code_print_instruction_(const Instruction* instr, FILE *fp)
             if (instr->ibm)
                 fputc('[', fp);
             if (instr->rmd == amReg) {
-                fputs(vmRegisterNameTbl[instr->rb], fp);
+                VM_code_print_register(instr->rb, !instr->ibm && VM_OP_VECTOR_B(instr->opc), fp);
                 if (instr->iea)
                     fprintf(fp, ", %" PRIi64, instr->ii);
             }
+            else if (!instr->ibm && VM_OP_FLOAT(instr->opc) && instr->opc != opItof)
+                fprintf(fp, "%.17g", VM_fread(&instr->ii, instr->ims));
             else
                 fprintf(fp, "%" PRIi64, instr->ii);
             if (instr->ibm)
@@ -141,6 +162,9 @@ void VM_code_print_instruction_(const Instruction* instr, FILE *fp)
             printf("Unsupported size of %u.%u\n", instr->opc, instr->osz);
             unreachable();
     }
+
+    if (VM_OP_BRANCH(instr->opc))
+        fprintf(fp, " %" PRIi32, instr->itg);
 }
 
 void VM_put_utf8_chr_(VM *vm, u32 chr, FILE *fp)
@@ -0,0 +1,164 @@
+/**
+ * Copyright (c) 2022 Suilteam, Carter Mbotho
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the MIT license. See LICENSE for details.
+ *
+ * @author Carter
+ * @date 2022-12-30
+ */
+
+#include "vm/vm.h"
+#include "vm/builtins.h"
+
+#include <stdlib.h>
+
+// The number of arguments taken by every op code
+static const u8 vmOpArgsTbl[] = {
+#define XX(N, S, A) A,
+    VM_OP_CODES(XX)
+#undef XX
+};
+
+#define VM_verify_error(ES, IP, FMT, ...)                                               \
+    ({ if (ES) Stream_printf((ES), "error: invalid bytecode at %08u: " FMT "\n", (IP), ##__VA_ARGS__); \
+       false; })
+
+// Register fields are 4 bits wide and all 16 values name a register, only
+// vector register operands can be out of range
+_Static_assert(regCOUNT == 16, "register fields must be able to name every register");
+
+static bool VM_verify_registers(const Instruction *instr, u32 ip, Stream *es)
+{
+    bool ra = (instr->osz == 3) || (instr->osz == 2 && instr->rmd == amReg);
+    bool rb = (instr->osz == 3) && (instr->rmd == amReg);
+
+    if (ra && !instr->iam && VM_OP_VECTOR_A(instr->opc) && instr->ra >= VM_VREG_COUNT)
+        return VM_verify_error(es, ip, "%s uses vector register %u, there are only %u vector registers",
+                               vmInstructionNamesTbl[instr->opc], instr->ra, VM_VREG_COUNT);
+    if (rb && !instr->ibm && VM_OP_VECTOR_B(instr->opc) && instr->rb >= VM_VREG_COUNT)
+        return VM_verify_error(es, ip, "%s uses vector register %u, there are only %u vector registers",
+                               vmInstructionNamesTbl[instr->opc], instr->rb, VM_VREG_COUNT);
+    return true;
+}
+
+static bool VM_verify_mode(const Instruction *instr, u32 ip, Stream *es)
+{
+    if (VM_OP_FLOAT(instr->opc) && instr->imd != szWord && instr->imd != szQuad)
+        return VM_verify_error(es, ip, "%s only supports the .w and .q modes, got %s",
+                               vmInstructionNamesTbl[instr->opc], vmModeNamesTbl[instr->imd]);
+    return true;
+}
+
+static bool VM_verify_vector(const Instruction *instr, u32 ip, Stream *es)
+{
+    if (!VM_OP_VECTOR(instr->opc))
+        return true;
+
+    if (instr->iam)
+        return VM_verify_error(es, ip, "%s argument A must be a register",
+                               vmInstructionNamesTbl[instr->opc]);
+    if (instr->opc == opVst && !instr->ibm)
+        return VM_verify_error(es, ip, "vst argument B must be a memory reference");
+    if (instr->opc == opVred && (instr->rmd != amReg || instr->ibm))
+        return VM_verify_error(es, ip, "vred argument B must be a vector register");
+    return true;
+}
+
+static bool VM_verify_jump(const Instruction *instr, const u8 *starts, u32 len, u32 ip, Stream *es)
+{
+    u64 target;
+
+    if (VM_OP_BRANCH(instr->opc)) {
+        target = ip + instr->itg;
+    }
+    else {
+        if (instr->opc != opCall && instr->opc != opFcall &&
+            (instr->opc < opJmp || instr->opc > opJmps))
+            return true;
+
+        // only jumps through an immediate value can be checked before running
+        if (instr->rmd != amImm || instr->iam)
+            return true;
+
+        target = ip + instr->ii;
+    }
+
+    if (target > len || !starts[target])
+        return VM_verify_error(es, ip, "%s target %08" PRIi64 " is not an instruction boundary",
+                               vmInstructionNamesTbl[instr->opc], (i64) target);
+    return true;
+}
+
+static bool VM_verify_ncall(const Instruction *prev, const Instruction *instr, u32 ip, Stream *es)
+{
+    const NativeSignature *sig;
+
+    if (instr->opc != opNcall || instr->rmd != amImm || instr->iam || instr->iu >= bncCOUNT)
+        return true;
+
+    // the number of arguments is known when pushed right before the call
+    if (prev->opc != opPush || prev->osz != 2 || prev->rmd != amImm || prev->iam)
+        return true;
+
+    sig = &vmNativeBuiltinSignatureTbl[instr->iu];
+    if (prev->iu < sig->min || prev->iu > sig->max)
+        return VM_verify_error(es, ip, "builtin native call %" PRIu64 " takes %u to %u arguments, got %" PRIi64,
+                               instr->iu, sig->min, sig->max, prev->ii);
+    return true;
+}
+
+bool VM_verify(const Code *code, Stream *es)
+{
+    const CodeHeader *header = (const CodeHeader *) Vector_at(code, 0);
+    Instruction prev = {0};
+    u32 len = Vector_len(code), ip;
+    u8 *starts;
+    bool ok = true;
+
+    if (len < sizeof(CodeHeader))
+        return VM_verify_error(es, 0, "code is too small to hold a header (%u bytes)", len);
+    if (header->db < sizeof(CodeHeader) || header->db > len)
+        return VM_verify_error(es, 0, "data boundary %u is outside of the code", header->db);
+    if (header->size > len)
+        return VM_verify_error(es, 0, "code is truncated, %u out of %" PRIu64 " bytes loaded",
+                               len, header->size);
+
+    starts = calloc(len + 1, sizeof(u8));
+    if (starts == NULL)
+        return VM_verify_error(es, 0, "out of memory");
+
+    // First pass marks instruction boundaries, running past the last
+    // instruction halts so the end of code is one too
+    for (ip = header->db; ok && ip < len;) {
+        Instruction instr = {0};
+        u32 size = VM_code_instruction_at(code, &instr, ip);
+
+        if (size == 0)
+            ok = VM_verify_error(es, ip, "instruction is truncated by the end of code");
+        else if (instr.opc >= opcCOUNT)
+            ok = VM_verify_error(es, ip, "unknown op code %u", instr.opc);
+        else if (instr.osz != vmOpArgsTbl[instr.opc] + 1)
+            ok = VM_verify_error(es, ip, "%s takes %u arguments, got %u",
+                                 vmInstructionNamesTbl[instr.opc], vmOpArgsTbl[instr.opc], instr.osz - 1);
+        else
+            ok = VM_verify_registers(&instr, ip, es) && VM_verify_mode(&instr, ip, es) &&
+                 VM_verify_vector(&instr, ip, es);
+
+        starts[ip] = 1;
+        ip += size;
+    }
+    starts[len] = 1;
+
+    for (ip = header->db; ok && ip < len;) {
+        Instruction instr = {0};
+        u32 size = VM_code_instruction_at(code, &instr, ip);
+        ok = VM_verify_jump(&instr, starts, len, ip, es) &&
+             VM_verify_ncall(&prev, &instr, ip, es);
+        prev = instr;
+        ip += size;
+    }
+
+    free(starts);
+    return ok;
+}
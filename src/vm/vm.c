@@ -10,12 +10,21 @@
 
 #include "vm/vm.h"
 #include "vm/builtins.h"
+#include "vm/jit.h"
+#include "vm/simd.h"
 
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <inttypes.h>
 
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifdef CYN_VM_GUARD_PAGES
+#include <signal.h>
+#endif
+
 #ifdef CYN_VM_DEBUG_TRACE
 attr(always_inline)
 static void VM_trace(VM *vm, u32 iip, const Instruction *instr)
@@ -71,255 +80,1117 @@ void VM_abort(VM *vm, const char* fmt, ...)
 void vmThrowError(VM *vm, i32 code)
 {}
 
+/**
+ * With threaded dispatch every handler is a label in the dispatch
+ * table and jumps straight to the handler of the next instruction,
+ * otherwise handlers are cases of a switch inside the dispatch loop
+ */
+#ifdef CYN_VM_THREADED_DISPATCH
+#define VM_LABEL(KEY, LBL)  LBL:
+#define VM_NEXT()                                   \
+    do {                                            \
+        VM_advance();                               \
+        VM_prologue();                              \
+        goto *vmDispatchTbl[di->op];                \
+    } while (0)
+#define VM_NEXT_DIRECT()                            \
+    do {                                            \
+        VM_advance_direct();                        \
+        VM_prologue();                              \
+        goto *vmDispatchTbl[di->op];                \
+    } while (0)
+#else
+#define VM_LABEL(KEY, LBL)  case KEY:
+#define VM_NEXT()           break
+#define VM_NEXT_DIRECT()    { VM_advance_direct(); VM_prologue(); continue; }
+#endif
+
+#define VM_CASE(OP, B)  VM_LABEL((((OP) << 1) | (B)), CynPST(CynPST(OP, _), B))
+
+/**
+ * The interpreter keeps `ip`, `sp`, `bp`, `flg` and the memory bounds in
+ * locals so that writing to memory does not force reloading them.
+ *
+ * `sp`, `bp` and `flg` are written through to the virtual machine whenever
+ * they change (\see VM_set), `ip` is only written back by \see VM_spill
+ * before running code that reads it. Instructions changing these registers
+ * through an operand are executed by \see VM_step (\see VM_DECODE_STEP),
+ * after which the locals are reloaded with \see VM_reload.
+ *
+ * The heap limit is only read by the bounds checks, which are omitted with
+ * guard pages.
+ */
+#define VM_registers()  u64 rip, rsp, rbp, rflg; u8 *mbase; u32 msize, msb; attr(unused) u32 mhlm
+
+#define VM_reload()                                                             \
+    do {                                                                        \
+        rip = REG(vm, ip);                                                      \
+        rsp = REG(vm, sp);                                                      \
+        rbp = REG(vm, bp);                                                      \
+        rflg = REG(vm, flg);                                                    \
+        mbase = vm->ram.base;                                                   \
+        msize = vm->ram.size;                                                   \
+        msb = vm->ram.sb;                                                       \
+        mhlm = vm->ram.hlm;                                                     \
+    } while (0)
+
+#define VM_spill()      REG(vm, ip) = rip
+
+#define VM_set(R, V)    (REG(vm, R) = CynPST(r, R) = (V))
+
+#ifndef CYN_VM_GUARD_PAGES
+// Checks an access outside the cached memory bounds against the memory
+static void VM_memory_miss(VM *vm, u32 addr, u64 len)
+{
+    if (!VM_memory_committed(vm->ram.hlm, vm->ram.sb, vm->ram.size, addr, len))
+        VM_abort(vm, "Memory access violation %x/%x", addr, vm->ram.hlm);
+}
+
+/**
+ * Memory access through the cached memory bounds (\see MEM). The heap limit
+ * and stack boundary only move apart as the memory grows, so an access
+ * outside of the cached ones is checked again against the memory before
+ * faulting (\see VM_memory_miss) and the cached bounds are reloaded.
+ */
+#define VM_mem_(ADDR, LEN)                                                      \
+    ({                                                                          \
+        u32 vmAddr = (ADDR);                                                    \
+        if (!VM_memory_committed(mhlm, msb, msize, vmAddr, (LEN))) {            \
+            VM_memory_miss(vm, vmAddr, (LEN));                                  \
+            mhlm = vm->ram.hlm;                                                 \
+            msb = vm->ram.sb;                                                   \
+        }                                                                       \
+        &mbase[vmAddr];                                                         \
+    })
+
+#define VM_mem(ADDR)    VM_mem_((ADDR), sizeof(Value))
+// the whole vector must be within the memory (\see VM_GUARD_SPAN)
+#define VM_vmem(ADDR)   VM_mem_((ADDR), sizeof(VectorReg))
+#else
+#define VM_mem(ADDR)    (&mbase[(u32) (ADDR)])
+#define VM_vmem(ADDR)   (&mbase[(u32) (ADDR)])
+#endif
+
+/**
+ * Memory access of bulk memory instructions, the \param len bytes at
+ * \param addr are checked at once. The length is not bounded so the check
+ * is kept with guard pages.
+ */
 attr(always_inline)
-static u64 VM_fetch(VM *vm, Instruction *instr)
+static u8 *VM_bmem_(VM *vm, u8 *base, u32 size, u64 addr, u64 len)
 {
-    u64 ret = REG(vm, ip);
-    if (REG(vm, ip) + 1 > Vector_len(vm->code))
-        VM_abort(vm, "execution goes beyond code space");
+    if (addr > size || len > size - addr || !VM_memory_committed(vm->ram.hlm, vm->ram.sb, size, addr, len))
+        VM_abort(vm, "Memory access violation %" PRIx64 "+%" PRIu64 "/%x", addr, len, vm->ram.hlm);
+    return &base[addr];
+}
 
-    instr->b1 =  *Vector_at(vm->code, REG(vm, ip));
-    ++REG(vm, ip);
-    if (instr->osz == 1) return ret;
+#define VM_bmem(ADDR, LEN)  VM_bmem_(vm, mbase, msize, (ADDR), (LEN))
 
-    if (REG(vm, ip) + (instr->osz-1) > Vector_len(vm->code))
-        VM_abort(vm, "execution goes beyond code space");
-    instr->b2 = *Vector_at(vm->code, REG(vm, ip));
-    ++REG(vm, ip);
-    if (instr->osz == 3) {
-        instr->b3 = *Vector_at(vm->code, REG(vm, ip));
-        ++REG(vm, ip);
+/**
+ * Stack access whose bounds were checked on entry to the function
+ * (\see VM_stack_analyze), it is never checked again
+ */
+#define VM_smem(ADDR)   ((u64 *) &mbase[(ADDR)])
+
+/**
+ * Stack operations on the cached stack pointer (\see VM_pushn, VM_popn)
+ */
+#define VM_sreserve(COUNT)                                                      \
+    ({                                                                          \
+        u32 vmSize = ((u8) (COUNT)) << 3;                                       \
+        if ((rsp - vmSize) <= msb) {                                            \
+            VM_memory_grow_stack(vm, rsp - vmSize);                             \
+            msb = vm->ram.sb;                                                   \
+        }                                                                       \
+        VM_set(sp, rsp - vmSize);                                               \
+        (Value *) VM_mem(rsp);                                                  \
+    })
+
+#define VM_spushn(DATA, COUNT)                                                  \
+    ({                                                                          \
+        Value *vmTop = VM_sreserve(COUNT);                                      \
+        memcpy(vmTop, (DATA), ((u8) (COUNT)) << 3);                             \
+        vmTop;                                                                  \
+    })
+
+#define VM_spopn(COUNT)                                                         \
+    ({                                                                          \
+        u32 vmSize = ((u8) (COUNT)) << 3;                                       \
+        Value *vmTop;                                                           \
+        if ((rsp + vmSize) > msize)                                             \
+            VM_abort(vm, "VM stack memory underflow - escapes virtual machine memory"); \
+        vmTop = (Value *) VM_mem(rsp);                                          \
+        VM_set(sp, rsp + vmSize);                                               \
+        vmTop;                                                                  \
+    })
+
+#define VM_spush(V)     (VM_sreserve(1)->i = (V))
+#define VM_spop(T)      ((T) VM_spopn(1)->i)
+
+// only control flow instructions change the instruction pointer
+#define VM_advance() \
+    di = (rip == di->nip)? di + 1 : VM_jump(VM_decoded_at(vm, rip))
+
+/**
+ * Advances from jumps through an immediate value, their target was checked
+ * when decoding (\see VM_decode_targets) so it is not checked again
+ */
+#define VM_advance_direct() \
+    di = (rip == di->nip)? di + 1 : VM_jump(&vm->decoded[vm->dmap[rip]])
+
+/**
+ * Get the instruction a jump from `di` to \param T lands on, backward
+ * jumps are reported to the tracer when tracing hot loops
+ */
+#define VM_jump(T)                                                              \
+    ({                                                                          \
+        DecodedInstruction *vmTarget = (T);                                     \
+        if (vm->tracer && vmTarget <= di &&                                     \
+            ((di->instr.opc >= opJmp && di->instr.opc <= opJmps) ||             \
+             VM_OP_BRANCH(di->instr.opc)))                                      \
+        {                                                                       \
+            VM_spill();                                                         \
+            vmTarget = VM_jit_trace(vm, vmTarget);                              \
+            VM_reload();                                                        \
+        }                                                                       \
+        vmTarget;                                                               \
+    })
+
+#if defined(CYN_VM_DEBUGGER)
+#define VM_debug_hook()                                         \
+    if (di->instr.opc == opDbg || vm->flags & eflDbgBreak) {    \
+        if (vm->debugger) {                                     \
+            VM_spill();                                         \
+            vm->debugger(vm, di->iip, &di->instr);              \
+            VM_reload();                                        \
+        }                                                       \
     }
+#else
+#define VM_debug_hook()
+#endif
 
-    if (instr->rmd || instr->iea) {
-        if (instr->osz == 2) {
-            // fix instruction
-            instr->ims = instr->ra;
-            instr->ra = 0;
-        }
+#define VM_prologue()                                                           \
+    do {                                                                        \
+        instr = &di->instr;                                                     \
+        iip = di->iip;                                                          \
+        rip = di->nip;                                                          \
+        VM_debug_hook()                                                         \
+        VM_dbg_trace(vm, trcEXEC, VM_spill(); VM_trace(vm, iip, instr));        \
+    } while (0)
 
-        instr->ii = VM_read(Vector_at(vm->code, REG(vm, ip)), instr->ims);
-        REG(vm, ip) += vmSizeTbl[instr->ims];
+/**
+ * Moves on to the next instruction executed by a superinstruction, the
+ * instruction pointer is updated as if that instruction was dispatched
+ */
+#define VM_fuse_next()                                                          \
+    do {                                                                        \
+        di++;                                                                   \
+        instr = &di->instr;                                                     \
+        iip = di->iip;                                                          \
+        rip = di->nip;                                                          \
+        VM_dbg_trace(vm, trcEXEC, VM_spill(); VM_trace(vm, iip, instr));        \
+    } while (0)
+
+/**
+ * Resolves the operands of the current instruction in generic handlers,
+ * immediate values are copied so that the decoded stream is never written to
+ */
+#define VM_operands()                                                           \
+    do {                                                                        \
+        imm = instr->iu;                                                        \
+        switch (di->ka) {                                                       \
+            case okNone: break;                                                 \
+            case okReg: rA = (void *) &REG(vm, instr->ra); break;               \
+            case okRegMem: rA = (void *) VM_mem(REG(vm, instr->ra)); break;     \
+            case okImm: rA = (void *) &imm; break;                              \
+            case okImmMem: rA = (void *) VM_mem(instr->iu); break;              \
+            default: unreachable();                                             \
+        }                                                                       \
+        switch (di->kb) {                                                       \
+            case okNone: break;                                                 \
+            case okReg: rB = (void *) &REG(vm, instr->rb); break;               \
+            case okRegMem:                                                      \
+                rB = (void *) VM_mem(REG(vm, instr->rb) + instr->ii); break;    \
+            case okImm: rB = (void *) &imm; break;                              \
+            case okImmMem: rB = (void *) VM_mem(instr->iu); break;              \
+            default: unreachable();                                             \
+        }                                                                       \
+    } while (0)
+
+/**
+ * Resolves argument B of vector instructions, immediate values are
+ * copied to every lane of vector \param TMP
+ */
+#define VM_vector_b(TMP)                                                        \
+    ({                                                                          \
+        void *vmB;                                                              \
+        switch (di->kb) {                                                       \
+            case okReg: vmB = &vm->vregs[instr->rb]; break;                     \
+            case okRegMem: vmB = VM_vmem(REG(vm, instr->rb) + instr->ii); break; \
+            case okImmMem: vmB = VM_vmem(instr->iu); break;                     \
+            default: VM_vdup((TMP), instr->iu, instr->imd); vmB = (TMP); break; \
+        }                                                                       \
+        vmB;                                                                    \
+    })
+
+/**
+ * Operand resolution of specialized handlers (\see VM_BINARY_FORMS). The
+ * kinds are known at compile time, so are the modes used to read and
+ * write the operands.
+ */
+#define VM_SPEC_A_R     (void *) &REG(vm, instr->ra)
+#define VM_SPEC_A_M     (void *) VM_mem(REG(vm, instr->ra))
+#define VM_SPEC_A_I     (imm = instr->iu, (void *) &imm)
+#define VM_SPEC_B_R     (void *) &REG(vm, instr->rb)
+#define VM_SPEC_B_M     (void *) VM_mem(REG(vm, instr->rb) + instr->ii)
+#define VM_SPEC_B_I     (void *) &instr->ii
+#define VM_SPEC_B_N     NULL
+#define VM_SPEC_S_R(M)  (M)
+#define VM_SPEC_S_M(M)  (M)
+#define VM_SPEC_S_I(M)  szQuad
+
+// the only instructions changing `ip` through an immediate value are jumps
+#define VM_SPEC_NEXT_R() VM_NEXT()
+#define VM_SPEC_NEXT_M() VM_NEXT()
+#define VM_SPEC_NEXT_I() VM_NEXT_DIRECT()
+
+#define VM_SPEC_LABEL(N, M, F) \
+    CynPST(CynPST(CynPST(vmSpec, N), CynPST(_, M)), CynPST(_, F))
+
+#define VM_SPEC_HANDLER(F, A, B, S, N, M, Apply, ...)                       \
+    VM_LABEL(VM_SPEC_KEY(sop##N, M, sf##F), VM_SPEC_LABEL(N, M, F)) {       \
+        rA = VM_SPEC_A_##A;                                                 \
+        rB = VM_SPEC_B_##B;                                                 \
+        Apply(M, VM_SPEC_S_##S(M), ##__VA_ARGS__);                          \
+        VM_SPEC_NEXT_##A();                                                 \
     }
 
-    if (REG(vm, ip) > Vector_len(vm->code))
-        VM_abort(vm, "execution goes beyond code space");
+#define VM_FUSE_CMP_LABEL(J, M, F) \
+    CynPST(CynPST(CynPST(vmFuseCmp, J), CynPST(_, M)), CynPST(_, F))
 
-    return  ret;
-}
+// `cmp` followed by a conditional jump, the flags are still updated
+#define VM_FUSE_CMP_HANDLER(F, A, B, S, J, M, Apply)                           \
+    VM_LABEL(VM_FUSE_CMP_KEY(fj##J, M, sf##F), VM_FUSE_CMP_LABEL(J, M, F)) {   \
+        rA = VM_SPEC_A_##A;                                                 \
+        rB = VM_SPEC_B_##B;                                                 \
+        Apply(M, VM_SPEC_S_##S(M));                                         \
+        VM_fuse_next();                                                     \
+        if (VM_COND_##J) rip = iip + instr->ii;                             \
+        VM_NEXT_DIRECT();                                                   \
+    }
 
-attr(always_inline)
-static void VM_execute(VM *vm, Instruction *instr, u64 iip)
-{
-    void *rA = NULL, *rB = NULL;
-    u16 op = instr->opc << 1;
-
-    VM_dbg_trace(vm, trcEXEC, VM_trace(vm, iip, instr));
-
-    switch (instr->osz) {
-        case 1: break;
-        case 2:
-            if (instr->rmd == amReg) {
-                op |= 1;
-                rA = instr->iam ? (void *) MEM(vm, REG(vm, instr->ra)) : (void *) &REG(vm, instr->ra);
-            } else {
-                rA = instr->iam ? (void *) MEM(vm, instr->iu) : (void *)&instr->iu;
-            }
-            break;
-        case 3:
-            rA = instr->iam ? (void *) MEM(vm, REG(vm, instr->ra)) : (void *) &REG(vm, instr->ra);
-            if (instr->rmd == amReg) {
-                op |= 1;
-                if (instr->ibm) {
-                    rB = ((MEM(vm, REG(vm, instr->rb))) + (instr->iea? instr->ii : 0));
-                }
-                else {
-                    rB = (void *) &REG(vm, instr->rb);
-                }
-            } else {
-                rB = instr->ibm ? (void *) MEM(vm, instr->iu) : (void *)&instr->iu;
-            }
-            break;
-        default:
-            unreachable();
+#define VM_FUSE_CMP_BINARY(M, J, Apply) \
+    VM_BINARY_FORMS(VM_FUSE_CMP_HANDLER, J, M, Apply)
+
+// compare and branch instructions, their target was checked when decoding
+#define VM_BRANCH_HANDLER(F, A, B, S, N, M, Apply, ...)                     \
+    VM_LABEL(VM_SPEC_KEY(sop##N, M, sf##F), VM_SPEC_LABEL(N, M, F)) {       \
+        rA = VM_SPEC_A_##A;                                                 \
+        rB = VM_SPEC_B_##B;                                                 \
+        Apply(M, VM_SPEC_S_##S(M), ##__VA_ARGS__);                          \
+        VM_NEXT_DIRECT();                                                   \
     }
 
-#define OP_CASES(OP, Apply, ...)                                              \
-    case ((OP << 1) | 0b1) : { Apply((instr->imd), (instr->imd), ##__VA_ARGS__); break; }  \
-    case ((OP << 1) | 0b0) : { Apply((instr->imd), (instr->ims), ##__VA_ARGS__); break; } \
+#define VM_BRANCH_BINARY(M, N, Apply, ...) \
+    VM_BINARY_FORMS(VM_BRANCH_HANDLER, N, M, Apply, ##__VA_ARGS__)
+#define VM_BRANCH_UNARY(M, N, Apply, ...) \
+    VM_UNARY_FORMS(VM_BRANCH_HANDLER, N, M, Apply, ##__VA_ARGS__)
+
+// Conditions of conditional jumps
+#define VM_COND_Jmpz    (rflg & flgZero)
+#define VM_COND_Jmpnz   (!(rflg & flgZero))
+#define VM_COND_Jmpg    (rflg & flgGreater)
+#define VM_COND_Jmps    (rflg & flgLess)
 
-    switch (op) {
+#define VM_SPEC_BINARY(M, N, Apply, ...) \
+    VM_BINARY_FORMS(VM_SPEC_HANDLER, N, M, Apply, ##__VA_ARGS__)
+#define VM_SPEC_UNARY(M, N, Apply, ...) \
+    VM_UNARY_FORMS(VM_SPEC_HANDLER, N, M, Apply, ##__VA_ARGS__)
+
+/**
+ * Semantics of every instruction, shared by the interpreter loop and
+ * \see VM_step
+ */
 #define BINARY_OPS(XX)      \
-        XX(Add, +)          \
-        XX(Sub, -)          \
-        XX(And, &&)         \
-        XX(Or,  ||)         \
-        XX(Sar, >>)         \
-        XX(Sal, <<)         \
-        XX(Xor, ^)          \
-        XX(Bor, |)          \
-        XX(Band, &)         \
-        XX(Mul, *)          \
-        XX(Div, /)
+    XX(Add, +)          \
+    XX(Sub, -)          \
+    XX(And, &&)         \
+    XX(Or,  ||)         \
+    XX(Sar, >>)         \
+    XX(Sal, <<)         \
+    XX(Xor, ^)          \
+    XX(Bor, |)          \
+    XX(Band, &)         \
+    XX(Mul, *)          \
+    XX(Div, /)          \
+    XX(Mod, %)
 
 #define Apply(TA, TB, OP)   VM_write(rA, (VM_read(rA, TA) OP VM_read(rB, TB)), TA)
-#define XX(N, O) OP_CASES(op##N, Apply, O)
-        BINARY_OPS(XX)
-#undef XX
-#undef Apply
+
+/**
+ * Floating point operations taking 2 arguments, both in the float width
+ * given by the instruction mode
+ */
+#define FLOAT_OPS(XX)       \
+    XX(Fadd, +)             \
+    XX(Fsub, -)             \
+    XX(Fmul, *)             \
+    XX(Fdiv, /)
+
+#define ApplyF(TA, TB, OP)  VM_fwrite(rA, (VM_fread(rA, TA) OP VM_fread(rB, TA)), TA)
+
+// no flags are set when either value is NaN
+#define ApplyFcmp(TA, TB)                               \
+        f64 a = VM_fread(rA, TA), b = VM_fread(rB, TA); \
+        if (a == b)                                     \
+            VM_set(flg, flgZero);                       \
+        else if (a < b)                                 \
+            VM_set(flg, flgLess);                       \
+        else if (a > b)                                 \
+            VM_set(flg, flgGreater);                    \
+        else                                            \
+            VM_set(flg, 0);
+
+// converts a value of the other float width
+#define ApplyFcvt(TA, TB)   VM_fwrite(rA, VM_fread(rB, ((TA) == szWord)? szQuad : szWord), TA)
+
+#define ApplyItof(TA, TB)                               \
+        i64 i = VM_read(rB, szQuad);                    \
+        if ((TA) == szWord)                             \
+            *((f32 *) rA) = (f32) i;                    \
+        else                                            \
+            *((f64 *) rA) = (f64) i;
+
+// NaN and values out of range truncate to INT64_MIN like x86-64 does
+#define ApplyFtoi(TA, TB)                               \
+        f64 f = VM_fread(rB, TA);                       \
+        VM_write(rA, (f >= -0x1p63 && f < 0x1p63)? (i64) f : INT64_MIN, szQuad);
+
+/**
+ * Vector operations taking 2 vectors, argument A is always a vector
+ * register (\see VM_OP_VECTOR)
+ */
+#define VECTOR_OPS(XX)      \
+    XX(Vadd, VM_vadd)       \
+    XX(Vsub, VM_vsub)       \
+    XX(Vmul, VM_vmul)       \
+    XX(Vand, VM_vand)       \
+    XX(Vor,  VM_vor)        \
+    XX(Vxor, VM_vxor)       \
+    XX(Vceq, VM_vceq)       \
+    XX(Vcgt, VM_vcgt)       \
+    XX(Vshuf, VM_vshuf)
+
+#define ApplyV(TA, TB, FN)                              \
+        VectorReg tmp;                                  \
+        VectorReg *vA = &vm->vregs[instr->ra];          \
+        FN(vA, vA, VM_vector_b(&tmp), TA);
+
+#define ApplyVld(TA, TB)                                \
+        VectorReg tmp;                                  \
+        memcpy(&vm->vregs[instr->ra], VM_vector_b(&tmp), sizeof(VectorReg));
+
+// argument B is the memory written
+#define ApplyVst(TA, TB)                                \
+        VectorReg tmp;                                  \
+        memcpy(VM_vector_b(&tmp), &vm->vregs[instr->ra], sizeof(VectorReg));
+
+// argument B is a value read in the width of the lanes
+#define ApplyVdup(TA, TB)   VM_vdup(&vm->vregs[instr->ra], VM_read(rB, TB), TA)
+
+// argument A is a general purpose register
+#define ApplyVred(TA, TB)   VM_write(rA, VM_vred(&vm->vregs[instr->rb], TA), szQuad)
+
+/**
+ * Bulk memory instructions, argument A is the address of the destination
+ * and the number of bytes is in `r0` (\see VM_BULK_LEN)
+ */
+#define ApplyMcpy(TA, TB)                                               \
+        u64 len = REG(vm, VM_BULK_LEN);                                 \
+        u8 *src = VM_bmem(VM_read(rB, TB), len);                        \
+        memmove(VM_bmem(VM_read(rA, TA), len), src, len);
+
+#define ApplyMset(TA, TB)                                               \
+        u64 len = REG(vm, VM_BULK_LEN);                                 \
+        memset(VM_bmem(VM_read(rA, TA), len), (u8) VM_read(rB, TB), len);
+
+// sets the flags like `cmp`, comparing bytes as unsigned values
+#define ApplyMcmp(TA, TB)                                               \
+        u64 len = REG(vm, VM_BULK_LEN);                                 \
+        u8 *b = VM_bmem(VM_read(rB, TB), len);                          \
+        int c = memcmp(VM_bmem(VM_read(rA, TA), len), b, len);          \
+        VM_set(flg, (c == 0)? flgZero : ((c < 0)? flgLess : flgGreater));
+
+// stops at the end of memory, `r0` is set to the offset of the first byte
+// equal to B or to the number of bytes scanned
+// the search stops at the end of the committed heap or stack memory holding `addr`
+#define ApplyMchr(TA, TB)                                               \
+        u64 addr = VM_read(rA, TA);                                     \
+        u8 *p = VM_bmem(addr, 0), *at;                                  \
+        u64 end = (addr < vm->ram.sb)? vm->ram.hlm + CYN_VM_ALIGNMENT : msize; \
+        u64 len = MIN(REG(vm, VM_BULK_LEN), end - addr);                \
+        at = memchr(p, (u8) VM_read(rB, TB), len);                      \
+        REG(vm, VM_BULK_LEN) = (at != NULL)? (u64) (at - p) : len;
 
 #define ApplyMov(TA, TB) VM_write(rA, VM_read(rB, TB), TA)
-        OP_CASES(opMov, ApplyMov)
-#undef ApplyMov
 
-#define ApplyRmem(TA, TB) VM_write(rA, (uptr)MEM(vm, VM_read(rB, TB)), TA)
-        OP_CASES(opRmem, ApplyRmem)
-#undef ApplyRmem
+#define ApplyRmem(TA, TB) VM_write(rA, (uptr)VM_mem(VM_read(rB, TB)), TA)
 
 #define ApplyNot(TA, TB) VM_write(rA, !VM_read(rA, TB), TA)
-        OP_CASES(opNot, ApplyNot)
-#undef ApplyNot
 
 #define ApplyBNot(TA, TB) VM_write(rA, ~VM_read(rA, TB), TA)
-        OP_CASES(opBNot, ApplyBNot)
-#undef ApplyBNot
 
 #define ApplyInc(TA, TB) VM_write(rA, VM_read(rA, TB) + 1, TA)
-        OP_CASES(opInc, ApplyInc)
-#undef ApplyInc
 
 #define ApplyDec(TA, TB) VM_write(rA, VM_read(rA, TB) - 1, TA)
-        OP_CASES(opDec, ApplyDec)
-#undef ApplyDec
 
-#define ApplyPush(TA, TB) VM_push(vm, VM_read(rA, TB))
-        OP_CASES(opPush, ApplyPush)
-#undef ApplyPush
+#define ApplyPush(TA, TB) VM_spush(VM_read(rA, TB))
 
 #define ApplyAlloca(TA, TB)                           \
         u32 count = VM_read(rB, TB) >> (szQuad - TA); \
         printf("count %u = %u\n", TA, count);          \
-        VM_write(rA, REG(vm, sp)-8, szQuad);           \
-        VM_pushn(vm, NULL, count);
-        OP_CASES(opAlloca, ApplyAlloca)
-#undef ApplyAlloca
+        VM_write(rA, rsp-8, szQuad);                   \
+        VM_sreserve(count);
 
-#define ApplyPop(TA, TB)  VM_write(rA, VM_pop(vm, i64), TB)
-        OP_CASES(opPop, ApplyPop)
-#undef ApplyPop
+#define ApplyPop(TA, TB)  VM_write(rA, VM_spop(i64), TB)
 
-#define ApplyPopn(TA, TB) VM_popn(vm, NULL, VM_read(rA, TB))
-        OP_CASES(opPopn, ApplyPopn)
-#undef ApplyPopn
+#define ApplyPopn(TA, TB) VM_spopn(VM_read(rA, TB))
 
-#define ApplyJmp(TA, TB)  REG(vm, ip) = iip + VM_read(rA, TB);
-        OP_CASES(opJmp, ApplyJmp)
-#undef ApplyJmp
+#define ApplyJmp(TA, TB)  VM_set(ip, iip + VM_read(rA, TB));
 
-#define ApplyJmpz(TA, TB)  if (REG(vm, flg) & flgZero) REG(vm, ip) = iip + VM_read(rA, TB);
-        OP_CASES(opJmpz, ApplyJmpz)
-#undef ApplyJmpz
+#define ApplyJmpz(TA, TB)  if (VM_COND_Jmpz) VM_set(ip, iip + VM_read(rA, TB));
 
-#define ApplyJmpnz(TA, TB)  if (!(REG(vm, flg) & flgZero)) REG(vm, ip) = iip + VM_read(rA, TB);
-        OP_CASES(opJmpnz, ApplyJmpnz)
-#undef ApplyJmpnz
+#define ApplyJmpnz(TA, TB)  if (VM_COND_Jmpnz) VM_set(ip, iip + VM_read(rA, TB));
 
-#define ApplyJmpg(TA, TB)  if (REG(vm, flg) & flgGreater) REG(vm, ip) = iip + VM_read(rA, TB);
-        OP_CASES(opJmpg, ApplyJmpg)
-#undef ApplyJmpg
+#define ApplyJmpg(TA, TB)  if (VM_COND_Jmpg) VM_set(ip, iip + VM_read(rA, TB));
 
-#define ApplyJmps(TA, TB)  if (REG(vm, flg) & flgLess) REG(vm, ip) = iip + VM_read(rA, TB);
-        OP_CASES(opJmps, ApplyJmps)
-#undef ApplyJmps
+#define ApplyJmps(TA, TB)  if (VM_COND_Jmps) VM_set(ip, iip + VM_read(rA, TB));
+
+/**
+ * Compare and branch instructions, signed compares read their arguments
+ * like `cmp` does and unsigned compares zero extend them from the width
+ * of the mode. The flags are left as they are.
+ */
+#define BRANCH_OPS(XX)      \
+    XX(Jeq,  ==, i64)       \
+    XX(Jne,  !=, i64)       \
+    XX(Jlt,  <,  i64)       \
+    XX(Jle,  <=, i64)       \
+    XX(Jgt,  >,  i64)       \
+    XX(Jge,  >=, i64)       \
+    XX(Jltu, <,  u64)       \
+    XX(Jleu, <=, u64)       \
+    XX(Jgtu, >,  u64)       \
+    XX(Jgeu, >=, u64)
+
+#define VM_umask(V, M)          ((u64) (V) & (UINT64_MAX >> (64 - (8 << (M)))))
+#define VM_branch_i64(P, M, W)  VM_read((P), (M))
+#define VM_branch_u64(P, M, W)  VM_umask(VM_read((P), (M)), (W))
+
+#define ApplyB(TA, TB, OP, T)                                           \
+        if (VM_branch_##T(rA, TA, TA) OP VM_branch_##T(rB, TB, TA))     \
+            VM_set(ip, iip + instr->itg);
+
+// branches unless argument A is 0 in the width of the mode once decremented
+#define ApplyDjnz(TA, TB)                                               \
+        i64 v = VM_read(rA, TA) - 1;                                    \
+        VM_write(rA, v, TA);                                            \
+        if (VM_umask(v, TA) != 0)                                       \
+            VM_set(ip, iip + instr->itg);
+
+/**
+ * Conditions tested by `set<cc>` and `csel<cc>` on the flags, both are
+ * written so that they compile to branch free code
+ */
+#define SELECT_OPS(XX)      \
+    XX(eq)                  \
+    XX(ne)                  \
+    XX(lt)                  \
+    XX(le)                  \
+    XX(gt)                  \
+    XX(ge)
+
+#define VM_COND_eq      VM_COND_Jmpz
+#define VM_COND_ne      VM_COND_Jmpnz
+#define VM_COND_lt      VM_COND_Jmps
+#define VM_COND_le      (rflg & (flgLess | flgZero))
+#define VM_COND_gt      VM_COND_Jmpg
+#define VM_COND_ge      (rflg & (flgGreater | flgZero))
+
+#define ApplySet(TA, TB, C)  VM_write(rA, (VM_COND_##C) != 0, TA)
+
+#define ApplyCsel(TA, TB, C)                                            \
+        i64 b = VM_read(rB, TB);                                        \
+        VM_write(rA, (VM_COND_##C)? b : VM_read(rA, TA), TA);
 
 #define ApplyCmp(TA, TB)                            \
         i64 a = VM_read(rA, TA), b = VM_read(rB, TB); \
         if (a == b)                                 \
-            REG(vm, flg) = flgZero;                 \
+            VM_set(flg, flgZero);                   \
         else if (a < b)                             \
-            REG(vm, flg) = flgLess;                 \
+            VM_set(flg, flgLess);                   \
         else                                        \
-            REG(vm, flg) = flgGreater;
-
-        OP_CASES(opCmp, ApplyCmp)
-#undef ApplyCmp
+            VM_set(flg, flgGreater);
 
 #define ApplyCall(TA, TB)               \
-            VM_push(vm, REG(vm, ip));    \
-            VM_push(vm, REG(vm, bp));    \
-            REG(vm, bp) = REG(vm, sp);  \
-            REG(vm, ip) = iip + VM_read(rA, TB)
-        OP_CASES(opCall, ApplyCall)
-#undef ApplyCall
+            VM_spush(rip);              \
+            VM_spush(rbp);              \
+            VM_set(bp, rsp);            \
+            VM_set(ip, iip + VM_read(rA, TB))
+
+// the frame of `call` and the pushes of the called function are checked at once
+#define ApplyFcall(TA, TB)                                                  \
+            if (rsp > msize)                                                \
+                VM_abort(vm, "VM stack memory underflow - escapes virtual machine memory"); \
+            if ((rsp - msb) <= di->stk) {                                   \
+                VM_memory_grow_stack(vm, rsp - di->stk);                    \
+                msb = vm->ram.sb;                                           \
+            }                                                               \
+            VM_set(sp, rsp - 16);                                           \
+            VM_smem(rsp)[1] = rip;                                          \
+            VM_smem(rsp)[0] = rbp;                                          \
+            VM_set(bp, rsp);                                                \
+            VM_set(ip, iip + VM_read(rA, TB))
+
+// drops the frame and the arguments, values are returned in registers
+#define ApplyFret(TA, TB)                                                   \
+            u64 top = rbp + 16 + (((u64) (u8) VM_read(rA, TB)) << 3);       \
+            Value *frame;                                                   \
+            if (top > msize)                                                \
+                VM_abort(vm, "VM stack memory underflow - escapes virtual machine memory"); \
+            frame = (Value *) VM_mem(rbp);                                  \
+            VM_set(ip, frame[1].u);                                         \
+            VM_set(bp, frame[0].u);                                         \
+            VM_set(sp, top);
 
 #define ApplyRet(TA, TB)                            \
             u32 nret =  VM_read(rA, TB), nargs = 0;  \
             Value *ret = NULL;                      \
-            if (nret) ret = VM_popn(vm, NULL, nret); \
-            REG(vm, sp) = REG(vm, bp);              \
-            REG(vm, bp) = VM_pop(vm, u64);           \
-            REG(vm, ip) = VM_pop(vm, u64);           \
-            nargs = VM_pop(vm, u32);                 \
-            if (nargs) VM_popn(vm, NULL, nargs);     \
-            if (nret)  VM_pushn(vm, ret, nret);      \
-            VM_push(vm, nret);
-        OP_CASES(opRet, ApplyRet)
-#undef ApplyRet
+            if (nret) ret = VM_spopn(nret);         \
+            VM_set(sp, rbp);                        \
+            VM_set(bp, VM_spop(u64));               \
+            VM_set(ip, VM_spop(u64));               \
+            nargs = VM_spop(u32);                   \
+            if (nargs) VM_spopn(nargs);             \
+            if (nret)  VM_spushn(ret, nret);        \
+            VM_spush(nret);
+
+// calls native function FN with the NARGS arguments pushed before the count
+#define VM_native(FN, NARGS)                                        \
+            Value *argv = ((NARGS) == 0)? NULL :                    \
+                        ((Value *)VM_mem((rsp + ((u64) (NARGS) << 3)))); \
+            VM_spush(rip);                                          \
+            VM_spush(rbp);                                          \
+            VM_set(bp, rsp);                                        \
+            VM_spill();                                             \
+            (FN)(vm, argv, (NARGS));                                \
+            VM_reload();
+
+// arguments are passed in r0-r5 and values returned in the same registers
+#define VM_native_regs(FN, NARGS)                                   \
+            Value argv[VM_NCALLR_REGS];                             \
+            for (u32 i = 0; i < (NARGS); i++)                       \
+                argv[VM_NCALLR_REGS - 1 - i].u = REG(vm, r0 + i);   \
+            VM_spill();                                             \
+            vm->ncallr = true;                                      \
+            (FN)(vm, &argv[VM_NCALLR_REGS - 1], (NARGS));           \
+            vm->ncallr = false;                                     \
+            VM_reload();
+
+// the number of arguments passed by `ncallr` to native function ID
+#define VM_native_regs_count(ID) \
+            (((ID) < bncCOUNT)? vmNativeBuiltinSignatureTbl[(ID)].max : VM_NCALLR_REGS)
 
 #define ApplyNcall(TA, TB)                                          \
             uptr id = (uptr)VM_read(rA, TB);                         \
             NativeCall fn = (id < bncCOUNT)?                        \
                     vmNativeBuiltinCallTbl[id] : (NativeCall)id;    \
-            Value *nargs = (Value*) MEM(vm, REG(vm, sp));           \
-            Value *argv = (nargs->i == 0)? NULL :                   \
-                        ((Value *)MEM(vm, (REG(vm, sp) + (nargs->i << 3)))); \
-            VM_push(vm, REG(vm, ip));                                \
-            VM_push(vm, REG(vm, bp));                                \
-            REG(vm, bp) = REG(vm, sp);                              \
-            fn(vm, argv, nargs->i);
-        OP_CASES(opNcall, ApplyNcall)
-#undef ApplyNcall
+            u32 nargs = ((Value *) VM_mem(rsp))->u;                 \
+            VM_native_check(vm, id, nargs);                         \
+            VM_native(fn, nargs)
+
+#define ApplyNcallr(TA, TB)                                         \
+            uptr id = (uptr)VM_read(rA, TB);                         \
+            NativeCall fn = (id < bncCOUNT)?                        \
+                    vmNativeBuiltinCallTbl[id] : (NativeCall)id;    \
+            VM_native_regs(fn, VM_native_regs_count(id))
 
 #define ApplyPutc(TA, TB)  VM_put_utf8_chr_(vm, VM_read(rA, TB), stdout);
-        OP_CASES(opPutc, ApplyPutc)
-#undef ApplyPutc
 
 #define ApplyPuti(TA, TB)  printf("%" PRId64 "", VM_read(rA, TB))
-        OP_CASES(opPuti, ApplyPuti)
-#undef ApplyPuti
 
 #define ApplyPuts(TA, TB)                                   \
             if (instr->iam)                                 \
                 fputs(rA, stdout);                          \
             else                                            \
                 fputs((void *) VM_read(rA, TB), stdout);
-        OP_CASES(opPuts, ApplyPuts)
-#undef ApplyPuts
 
 #define ApplyAlloc(TA, TB)  VM_write(rA, VM_alloc(vm, VM_read(rB, TB)), TA)
-        OP_CASES(opAlloc, ApplyAlloc)
-#undef ApplyAlloc
 
 #define ApplyDlloc(TA, TB)  VM_free(vm, VM_read(rA, TB))
+
+#define ApplyRalloc(TA, TB) VM_write(rA, VM_realloc(vm, VM_read(rA, TA), VM_read(rB, TB)), TA)
+
+#define ApplyAnew(TA, TB)   VM_write(rA, VM_arena_new(vm, VM_read(rB, TB)), TA)
+
+#define ApplyAalloc(TA, TB) REG(vm, VM_ARENA_ADDR) = VM_arena_alloc(vm, VM_read(rA, TA), VM_read(rB, TB))
+
+#define ApplyAreset(TA, TB) VM_arena_reset(vm, VM_read(rA, TB))
+
+#define ApplyAfree(TA, TB)  VM_arena_free(vm, VM_read(rA, TB))
+static void VM_dispatch(VM *vm, DecodedInstruction *di)
+{
+    void *rA = NULL, *rB = NULL;
+    const Instruction *instr;
+    u64 iip, imm;
+    VM_registers();
+
+#ifdef CYN_VM_THREADED_DISPATCH
+#define VM_SPEC_ENTRY(F, A, B, S, N, M) [VM_SPEC_KEY(sop##N, M, sf##F)] = &&VM_SPEC_LABEL(N, M, F),
+#define VM_SPEC_ENTRY_BINARY(M, N) VM_BINARY_FORMS(VM_SPEC_ENTRY, N, M)
+#define VM_SPEC_ENTRY_UNARY(M, N)  VM_UNARY_FORMS(VM_SPEC_ENTRY, N, M)
+#define VM_FUSE_CMP_ENTRY(F, A, B, S, J, M) \
+    [VM_FUSE_CMP_KEY(fj##J, M, sf##F)] = &&VM_FUSE_CMP_LABEL(J, M, F),
+#define VM_FUSE_CMP_ENTRY_BINARY(M, J) VM_BINARY_FORMS(VM_FUSE_CMP_ENTRY, J, M)
+    static const void *vmDispatchTbl[] = {
+#define XX(N, ...) [(op##N << 1)] = &&op##N##_0, [(op##N << 1) | 1] = &&op##N##_1,
+        VM_OP_CODES(XX)
+#undef XX
+        [VM_DECODE_TRAP] = &&vmTrap,
+        [VM_DECODE_UNKNOWN] = &&vmUnknown,
+        [VM_DECODE_STEP] = &&vmStep,
+        [VM_DECODE_NCALL] = &&vmNcall,
+        [VM_DECODE_NCALLR] = &&vmNcallr,
+#define XX(N) VM_MODES(VM_SPEC_ENTRY_BINARY, N)
+#define YY(N) VM_MODES(VM_SPEC_ENTRY_UNARY, N)
+        VM_SPECIALIZED_OPS(XX, YY)
+#undef YY
+#undef XX
+#define XX(J) VM_MODES(VM_FUSE_CMP_ENTRY_BINARY, J)
+        VM_FUSED_JUMPS(XX)
+#undef XX
+#define XX(S) [VM_FUSE_KEY(fs##S)] = &&vmFuse##S,
+        VM_FUSED_SEQUENCES(XX)
+#undef XX
+#define XX(U) [VM_STACK_KEY(us##U)] = &&vmStack##U,
+        VM_UNCHECKED_STACK_OPS(XX)
+#undef XX
+    };
+#undef VM_FUSE_CMP_ENTRY_BINARY
+#undef VM_FUSE_CMP_ENTRY
+#undef VM_SPEC_ENTRY_UNARY
+#undef VM_SPEC_ENTRY_BINARY
+#undef VM_SPEC_ENTRY
+#endif
+
+#define OP_CASES(OP, Apply, ...)                                                                            \
+    VM_CASE(OP, 1) { VM_operands(); Apply((instr->imd), (instr->imd), ##__VA_ARGS__); VM_NEXT(); }         \
+    VM_CASE(OP, 0) { VM_operands(); Apply((instr->imd), (instr->ims), ##__VA_ARGS__); VM_NEXT(); }         \
+
+// Specialized handlers of instructions taking 2 arguments
+#define SPEC_CASES(N, Apply, ...)  VM_MODES(VM_SPEC_BINARY, N, Apply, ##__VA_ARGS__)
+// Specialized handlers of instructions taking 1 argument
+#define SPEC_CASES1(N, Apply, ...) VM_MODES(VM_SPEC_UNARY, N, Apply, ##__VA_ARGS__)
+// Specialized handlers of compare and branch instructions
+#define BRANCH_CASES(N, Apply, ...)  VM_MODES(VM_BRANCH_BINARY, N, Apply, ##__VA_ARGS__)
+#define BRANCH_CASES1(N, Apply, ...) VM_MODES(VM_BRANCH_UNARY, N, Apply, ##__VA_ARGS__)
+
+    VM_reload();
+    VM_prologue();
+#ifdef CYN_VM_THREADED_DISPATCH
+    goto *vmDispatchTbl[di->op];
+#else
+    for (;;) {
+    switch (di->op) {
+#endif
+#define XX(N, O) OP_CASES(op##N, Apply, O) SPEC_CASES(N, Apply, O)
+        BINARY_OPS(XX)
+#undef XX
+
+#define XX(N, O) OP_CASES(op##N, ApplyF, O)
+        FLOAT_OPS(XX)
+#undef XX
+
+        OP_CASES(opFcmp, ApplyFcmp)
+
+        OP_CASES(opFcvt, ApplyFcvt)
+
+        OP_CASES(opItof, ApplyItof)
+
+        OP_CASES(opFtoi, ApplyFtoi)
+
+        OP_CASES(opVld, ApplyVld)
+
+        OP_CASES(opVst, ApplyVst)
+
+        OP_CASES(opVdup, ApplyVdup)
+
+#define XX(N, FN) OP_CASES(op##N, ApplyV, FN)
+        VECTOR_OPS(XX)
+#undef XX
+
+        OP_CASES(opVred, ApplyVred)
+
+        OP_CASES(opMcpy, ApplyMcpy)
+
+        OP_CASES(opMset, ApplyMset)
+
+        OP_CASES(opMcmp, ApplyMcmp)
+
+        OP_CASES(opMchr, ApplyMchr)
+
+        OP_CASES(opMov, ApplyMov)
+        SPEC_CASES(Mov, ApplyMov)
+
+        OP_CASES(opRmem, ApplyRmem)
+
+        OP_CASES(opNot, ApplyNot)
+        SPEC_CASES1(Not, ApplyNot)
+
+        OP_CASES(opBNot, ApplyBNot)
+        SPEC_CASES1(BNot, ApplyBNot)
+
+        OP_CASES(opInc, ApplyInc)
+        SPEC_CASES1(Inc, ApplyInc)
+
+        OP_CASES(opDec, ApplyDec)
+        SPEC_CASES1(Dec, ApplyDec)
+
+        OP_CASES(opPush, ApplyPush)
+        SPEC_CASES1(Push, ApplyPush)
+
+        OP_CASES(opAlloca, ApplyAlloca)
+
+        OP_CASES(opPop, ApplyPop)
+        SPEC_CASES1(Pop, ApplyPop)
+
+        OP_CASES(opPopn, ApplyPopn)
+
+        // `popn <imm>` followed by `pop <reg>`
+        VM_LABEL(VM_FUSE_KEY(fsPopnPop), vmFusePopnPop) {
+            VM_spopn(instr->iu);
+            VM_fuse_next();
+            VM_write(&REG(vm, instr->ra), VM_spop(i64), instr->imd);
+            VM_NEXT();
+        }
+
+        // `push.q <reg>`, `mov.q <reg> <reg|imm>` followed by `pop.q <reg>`
+        VM_LABEL(VM_FUSE_KEY(fsPushMovPop), vmFusePushMovPop) {
+            VM_spush(REG(vm, instr->ra));
+            VM_fuse_next();
+            REG(vm, instr->ra) = (di->kb == okImm)? instr->iu : REG(vm, instr->rb);
+            VM_fuse_next();
+            REG(vm, instr->ra) = VM_spop(u64);
+            VM_NEXT();
+        }
+
+        // stack operations of functions whose stack space was checked on entry
+        VM_LABEL(VM_STACK_KEY(usPushR), vmStackPushR) {
+            VM_set(sp, rsp - 8);
+            *VM_smem(rsp) = REG(vm, instr->ra);
+            VM_NEXT();
+        }
+
+        VM_LABEL(VM_STACK_KEY(usPushI), vmStackPushI) {
+            VM_set(sp, rsp - 8);
+            *VM_smem(rsp) = instr->iu;
+            VM_NEXT();
+        }
+
+        VM_LABEL(VM_STACK_KEY(usPopR), vmStackPopR) {
+            REG(vm, instr->ra) = *VM_smem(rsp);
+            VM_set(sp, rsp + 8);
+            VM_NEXT();
+        }
+
+        VM_LABEL(VM_STACK_KEY(usPopn), vmStackPopn) {
+            VM_set(sp, rsp + (((u64) (u8) instr->iu) << 3));
+            VM_NEXT();
+        }
+
+        OP_CASES(opJmp, ApplyJmp)
+        SPEC_CASES1(Jmp, ApplyJmp)
+
+        OP_CASES(opJmpz, ApplyJmpz)
+        SPEC_CASES1(Jmpz, ApplyJmpz)
+
+        OP_CASES(opJmpnz, ApplyJmpnz)
+        SPEC_CASES1(Jmpnz, ApplyJmpnz)
+
+        OP_CASES(opJmpg, ApplyJmpg)
+        SPEC_CASES1(Jmpg, ApplyJmpg)
+
+        OP_CASES(opJmps, ApplyJmps)
+        SPEC_CASES1(Jmps, ApplyJmps)
+
+        OP_CASES(opCmp, ApplyCmp)
+        SPEC_CASES(Cmp, ApplyCmp)
+#define XX(J) VM_MODES(VM_FUSE_CMP_BINARY, J, ApplyCmp)
+        VM_FUSED_JUMPS(XX)
+#undef XX
+
+#define XX(N, O, T) OP_CASES(op##N, ApplyB, O, T) BRANCH_CASES(N, ApplyB, O, T)
+        BRANCH_OPS(XX)
+#undef XX
+
+        OP_CASES(opDjnz, ApplyDjnz)
+        BRANCH_CASES1(Djnz, ApplyDjnz)
+
+#define XX(C) OP_CASES(opSet##C, ApplySet, C) SPEC_CASES1(Set##C, ApplySet, C)
+        SELECT_OPS(XX)
+#undef XX
+
+#define XX(C) OP_CASES(opCsel##C, ApplyCsel, C) SPEC_CASES(Csel##C, ApplyCsel, C)
+        SELECT_OPS(XX)
+#undef XX
+
+        OP_CASES(opCall, ApplyCall)
+
+        // checks the space needed by the frame and the called function at once
+        VM_LABEL(VM_STACK_KEY(usCall), vmStackCall) {
+            if (rsp > msize)
+                VM_abort(vm, "VM stack memory underflow - escapes virtual machine memory");
+            if ((rsp - msb) <= di->stk) {
+                VM_memory_grow_stack(vm, rsp - di->stk);
+                msb = vm->ram.sb;
+            }
+            VM_set(sp, rsp - 16);
+            VM_smem(rsp)[1] = rip;
+            VM_smem(rsp)[0] = rbp;
+            VM_set(bp, rsp);
+            rip = iip + instr->ii;
+            VM_NEXT_DIRECT();
+        }
+
+        OP_CASES(opRet, ApplyRet)
+
+        OP_CASES(opFcall, ApplyFcall)
+
+        OP_CASES(opFret, ApplyFret)
+
+        OP_CASES(opNcall, ApplyNcall)
+
+        // `ncall <imm>`, the native function is resolved when decoding
+        VM_LABEL(VM_DECODE_NCALL, vmNcall) {
+            u32 nargs = ((Value *) VM_mem(rsp))->u;
+            VM_native_check(vm, instr->iu, nargs);
+            VM_native(vm->natives[di->nat], nargs);
+            VM_NEXT();
+        }
+
+        // `push <nargs>` followed by `ncall <imm>`, both checked when decoding
+        VM_LABEL(VM_FUSE_KEY(fsPushNcall), vmFusePushNcall) {
+            u32 nargs = instr->iu;
+            VM_spush(nargs);
+            VM_fuse_next();
+            VM_native(vm->natives[di->nat], nargs);
+            VM_NEXT();
+        }
+
+        OP_CASES(opNcallr, ApplyNcallr)
+
+        // `ncallr <imm>`, the native function is resolved when decoding
+        VM_LABEL(VM_DECODE_NCALLR, vmNcallr) {
+            VM_native_regs(vm->natives[di->nat], VM_native_regs_count(instr->iu));
+            VM_NEXT();
+        }
+
+        OP_CASES(opPutc, ApplyPutc)
+
+        OP_CASES(opPuti, ApplyPuti)
+
+        OP_CASES(opPuts, ApplyPuts)
+
+        OP_CASES(opAlloc, ApplyAlloc)
+
         OP_CASES(opDlloc, ApplyDlloc)
-#undef ApplyDlloc
 
-        case (opHalt << 1):
-        case (opHalt << 1) | 0b1:
+        OP_CASES(opRalloc, ApplyRalloc)
+
+        OP_CASES(opAnew, ApplyAnew)
+
+        OP_CASES(opAalloc, ApplyAalloc)
+
+        OP_CASES(opAreset, ApplyAreset)
+
+        OP_CASES(opAfree, ApplyAfree)
+
+        VM_CASE(opHalt, 0)
+        VM_CASE(opHalt, 1)
+            VM_spill();
+            vm->flags = eflHalt;
+            return;
+
+        // instructions changing the cached registers through an operand
+        VM_LABEL(VM_DECODE_STEP, vmStep) {
+            VM_spill();
+            VM_step(vm, di);
+            VM_reload();
+            VM_NEXT();
+        }
+
+        VM_CASE(opDbg, 0)
+        VM_CASE(opDbg, 1)
+            VM_NEXT();
+
+        VM_LABEL(VM_DECODE_TRAP, vmTrap)
+            VM_abort(vm, "execution goes beyond code space");
+
+        VM_LABEL(VM_DECODE_UNKNOWN, vmUnknown)
+#ifndef CYN_VM_THREADED_DISPATCH
+        default:
+#endif
+            VM_abort(vm, "Unknown instruction {%0x|%0x|%0x -> %04x}",
+                    instr->opc, instr->imd, instr->ims, di->op);
+#ifndef CYN_VM_THREADED_DISPATCH
+    }
+
+        VM_advance();
+        VM_prologue();
+    }
+#endif
+}
+
+#undef BRANCH_CASES1
+#undef BRANCH_CASES
+#undef SPEC_CASES1
+#undef SPEC_CASES
+#undef OP_CASES
+
+#define STEP_CASE(OP, Apply, ...) \
+    case OP: { Apply((instr->imd), mb, ##__VA_ARGS__); break; }
+
+void VM_step(VM *vm, const DecodedInstruction *di)
+{
+    void *rA = NULL, *rB = NULL;
+    const Instruction *instr = &di->instr;
+    u64 iip = di->iip, imm;
+    Mode mb = (instr->rmd == amReg)? instr->imd : instr->ims;
+    VM_registers();
+
+    if (di->op == VM_DECODE_TRAP)
+        VM_abort(vm, "execution goes beyond code space");
+
+    REG(vm, ip) = di->nip;
+    VM_reload();
+    VM_operands();
+    switch (di->op == VM_DECODE_UNKNOWN? opcCOUNT : instr->opc) {
+#define XX(N, O) STEP_CASE(op##N, Apply, O)
+        BINARY_OPS(XX)
+#undef XX
+#define XX(N, O) STEP_CASE(op##N, ApplyF, O)
+        FLOAT_OPS(XX)
+#undef XX
+#define XX(N, FN) STEP_CASE(op##N, ApplyV, FN)
+        VECTOR_OPS(XX)
+#undef XX
+#define XX(N, O, T) STEP_CASE(op##N, ApplyB, O, T)
+        BRANCH_OPS(XX)
+#undef XX
+#define XX(C) STEP_CASE(opSet##C, ApplySet, C) STEP_CASE(opCsel##C, ApplyCsel, C)
+        SELECT_OPS(XX)
+#undef XX
+#define XX(N) STEP_CASE(op##N, Apply##N)
+        XX(Mov) XX(Rmem) XX(Not) XX(BNot) XX(Inc) XX(Dec) XX(Push) XX(Alloca)
+        XX(Pop) XX(Popn) XX(Jmp) XX(Jmpz) XX(Jmpnz) XX(Jmpg) XX(Jmps) XX(Cmp)
+        XX(Call) XX(Ret) XX(Ncall) XX(Putc) XX(Puti) XX(Puts) XX(Alloc) XX(Dlloc)
+        XX(Fcall) XX(Fret) XX(Ncallr) XX(Fcmp) XX(Fcvt) XX(Itof) XX(Ftoi)
+        XX(Vld) XX(Vst) XX(Vdup) XX(Vred)
+        XX(Mcpy) XX(Mset) XX(Mcmp) XX(Mchr) XX(Djnz)
+        XX(Anew) XX(Aalloc) XX(Areset) XX(Afree) XX(Ralloc)
+#undef XX
+        case opHalt:
             vm->flags = eflHalt;
             break;
-        case (opDbg << 1):
-        case (opDbg << 1) | 0b1:
+        case opDbg:
             break;
         default:
             VM_abort(vm, "Unknown instruction {%0x|%0x|%0x -> %04x}",
-                    instr->opc, instr->imd, instr->ims, op);
+                     instr->opc, instr->imd, instr->ims, di->op);
     }
 }
 
+#undef STEP_CASE
+#undef ApplyAfree
+#undef ApplyAreset
+#undef ApplyAalloc
+#undef ApplyAnew
+#undef ApplyRalloc
+#undef ApplyDlloc
+#undef ApplyAlloc
+#undef ApplyPuts
+#undef ApplyPuti
+#undef ApplyPutc
+#undef ApplyNcallr
+#undef ApplyNcall
+#undef VM_native_regs_count
+#undef VM_native_regs
+#undef VM_native
+#undef ApplyRet
+#undef ApplyFret
+#undef ApplyFcall
+#undef ApplyCall
+#undef ApplyCsel
+#undef ApplySet
+#undef VM_COND_ge
+#undef VM_COND_gt
+#undef VM_COND_le
+#undef VM_COND_lt
+#undef VM_COND_ne
+#undef VM_COND_eq
+#undef SELECT_OPS
+#undef ApplyCmp
+#undef ApplyDjnz
+#undef ApplyB
+#undef VM_branch_u64
+#undef VM_branch_i64
+#undef VM_umask
+#undef BRANCH_OPS
+#undef ApplyJmps
+#undef ApplyJmpg
+#undef ApplyJmpnz
+#undef ApplyJmpz
+#undef ApplyJmp
+#undef ApplyPopn
+#undef ApplyPop
+#undef ApplyAlloca
+#undef ApplyPush
+#undef ApplyDec
+#undef ApplyInc
+#undef ApplyBNot
+#undef ApplyNot
+#undef ApplyRmem
+#undef ApplyMov
+#undef ApplyMchr
+#undef ApplyMcmp
+#undef ApplyMset
+#undef ApplyMcpy
+#undef ApplyVred
+#undef ApplyVdup
+#undef ApplyVst
+#undef ApplyVld
+#undef ApplyV
+#undef VECTOR_OPS
+#undef Apply
+#undef ApplyFtoi
+#undef ApplyItof
+#undef ApplyFcvt
+#undef ApplyFcmp
+#undef ApplyF
+#undef FLOAT_OPS
+#undef BINARY_OPS
+
 void VM_returnx(VM *vm, Value *vals, u32 count)
 {
     u32 nargs;
+    if (vm->ncallr) {
+        VM_assert(vm, count <= VM_NCALLR_REGS, "ncallr returns at most %u values, got %u",
+                  VM_NCALLR_REGS, count);
+        for (u32 i = 0; i < count; i++)
+            REG(vm, r0 + i) = vals[i].u;
+        return;
+    }
+
     REG(vm, sp) = REG(vm, bp);
     REG(vm, bp) = VM_pop(vm, u64);
     REG(vm, ip) = VM_pop(vm, u64);
@@ -329,35 +1200,179 @@ void VM_returnx(VM *vm, Value *vals, u32 count)
     VM_push(vm, count);
 }
 
-static void VM_memory_init(Memory *mem, u64 size, u32 bk, u32 ss, u32 db)
+#ifdef CYN_VM_GUARD_PAGES
+// Any 32-bit address plus the size of the widest access
+#define VM_GUARD_SPAN ((1ull << 32) + sizeof(VectorReg))
+
+// The virtual machines whose memory faults are reported, linked through `guard`
+static VM *vmGuarded = NULL;
+
+// The handler replaced by \see VM_guard_handler, it handles the other faults
+static struct sigaction vmGuardPrev;
+
+static void VM_guard_handler(int sig, siginfo_t *info, void *ctx)
 {
-    mem->ptr = malloc(size);
+    u8 *addr = info->si_addr;
+
+    for (VM *vm = vmGuarded; vm != NULL; vm = vm->guard) {
+        if (addr >= vm->ram.ptr && addr < vm->ram.ptr + vm->ram.reserved) {
+            VM_jit_fault_context(vm, ctx);
+            VM_abort(vm, "Memory access violation %x/%x", (u32) (addr - vm->ram.base), vm->ram.hlm);
+        }
+    }
+
+    // not a virtual machine memory access
+    if (vmGuardPrev.sa_flags & SA_SIGINFO)
+        vmGuardPrev.sa_sigaction(sig, info, ctx);
+    else if (vmGuardPrev.sa_handler != SIG_DFL && vmGuardPrev.sa_handler != SIG_IGN)
+        vmGuardPrev.sa_handler(sig);
+    else
+        // fault again with the previous disposition
+        sigaction(sig, &vmGuardPrev, NULL);
+}
+
+static void VM_guard(VM *vm)
+{
+    static bool installed = false;
+    if (!installed) {
+        struct sigaction sa = {0};
+        sa.sa_sigaction = VM_guard_handler;
+        sa.sa_flags = SA_SIGINFO | SA_NODEFER;
+        sigemptyset(&sa.sa_mask);
+        installed = sigaction(SIGSEGV, &sa, &vmGuardPrev) == 0;
+    }
+    vm->guard = vmGuarded;
+    vmGuarded = vm;
+}
+
+static void VM_unguard(VM *vm)
+{
+    VM **it = &vmGuarded;
+    while (*it != NULL && *it != vm)
+        it = &(*it)->guard;
+    if (*it != NULL)
+        *it = vm->guard;
+}
+#endif
+
+// Commits the reserved memory from \param from to \param to, both are page aligned offsets from `ptr`
+static bool VM_memory_commit(Memory *mem, u64 from, u64 to)
+{
+    if (from >= to)
+        return true;
+    if (mprotect(mem->ptr + from, to - from, PROT_READ | PROT_WRITE) != 0)
+        return false;
+    mem->committed += to - from;
+    return true;
+}
+
+/**
+ * Reserves \param max bytes of address space, the heap grows up from the
+ * start and the stack grows down from the end. Only \param size bytes are
+ * committed, \param ss of them at the end for the stack. Both the heap limit
+ * and the stack boundary are kept page aligned so that growing either of them
+ * commits whole pages (\see VM_memory_grow_heap, VM_memory_grow_stack).
+ */
+static bool VM_memory_init(Memory *mem, u64 size, u64 max, u32 bk, u32 ss, u32 db)
+{
+    u64 page = sysconf(_SC_PAGESIZE), heap, stack, top;
+
+    // the memory must stay addressable with 32-bit addresses
+    max = MIN(CynAlign(MAX(size, max), page), (bk + (1ull << 32) - page) & ~(page - 1));
+    stack = MIN(CynAlign(ss, page), max - bk);
+    heap = MIN(CynAlign(size - MIN(size, ss), page), max - stack);
+#ifdef CYN_VM_GUARD_PAGES
+    // The rest of the address space is reserved but never committed so that
+    // any access past the memory faults
+    mem->reserved = CynAlign(bk + VM_GUARD_SPAN, page);
+    top = max;
+#else
+    // accesses are bounds checked, the widest one at the end of the memory
+    // reads past it
+    mem->reserved = CynAlign(max + sizeof(VectorReg), page);
+    top = mem->reserved;
+#endif
+    mem->committed = 0;
+    mem->ptr = mmap(NULL, mem->reserved, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem->ptr == MAP_FAILED) {
+        mem->ptr = NULL;
+        return false;
+    }
+    if (!VM_memory_commit(mem, 0, heap) || !VM_memory_commit(mem, max - stack, top)) {
+        munmap(mem->ptr, mem->reserved);
+        mem->ptr = NULL;
+        return false;
+    }
     mem->base = mem->ptr + bk;
-    mem->size = size - bk;
-    mem->sb = mem->size - ss;
+    mem->size = max - bk;
+    mem->sb = mem->size - stack;
     mem->hb = db;
-    mem->hlm = (mem->sb - CYN_VM_ALIGNMENT);
+    mem->hlm = heap - bk - CYN_VM_ALIGNMENT;
+    return true;
+}
+
+void VM_memory_grow_stack(VM *vm, u64 bottom)
+{
+    Memory *mem = &vm->ram;
+    u64 page = sysconf(_SC_PAGESIZE), bk = mem->base - mem->ptr;
+    u64 floor = bk + mem->hlm + CYN_VM_ALIGNMENT, sb = bk + mem->sb, want;
+
+    if (bottom > mem->sb)
+        return;
+    // at least double the stack so that deep recursion commits few times
+    want = MIN(bk + bottom, bk + mem->size - 2 * (mem->size - mem->sb));
+    want = MAX((want - 1) & ~(page - 1), floor);
+    if (want >= bk + bottom || !VM_memory_commit(mem, want, sb))
+        VM_abort(vm, "VM stack memory overflow - collides with heap boundary");
+
+    VM_dbg_trace(vm, trcHEAP, printf("heap: stack grown to %" PRIu64 " bytes\n", bk + mem->size - want));
+    mem->sb = want - bk;
+}
+
+bool VM_memory_grow_heap(VM *vm, u64 limit)
+{
+    Memory *mem = &vm->ram;
+    u64 page = sysconf(_SC_PAGESIZE), bk = mem->base - mem->ptr;
+    u64 end = bk + mem->hlm + CYN_VM_ALIGNMENT, want;
+
+    if (limit <= mem->hlm)
+        return true;
+    // at least double the heap so that growing allocations commit few times
+    want = MAX(limit, 2 * (u64) mem->hlm) + CYN_VM_ALIGNMENT;
+    want = MIN(CynAlign(bk + want, page), bk + mem->sb);
+    if (want < bk + limit + CYN_VM_ALIGNMENT || !VM_memory_commit(mem, end, want))
+        return false;
+
+    VM_dbg_trace(vm, trcHEAP, printf("heap: heap grown to %" PRIu64 " bytes\n", want - bk));
+    mem->hlm = want - bk - CYN_VM_ALIGNMENT;
+    return true;
 }
 
-void VM_init_(VM *vm, Code *code, u64 mem, u32 nhbs, u32 ss)
+void VM_init_(VM *vm, Code *code, u64 mem, u64 max, HeapAllocator alc, u32 nhbs, u32 ss)
 {
     u32 bk;
     CodeHeader *header = (CodeHeader *) Vector_at(code, 0);
 
     memset(vm, 0, sizeof(*vm));
 
-    bk = CynAlign((sizeof(Heap) + sizeof(HeapBlock) * nhbs), CYN_VM_ALIGNMENT);
+    bk = CynAlign(VM_heap_size(alc, nhbs), CYN_VM_ALIGNMENT);
     mem += header->db + bk;
+    max += header->db + bk;
 
     mem = CynAlign(mem, CYN_VM_ALIGNMENT);
     ss  = CynAlign(ss + CYN_VM_ALIGNMENT, CYN_VM_ALIGNMENT);
 
-    VM_memory_init(&vm->ram, mem, bk, ss, header->db);
-    VM_heap_init(vm, nhbs);
+    if (!VM_memory_init(&vm->ram, mem, max, bk, ss, header->db))
+        VM_abort(vm, "Out of memory, allocating %" PRIu64 " bytes of virtual machine memory failed", mem);
+#ifdef CYN_VM_GUARD_PAGES
+    VM_guard(vm);
+#endif
+    VM_heap_init(vm, alc, nhbs);
 
     // Copy over the code header and constants to ram
     vm->code = code;
     memcpy(vm->ram.base, header, header->db);
+    VM_decode(vm);
     // first stack word
     for (int i = 0; i < 8; i++)
         *MEM(vm, ss-i) = 0xA3;
@@ -368,12 +1383,18 @@ void VM_init_(VM *vm, Code *code, u64 mem, u32 nhbs, u32 ss)
 void VM_deinit(VM *vm)
 {
     if (vm->ram.base) {
-        free(vm->ram.ptr);
+        VM_heap_deinit(vm);
+#ifdef CYN_VM_GUARD_PAGES
+        VM_unguard(vm);
+#endif
+        munmap(vm->ram.ptr, vm->ram.reserved);
     }
+    VM_jit_release(vm);
+    VM_decode_release(vm);
     memset(vm, 0, sizeof(*vm));
 }
 
-void VM_run(VM *vm, int argc, char *argv[])
+void VM_enter(VM *vm, int argc, char *argv[])
 {
     CodeHeader *header = (CodeHeader *) Vector_at(vm->code, 0);
     memset(vm->regs, 0, sizeof(vm->regs));
@@ -390,22 +1411,17 @@ void VM_run(VM *vm, int argc, char *argv[])
     VM_push(vm, Vector_len(vm->code));
     VM_push(vm, REG(vm, bp));
     REG(vm, bp) = REG(vm, sp);
+}
 
-    while (REG(vm, ip) < Vector_len(vm->code))
-    {
-        Instruction instr = {0};
-        u64 iip  = VM_fetch(vm, &instr);
-
-#if defined(CYN_VM_DEBUGGER)
-        if (instr.opc == opDbg || vm->flags & eflDbgBreak) {
-            if (vm->debugger)
-                vm->debugger(vm, iip, &instr);
-        }
-        VM_execute(vm, &instr, iip);
-#else
-        VM_execute(vm, &instr, iip);
-#endif
-        if (vm->flags & eflHalt)
-            break;
+void VM_run(VM *vm, int argc, char *argv[])
+{
+    VM_enter(vm, argc, argv);
+    if (vm->jit)
+        VM_jit_run(vm);
+    else {
+        // the entry point might not check its own pushes (\see VM_stack_analyze)
+        if ((REG(vm, sp) - vm->ram.sb) <= vm->stk)
+            VM_memory_grow_stack(vm, REG(vm, sp) - vm->stk);
+        VM_dispatch(vm, VM_decoded_at(vm, REG(vm, ip)));
     }
 }
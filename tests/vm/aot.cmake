@@ -0,0 +1,54 @@
+# Checks that the programs in aot/ print the same output and exit with the
+# same code when translated ahead of time (cynvm aot) as when interpreted.
+#
+# Run by ctest with the tools (CYNAS, CYNVM), the C compiler (CC), the flags
+# and libraries needed to build translated programs (AOT_FLAGS, AOT_LIBS) and
+# the directory to build them in (WORK_DIR). The flags and libraries are
+# separated by spaces.
+
+separate_arguments(AOT_FLAGS)
+separate_arguments(AOT_LIBS)
+file(MAKE_DIRECTORY ${WORK_DIR})
+file(GLOB programs ${CMAKE_CURRENT_LIST_DIR}/aot/*.cas)
+
+foreach (program ${programs})
+    get_filename_component(name ${program} NAME_WE)
+
+    execute_process(COMMAND ${CYNAS} ${program}
+            WORKING_DIRECTORY ${WORK_DIR}
+            RESULT_VARIABLE status)
+    if (NOT status EQUAL 0)
+        message(FATAL_ERROR "${name}: assembling failed")
+    endif()
+
+    execute_process(COMMAND ${CYNVM} aot ${name}.bin -o ${name}.c
+            WORKING_DIRECTORY ${WORK_DIR}
+            RESULT_VARIABLE status)
+    if (NOT status EQUAL 0)
+        message(FATAL_ERROR "${name}: translating failed")
+    endif()
+
+    execute_process(COMMAND ${CC} ${AOT_FLAGS} ${name}.c ${AOT_LIBS} -lm -o ${name}
+            WORKING_DIRECTORY ${WORK_DIR}
+            RESULT_VARIABLE status
+            ERROR_VARIABLE errors)
+    if (NOT status EQUAL 0)
+        message(FATAL_ERROR "${name}: compiling the translated program failed\n${errors}")
+    endif()
+
+    execute_process(COMMAND ${CYNVM} run ${name}.bin
+            WORKING_DIRECTORY ${WORK_DIR}
+            RESULT_VARIABLE expectedStatus
+            OUTPUT_VARIABLE expected)
+    execute_process(COMMAND ./${name}
+            WORKING_DIRECTORY ${WORK_DIR}
+            RESULT_VARIABLE actualStatus
+            OUTPUT_VARIABLE actual)
+
+    if (NOT actual STREQUAL expected OR NOT actualStatus STREQUAL expectedStatus)
+        message(FATAL_ERROR "${name}: the translated program disagrees with the interpreter\n"
+                "interpreter (${expectedStatus}):\n${expected}\n"
+                "translated (${actualStatus}):\n${actual}")
+    endif()
+    message(STATUS "${name}: ok")
+endforeach()
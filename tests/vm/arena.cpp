@@ -0,0 +1,110 @@
+/**
+ * Copyright (c) 2022 Suilteam, Carter Mbotho
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the MIT license. See LICENSE for details.
+ *
+ * @author Carter
+ * @date 2022-12-27
+ */
+
+#include "vm.hpp"
+
+using namespace cyn::test;
+
+static const HeapAllocator allocators[] = {halTlsf, halList};
+
+TEST_CASE("Arena: aalloc bumps a pointer within the current chunk")
+{
+    checkAllExecs(R"(
+main:
+    anew r1 64
+    aalloc r1 24
+    mov r2 r0
+    mov [r2] 7
+    aalloc r1 20
+    mov r3 r0
+    mov [r3] 9
+    aalloc r1 16
+    mov r4 r0
+    add r5 [r2]
+    add r5 [r3]
+    afree r1
+    halt
+)", [](const Machine& m) {
+        CHECK(m.reg(r1) != 0);
+        CHECK(m.reg(r2) != 0);
+        CHECK(m.reg(r3) == m.reg(r2) + 24);
+        // sizes are rounded up to the alignment
+        CHECK(m.reg(r4) == m.reg(r3) + 24);
+        CHECK(m.reg(r5) == 16);
+    });
+}
+
+TEST_CASE("Arena: full chunks are chained and areset starts over")
+{
+    checkAllExecs(R"(
+main:
+    anew r1 32
+    aalloc r1 32
+    mov r2 r0
+    aalloc r1 8
+    mov r3 r0
+    aalloc r1 100
+    mov r4 r0
+    mov r0 100
+    mset r4 'a'
+    areset r1
+    aalloc r1 8
+    mov r5 r0
+    afree r1
+    halt
+)", [](const Machine& m) {
+        // the second allocation does not fit in the first chunk
+        CHECK(m.reg(r3) > m.reg(r2));
+        CHECK(m.reg(r3) != m.reg(r2) + 32);
+        CHECK(m.reg(r4) != m.reg(r3) + 8);
+        CHECK(m.reg(r5) == m.reg(r2));
+    });
+}
+
+TEST_CASE("Arena: areset and afree return every chunk to the heap")
+{
+    for (auto alc: allocators) {
+        CAPTURE(alc);
+        Machine m{"main:\n    halt\n", Exec::Interpret, CYN_VM_DEFAULT_MS, CYN_VM_DEFAULT_MX, alc};
+        VM *vm = &m.vm;
+
+        u32 arena = VM_arena_new(vm, 64);
+        REQUIRE(arena != 0);
+        u32 first = VM_arena_alloc(vm, arena, 8);
+        for (u32 i = 0; i < 100; i++)
+            REQUIRE(VM_arena_alloc(vm, arena, 48) != 0);
+        u32 top = VM_alloc(vm, 8);
+        REQUIRE(top != 0);
+        CHECK(VM_free(vm, top));
+
+        VM_arena_reset(vm, arena);
+        CHECK(VM_arena_alloc(vm, arena, 8) == first);
+        // all the chunks were released so the heap top is back after the arena
+        u32 after = VM_alloc(vm, 8);
+        CHECK(after > arena);
+        CHECK(after < top);
+        CHECK(VM_free(vm, after));
+
+        VM_arena_free(vm, arena);
+        CHECK(VM_alloc(vm, 8) == arena);
+    }
+}
+
+TEST_CASE("Arena: creating an arena larger than the heap fails")
+{
+    Machine m{"main:\n    halt\n", Exec::Interpret};
+    VM *vm = &m.vm;
+
+    CHECK(VM_arena_new(vm, m.vm.ram.size + 1) == 0);
+    u32 arena = VM_arena_new(vm, 0);
+    REQUIRE(arena != 0);
+    CHECK(VM_arena_alloc(vm, arena, m.vm.ram.size + 1) == 0);
+    VM_arena_free(vm, arena);
+}
@@ -0,0 +1,102 @@
+/**
+ * Copyright (c) 2022 Suilteam, Carter Mbotho
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the MIT license. See LICENSE for details.
+ *
+ * @author Carter
+ * @date 2022-12-27
+ */
+
+#include "vm.hpp"
+
+using namespace cyn::test;
+
+TEST_CASE("Branch: compare and branch on every condition")
+{
+    // r0 counts the branches that went the right way, r1 is set on the wrong way
+    checkAllExecs(R"(
+main:
+    mov r0 0
+    mov r1 0
+    mov r2 -1
+    jltu r2 5 fail
+    jlt r2 5 t1
+    jmp fail
+t1:
+    inc r0
+    mov.b r3 255
+    jgtu.b r3 254 t2
+    jmp fail
+t2:
+    inc r0
+    jgt.b r3 0 fail
+    inc r0
+    mov r5 7
+    jeq r5 7 t3
+    jmp fail
+t3:
+    inc r0
+    jne r5 r5 fail
+    jle r5 7 t4
+    jmp fail
+t4:
+    inc r0
+    jge r5 8 fail
+    jgeu r5 7 t5
+    jmp fail
+t5:
+    inc r0
+    jleu r5 6 fail
+    inc r0
+    halt
+fail:
+    mov r1 1
+    halt
+)", [](const Machine& m) {
+        CHECK(m.reg(r0) == 7);
+        CHECK(m.reg(r1) == 0);
+    });
+}
+
+TEST_CASE("Branch: djnz loops until the register is zero")
+{
+    checkAllExecs(R"(
+main:
+    mov r6 100
+    mov r7 0
+count:
+    inc r7
+    djnz r6 count
+    mov r8 300
+    mov r9 0
+bytes:
+    inc r9
+    djnz.b r8 bytes
+    halt
+)", [](const Machine& m) {
+        CHECK(m.reg(r6) == 0);
+        CHECK(m.reg(r7) == 100);
+        // only the low byte is counted down
+        CHECK(m.reg(r8) == 256);
+        CHECK(m.reg(r9) == 44);
+    });
+}
+
+TEST_CASE("Branch: compare and branch leaves the flags register untouched")
+{
+    checkAllExecs(R"(
+main:
+    mov r0 3
+    cmp r0 3
+    jlt r0 100 taken
+    halt
+taken:
+    seteq r1
+    mov r2 flg
+    halt
+)", [](const Machine& m) {
+        CHECK(m.reg(r1) == 1);
+        CHECK(m.reg(r2) == flgZero);
+    });
+}
@@ -0,0 +1,92 @@
+/**
+ * Copyright (c) 2022 Suilteam, Carter Mbotho
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the MIT license. See LICENSE for details.
+ *
+ * @author Carter
+ * @date 2022-12-27
+ */
+
+#include "vm.hpp"
+
+#include <cstdint>
+
+using namespace cyn::test;
+
+TEST_CASE("Float: arithmetic and conversions")
+{
+    checkAllExecs(R"(
+main:
+    mov r0 0
+    fadd r0 1.5
+    fmul r0 4
+    fsub r0 0.5
+    fdiv r0 2
+    ftoi r1 r0
+    itof r2 r1
+    mov r3 -7
+    itof r4 r3
+    ftoi r5 r4
+    halt
+)", [](const Machine& m) {
+        CHECK(m.freg(r0) == 2.75);
+        CHECK(m.reg(r1) == 2);
+        CHECK(m.freg(r2) == 2.0);
+        CHECK(m.freg(r4) == -7.0);
+        CHECK(m.ireg(r5) == -7);
+    });
+}
+
+TEST_CASE("Float: single precision values and width conversions")
+{
+    checkAllExecs(R"(
+main:
+    mov r0 0
+    fadd.w r0 1.25
+    fmul.w r0 2
+    fcvt r1 r0
+    mov r2 0
+    fadd r2 3.5
+    fcvt.w r3 r2
+    ftoi.w r4 r3
+    halt
+)", [](const Machine& m) {
+        f32 f;
+        u32 bits = (u32) m.reg(r0);
+        memcpy(&f, &bits, sizeof(f));
+        CHECK(f == 2.5f);
+        CHECK(m.freg(r1) == 2.5);
+        bits = (u32) m.reg(r3);
+        memcpy(&f, &bits, sizeof(f));
+        CHECK(f == 3.5f);
+        CHECK(m.reg(r4) == 3);
+    });
+}
+
+TEST_CASE("Float: fcmp sets the flags like cmp and clears them when unordered")
+{
+    checkAllExecs(R"(
+main:
+    mov r0 0
+    fadd r0 2.5
+    fcmp r0 1
+    setgt r1
+    fcmp r0 2.5
+    seteq r2
+    fcmp r0 3
+    setlt r3
+    mov r4 0
+    fdiv r4 0
+    fcmp r4 r4
+    mov r5 flg
+    ftoi r6 r4
+    halt
+)", [](const Machine& m) {
+        CHECK(m.reg(r1) == 1);
+        CHECK(m.reg(r2) == 1);
+        CHECK(m.reg(r3) == 1);
+        CHECK(m.reg(r5) == 0);
+        CHECK(m.ireg(r6) == INT64_MIN);
+    });
+}
@@ -0,0 +1,141 @@
+/**
+ * Copyright (c) 2022 Suilteam, Carter Mbotho
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the MIT license. See LICENSE for details.
+ *
+ * @author Carter
+ * @date 2022-12-27
+ */
+
+#include "vm.hpp"
+
+using namespace cyn::test;
+
+// A small memory in a large reservation so that programs grow into the gap
+static const u64 growMs = 64 * 1024;
+static const u64 growMx = 16 * 1024 * 1024;
+static const HeapAllocator allocators[] = {halTlsf, halList};
+
+TEST_CASE("Grow: the heap commits the gap as allocations need it")
+{
+    // 256 blocks of 4k each storing its index, summed once all are allocated
+    static const char *program = R"(
+main:
+    alloc r8 2048
+    mov r6 0
+fill:
+    alloc r2 4096
+    jeq r2 0 fail
+    mov [r2] r6
+    mov r3 r2
+    add r3 4088
+    mov [r3] r6
+    mov r1 r6
+    sal r1 3
+    add r1 r8
+    mov [r1] r2
+    inc r6
+    jlt r6 256 fill
+    mov r6 0
+    mov r7 0
+sum:
+    mov r1 r6
+    sal r1 3
+    add r1 r8
+    mov r2 [r1]
+    add r7 [r2]
+    mov r3 r2
+    add r3 4088
+    add r7 [r3]
+    inc r6
+    jlt r6 256 sum
+    halt
+fail:
+    mov r7 -1
+    halt
+)";
+
+    for (auto alc: allocators) {
+        CAPTURE(alc);
+        Machine idle{"main:\n    halt\n", Exec::Interpret, growMs, growMx, alc};
+        for (auto exec: AllExecs) {
+            CAPTURE(execName(exec));
+            Machine m{program, exec, growMs, growMx, alc};
+            CHECK(m.reg(r7) == 2 * (255 * 256 / 2));
+            CHECK(m.vm.ram.hlm > idle.vm.ram.hlm + 1024 * 1024);
+            CHECK(m.vm.ram.committed > idle.vm.ram.committed);
+            // the stack was left where it was
+            CHECK(m.vm.ram.sb == idle.vm.ram.sb);
+            CHECK(m.vm.ram.size == idle.vm.ram.size);
+        }
+    }
+}
+
+TEST_CASE("Grow: deep recursion commits the gap for the stack")
+{
+    // every frame keeps its depth on the stack and adds it when returning
+    static const char *program = R"(
+main:
+    mov r0 0
+    mov r1 0
+    push 0
+    call rec
+    pop r2
+    halt
+rec:
+    inc r1
+    push r1
+    jge r1 30000 done
+    push 0
+    call rec
+    pop r5
+done:
+    pop r4
+    add r0 r4
+    ret 0
+)";
+
+    Machine idle{"main:\n    halt\n", Exec::Interpret, growMs, growMx};
+    for (auto exec: AllExecs) {
+        CAPTURE(execName(exec));
+        Machine m{program, exec, growMs, growMx};
+        CHECK(m.reg(r0) == 30000ull * 30001 / 2);
+        CHECK(m.reg(r1) == 30000);
+        CHECK(m.vm.ram.sb + 512 * 1024 < idle.vm.ram.sb);
+        CHECK(m.vm.ram.committed > idle.vm.ram.committed);
+        CHECK(m.vm.ram.hlm == idle.vm.ram.hlm);
+    }
+}
+
+TEST_CASE("Grow: the heap does not grow into the stack")
+{
+    for (auto alc: allocators) {
+        CAPTURE(alc);
+        Machine m{"main:\n    halt\n", Exec::Interpret, growMs, growMx, alc};
+        VM *vm = &m.vm;
+        u32 hlm = vm->ram.hlm, sb = vm->ram.sb;
+
+        CHECK_FALSE(VM_memory_grow_heap(vm, sb));
+        CHECK(VM_alloc(vm, growMx) == 0);
+        CHECK(vm->ram.hlm == hlm);
+
+        // grows up to the stack boundary at most
+        CHECK(VM_memory_grow_heap(vm, hlm + 100));
+        CHECK(vm->ram.hlm >= hlm + 100);
+        CHECK(vm->ram.hlm + CYN_VM_ALIGNMENT <= vm->ram.sb);
+        u32 mem = VM_alloc(vm, growMx / 2);
+        REQUIRE(mem != 0);
+        vm->ram.base[mem + growMx / 2 - 1] = 0x5A;
+        CHECK(vm->ram.base[mem + growMx / 2 - 1] == 0x5A);
+        CHECK(vm->ram.sb == sb);
+    }
+}
+
+TEST_CASE("Grow: Xmx smaller than Xms reserves the committed memory")
+{
+    Machine m{"main:\n    halt\n", Exec::Interpret, growMs, 0};
+    CHECK(m.vm.ram.size >= growMs);
+    CHECK(VM_alloc(&m.vm, growMs) == 0);
+    CHECK(VM_alloc(&m.vm, growMs / 4) != 0);
+}
@@ -0,0 +1,276 @@
+/**
+ * Copyright (c) 2022 Suilteam, Carter Mbotho
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the MIT license. See LICENSE for details.
+ *
+ * @author Carter
+ * @date 2022-12-27
+ */
+
+#include "vm.hpp"
+
+using namespace cyn::test;
+
+static const char *haltProgram = "main:\n    halt\n";
+static const HeapAllocator allocators[] = {halTlsf, halList};
+
+TEST_CASE("Heap: TLSF coalesces freed blocks with their free neighbours")
+{
+    Machine m{haltProgram, Exec::Interpret, CYN_VM_DEFAULT_MS, CYN_VM_DEFAULT_MX, halTlsf};
+    VM *vm = &m.vm;
+
+    u32 a = VM_alloc(vm, 100), b = VM_alloc(vm, 100), c = VM_alloc(vm, 100);
+    // keeps the freed blocks away from the top of the heap
+    u32 d = VM_alloc(vm, 100);
+    REQUIRE(a != 0);
+    REQUIRE(b > a);
+    REQUIRE(c > b);
+    REQUIRE(d > c);
+
+    CHECK(VM_free(vm, a));
+    CHECK(VM_free(vm, c));
+    // merges with both the previous and the next block
+    CHECK(VM_free(vm, b));
+    CHECK(VM_alloc(vm, 300) == a);
+    // the rest of the merged block is split off and reused
+    CHECK(VM_alloc(vm, 16) == a + 312);
+}
+
+TEST_CASE("Heap: TLSF splits blocks and reuses the rest")
+{
+    Machine m{haltProgram, Exec::Interpret, CYN_VM_DEFAULT_MS, CYN_VM_DEFAULT_MX, halTlsf};
+    VM *vm = &m.vm;
+
+    u32 a = VM_alloc(vm, 1000), b = VM_alloc(vm, 16);
+    REQUIRE(a != 0);
+    REQUIRE(b != 0);
+    CHECK(VM_free(vm, a));
+
+    u32 x = VM_alloc(vm, 100), y = VM_alloc(vm, 100);
+    CHECK(x == a);
+    CHECK(y > x);
+    CHECK(y < b);
+}
+
+TEST_CASE("Heap: freeing the block at the top of the heap lowers the top")
+{
+    for (auto alc: allocators) {
+        CAPTURE(alc);
+        Machine m{haltProgram, Exec::Interpret, CYN_VM_DEFAULT_MS, CYN_VM_DEFAULT_MX, alc};
+        VM *vm = &m.vm;
+
+        u32 a = VM_alloc(vm, 64), b = VM_alloc(vm, 64);
+        REQUIRE(a != 0);
+        REQUIRE(b != 0);
+        CHECK(VM_free(vm, b));
+        CHECK(VM_alloc(vm, 64) == b);
+        CHECK(VM_free(vm, b));
+        CHECK(VM_free(vm, a));
+        CHECK(VM_alloc(vm, 128) == a);
+    }
+}
+
+TEST_CASE("Heap: freeing memory that was not allocated fails")
+{
+    for (auto alc: allocators) {
+        CAPTURE(alc);
+        Machine m{haltProgram, Exec::Interpret, CYN_VM_DEFAULT_MS, CYN_VM_DEFAULT_MX, alc};
+        VM *vm = &m.vm;
+
+        u32 a = VM_alloc(vm, 64);
+        REQUIRE(a != 0);
+        CHECK_FALSE(VM_free(vm, a + 8));
+        CHECK(VM_free(vm, a));
+        CHECK_FALSE(VM_free(vm, a));
+    }
+}
+
+TEST_CASE("Heap: programs allocating and freeing with either allocator")
+{
+    // keeps 64 live blocks of random sizes, each starting with the low byte of its address
+    static const char *program = R"(
+main:
+    alloc r8 512
+    mov r0 512
+    mset r8 0
+    mov r7 12345
+    mov r6 0
+    mov r10 0
+loop:
+    mul r7 1103515245
+    add r7 12345
+    mov r1 r7
+    sar r1 16
+    band r1 63
+    sal r1 3
+    add r1 r8
+    mov r2 [r1]
+    jeq r2 0 fresh
+    mov.b r3 [r2]
+    mov r4 r2
+    band r4 255
+    jeq.b r3 r4 ok
+    add r10 1
+ok:
+    dlloc r2
+fresh:
+    mov r3 r7
+    sar r3 24
+    band r3 1023
+    add r3 1
+    alloc r2 r3
+    jne r2 0 stored
+    add r10 1000000
+    jmp next
+stored:
+    mov r4 r2
+    mov.b [r2] r4
+    mov [r1] r2
+next:
+    inc r6
+    jlt r6 20000 loop
+    halt
+)";
+
+    for (auto alc: allocators) {
+        CAPTURE(alc);
+        Machine m{program, Exec::Interpret, CYN_VM_DEFAULT_MS, CYN_VM_DEFAULT_MX, alc};
+        CHECK(m.reg(r10) == 0);
+    }
+}
+
+// Fills the memory at mem with bytes counting up from seed
+static void fillBytes(VM *vm, u32 mem, u32 size, u8 seed)
+{
+    for (u32 i = 0; i < size; i++)
+        vm->ram.base[mem + i] = (u8) (seed + i);
+}
+
+static bool checkBytes(VM *vm, u32 mem, u32 size, u8 seed)
+{
+    for (u32 i = 0; i < size; i++)
+        if (vm->ram.base[mem + i] != (u8) (seed + i))
+            return false;
+    return true;
+}
+
+TEST_CASE("Heap: realloc grows the block at the top of the heap in place")
+{
+    for (auto alc: allocators) {
+        CAPTURE(alc);
+        Machine m{haltProgram, Exec::Interpret, CYN_VM_DEFAULT_MS, CYN_VM_DEFAULT_MX, alc};
+        VM *vm = &m.vm;
+
+        u32 a = VM_alloc(vm, 64);
+        REQUIRE(a != 0);
+        fillBytes(vm, a, 64, 1);
+        CHECK(VM_realloc(vm, a, 4096) == a);
+        CHECK(checkBytes(vm, a, 64, 1));
+        CHECK(VM_alloc(vm, 16) >= a + 4096);
+    }
+}
+
+TEST_CASE("Heap: realloc merges a free next block")
+{
+    for (auto alc: allocators) {
+        CAPTURE(alc);
+        Machine m{haltProgram, Exec::Interpret, CYN_VM_DEFAULT_MS, CYN_VM_DEFAULT_MX, alc};
+        VM *vm = &m.vm;
+
+        u32 a = VM_alloc(vm, 64), b = VM_alloc(vm, 256), c = VM_alloc(vm, 64);
+        REQUIRE(a != 0);
+        REQUIRE(b != 0);
+        REQUIRE(c != 0);
+        fillBytes(vm, a, 64, 1);
+        fillBytes(vm, c, 64, 2);
+        CHECK(VM_free(vm, b));
+        CHECK(VM_realloc(vm, a, 200) == a);
+        CHECK(checkBytes(vm, a, 64, 1));
+        CHECK(checkBytes(vm, c, 64, 2));
+        // shrinking never moves the block
+        CHECK(VM_realloc(vm, a, 16) == a);
+        CHECK(checkBytes(vm, a, 16, 1));
+    }
+}
+
+TEST_CASE("Heap: realloc moves the block when it cannot grow in place")
+{
+    for (auto alc: allocators) {
+        CAPTURE(alc);
+        Machine m{haltProgram, Exec::Interpret, CYN_VM_DEFAULT_MS, CYN_VM_DEFAULT_MX, alc};
+        VM *vm = &m.vm;
+
+        u32 a = VM_alloc(vm, 64), b = VM_alloc(vm, 64);
+        REQUIRE(a != 0);
+        REQUIRE(b != 0);
+        fillBytes(vm, a, 64, 1);
+        fillBytes(vm, b, 64, 2);
+        u32 moved = VM_realloc(vm, a, 512);
+        REQUIRE(moved != 0);
+        CHECK(moved != a);
+        CHECK(checkBytes(vm, moved, 64, 1));
+        CHECK(checkBytes(vm, b, 64, 2));
+        // the old block was released
+        CHECK_FALSE(VM_free(vm, a));
+        CHECK(VM_alloc(vm, 32) == a);
+    }
+}
+
+TEST_CASE("Heap: realloc of a null or unknown address")
+{
+    for (auto alc: allocators) {
+        CAPTURE(alc);
+        Machine m{haltProgram, Exec::Interpret, CYN_VM_DEFAULT_MS, CYN_VM_DEFAULT_MX, alc};
+        VM *vm = &m.vm;
+
+        u32 a = VM_realloc(vm, 0, 64);
+        CHECK(a != 0);
+        CHECK(VM_realloc(vm, a + 8, 128) == 0);
+        CHECK(VM_free(vm, a));
+    }
+}
+
+TEST_CASE("Heap: ralloc grows a buffer while keeping its contents")
+{
+    // appends the bytes 1..1000 to a buffer doubling its capacity when full
+    checkAllExecs(R"(
+main:
+    mov r2 8
+    alloc r1 r2
+    mov r3 0
+append:
+    jltu r3 r2 store
+    sal r2 1
+    ralloc r1 r2
+    jeq r1 0 fail
+    inc r4
+store:
+    mov r5 r1
+    add r5 r3
+    inc r3
+    mov.b [r5] r3
+    jltu r3 1000 append
+    mov r6 0
+    mov r7 0
+sum:
+    mov r5 r1
+    add r5 r6
+    mov.b r8 [r5]
+    add r7 r8
+    inc r6
+    jltu r6 1000 sum
+    dlloc r1
+    halt
+fail:
+    mov r7 -1
+    halt
+)", [](const Machine& m) {
+        u64 sum = 0;
+        for (u32 i = 1; i <= 1000; i++)
+            sum += (u8) i;
+        CHECK(m.reg(r2) == 1024);
+        CHECK(m.reg(r4) == 7);
+        CHECK(m.reg(r7) == sum);
+    });
+}
@@ -0,0 +1,143 @@
+/**
+ * Copyright (c) 2022 Suilteam, Carter Mbotho
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the MIT license. See LICENSE for details.
+ *
+ * @author Carter
+ * @date 2022-12-27
+ */
+
+#include "vm.hpp"
+
+using namespace cyn::test;
+
+TEST_CASE("JIT: loops agree with the interpreter")
+{
+    checkAllExecs(R"(
+main:
+    mov r0 0
+    mov r1 0
+loop:
+    add r0 r1
+    inc r1
+    jlt r1 100000 loop
+    mov r2 0
+    mov r3 50
+count:
+    inc r2
+    djnz r3 count
+    halt
+)", [](const Machine& m) {
+        CHECK(m.reg(r0) == 4999950000);
+        CHECK(m.reg(r1) == 100000);
+        CHECK(m.reg(r2) == 50);
+    });
+}
+
+TEST_CASE("JIT: calls and the stack agree with the interpreter")
+{
+    // every frame keeps its depth on the stack and adds it when returning
+    checkAllExecs(R"(
+main:
+    mov r0 0
+    mov r1 0
+    push 0
+    call rec
+    pop r2
+    mov r3 sp
+    mov r4 bp
+    halt
+rec:
+    inc r1
+    push r1
+    jge r1 1000 done
+    push 0
+    call rec
+    pop r5
+done:
+    pop r4
+    add r0 r4
+    ret 0
+)", [](const Machine& m) {
+        CHECK(m.reg(r0) == 500500);
+        CHECK(m.reg(r1) == 1000);
+    });
+}
+
+TEST_CASE("JIT: narrow writes keep the upper bits of registers")
+{
+    checkAllExecs(R"(
+main:
+    mov r6 0
+loop:
+    mov r0 -1
+    mov.b r0 5
+    mov r1 -1
+    mov.s r1 r6
+    mov r2 -1
+    mov.w r2 7
+    mov r7 -1
+    mov.w r7 7
+    inc r6
+    jlt r6 100 loop
+    halt
+)", [](const Machine& m) {
+        CHECK(m.ireg(r0) == -251);
+        CHECK(m.ireg(r1) == -65536 + 99);
+        CHECK(m.ireg(r2) == -4294967289);
+        CHECK(m.ireg(r7) == -4294967289);
+    });
+}
+
+TEST_CASE("JIT: memory accesses through registers agree with the interpreter")
+{
+    checkAllExecs(R"(
+main:
+    alloc r0 800
+    mov r1 0
+    mov r2 r0
+fill:
+    mov [r2] r1
+    add r2 8
+    inc r1
+    jlt r1 100 fill
+    mov r1 0
+    mov r2 r0
+    mov r3 0
+sum:
+    add r3 [r2]
+    add r2 8
+    inc r1
+    jlt r1 100 sum
+    push r3
+    mov r4 [sp]
+    pop r5
+    dlloc r0
+    halt
+)", [](const Machine& m) {
+        CHECK(m.reg(r3) == 4950);
+        CHECK(m.reg(r4) == 4950);
+        CHECK(m.reg(r5) == 4950);
+    });
+}
+
+TEST_CASE("JIT: instructions run by the interpreter see the compiled registers")
+{
+    // floating point instructions are not compiled, they are stepped in the interpreter
+    checkAllExecs(R"(
+main:
+    mov r0 0
+    mov r1 0
+loop:
+    itof r2 r1
+    fadd r0 r2
+    inc r1
+    jlt r1 100 loop
+    ftoi r3 r0
+    halt
+)", [](const Machine& m) {
+        CHECK(m.freg(r0) == 4950.0);
+        CHECK(m.reg(r3) == 4950);
+    });
+}
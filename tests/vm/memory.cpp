@@ -0,0 +1,83 @@
+/**
+ * Copyright (c) 2022 Suilteam, Carter Mbotho
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the MIT license. See LICENSE for details.
+ *
+ * @author Carter
+ * @date 2022-12-27
+ */
+
+#include "vm.hpp"
+
+using namespace cyn::test;
+
+TEST_CASE("Memory: mset and mcpy write the number of bytes in r0")
+{
+    checkAllExecs(R"(
+$src = "hello world, hello!"
+main:
+    alloc r1 64
+    mov r0 64
+    mset r1 'x'
+    mov.b r2 [r1, 63]
+    mov r3 src
+    mov r0 19
+    mcpy r1 r3
+    mov.b r4 [r1, 18]
+    mov.b r5 [r1, 19]
+    mov r10 r1
+    add r10 1
+    mov r0 5
+    mcpy r10 r1
+    mov.b r11 [r1, 5]
+    mov.b r6 [r1, 6]
+    dlloc r1
+    halt
+)", [](const Machine& m) {
+        CHECK(m.reg(r2) == 'x');
+        CHECK(m.reg(r4) == '!');
+        CHECK(m.reg(r5) == 'x');
+        // overlapping copies move the bytes like memmove
+        CHECK(m.reg(r11) == 'o');
+        CHECK(m.reg(r6) == 'w');
+    });
+}
+
+TEST_CASE("Memory: mcmp sets the flags like cmp and mchr finds bytes")
+{
+    checkAllExecs(R"(
+$src = "hello world, hello!"
+main:
+    alloc r1 32
+    mov r3 src
+    mov r0 19
+    mcpy r1 r3
+    mcmp r1 r3
+    seteq r4
+    mov.b [r1] 'a'
+    mcmp r1 r3
+    setlt r5
+    mcmp r3 r1
+    setgt r6
+    mov r0 19
+    mchr r3 ','
+    mov r7 r0
+    mov r0 5
+    mchr r3 ','
+    mov r8 r0
+    mov r0 19
+    mchr r3 'h'
+    mov r9 r0
+    dlloc r1
+    halt
+)", [](const Machine& m) {
+        CHECK(m.reg(r4) == 1);
+        CHECK(m.reg(r5) == 1);
+        CHECK(m.reg(r6) == 1);
+        CHECK(m.reg(r7) == 11);
+        // the number of bytes scanned when the byte is not found
+        CHECK(m.reg(r8) == 5);
+        CHECK(m.reg(r9) == 0);
+    });
+}
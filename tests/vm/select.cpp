@@ -0,0 +1,100 @@
+/**
+ * Copyright (c) 2022 Suilteam, Carter Mbotho
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the MIT license. See LICENSE for details.
+ *
+ * @author Carter
+ * @date 2022-12-27
+ */
+
+#include "vm.hpp"
+
+using namespace cyn::test;
+
+TEST_CASE("Select: set<cc> writes the condition of the flags")
+{
+    checkAllExecs(R"(
+main:
+    mov r0 5
+    cmp r0 5
+    seteq r1
+    setne r2
+    setle r3
+    setge r4
+    setlt r5
+    setgt r6
+    cmp r0 9
+    setlt r7
+    setgt r8
+    mov r9 -1
+    setlt.b r9
+    halt
+)", [](const Machine& m) {
+        CHECK(m.reg(r1) == 1);
+        CHECK(m.reg(r2) == 0);
+        CHECK(m.reg(r3) == 1);
+        CHECK(m.reg(r4) == 1);
+        CHECK(m.reg(r5) == 0);
+        CHECK(m.reg(r6) == 0);
+        CHECK(m.reg(r7) == 1);
+        CHECK(m.reg(r8) == 0);
+        // narrow modes only write the low bits
+        CHECK(m.reg(r9) == 0xFFFFFFFFFFFFFF01);
+    });
+}
+
+TEST_CASE("Select: csel<cc> moves argument B only when the condition holds")
+{
+    // a running maximum and a clamped sum without branching
+    checkAllExecs(R"(
+main:
+    mov r1 0
+    mov r2 0
+    mov r3 0
+loop:
+    mov r5 r1
+    mul r5 7
+    mod r5 13
+    cmp r5 r3
+    cselgt r3 r5
+    mov r6 4
+    cmp r5 4
+    csellt r6 r5
+    add r2 r6
+    inc r1
+    jlt r1 100 loop
+    halt
+)", [](const Machine& m) {
+        u64 sum = 0;
+        for (u64 i = 0; i < 100; i++)
+            sum += ((i * 7) % 13 < 4)? (i * 7) % 13 : 4;
+        CHECK(m.reg(r3) == 12);
+        CHECK(m.reg(r2) == sum);
+    });
+}
+
+TEST_CASE("Select: set<cc> and csel<cc> on memory operands")
+{
+    checkAllExecs(R"(
+main:
+    alloc r1 16
+    mov [r1] 5
+    mov r2 9
+    cmp r2 3
+    setgt [r1]
+    mov r3 [r1]
+    mov r4 r1
+    add r4 8
+    mov [r4] 11
+    cselgt [r4] r2
+    mov r5 [r4]
+    cselne r2 [r1]
+    dlloc r1
+    halt
+)", [](const Machine& m) {
+        CHECK(m.reg(r3) == 1);
+        CHECK(m.reg(r5) == 9);
+        CHECK(m.reg(r2) == 1);
+    });
+}
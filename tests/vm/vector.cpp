@@ -0,0 +1,91 @@
+/**
+ * Copyright (c) 2022 Suilteam, Carter Mbotho
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the MIT license. See LICENSE for details.
+ *
+ * @author Carter
+ * @date 2022-12-27
+ */
+
+#include "vm.hpp"
+
+using namespace cyn::test;
+
+// Concatenated with the code of every test
+#define VECTOR_DATA                                                                                 \
+    "$data = {1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20,21,22,23,24,25,26,27,28,29,30,31,32}\n" \
+    "$rev = {15,14,13,12,11,10,9,8,7,6,5,4,3,2,1,0}\n"                                             \
+    "$out = [16]\n"
+
+TEST_CASE("Vector: loads, stores and lane-wise arithmetic")
+{
+    checkAllExecs(VECTOR_DATA R"(
+main:
+    mov r1 data
+    vld.b v0 [r1]
+    vld.b v1 [r1, 16]
+    vadd.b v0 v1
+    vred.b r0 v0
+    mov r3 out
+    vst.b v0 [r3]
+    mov.b r4 [r3, 15]
+    vld.w v3 [r1]
+    vmul.w v3 v3
+    vred.w r5 v3
+    vdup.q v5 10
+    vdup.q v6 4
+    vsub.q v5 v6
+    vred.q r6 v5
+    halt
+)", [](const Machine& m) {
+        u64 squares = 0;
+        for (u32 i = 0; i < 4; i++) {
+            u32 lane = (4 * i + 1) | (4 * i + 2) << 8 | (4 * i + 3) << 16 | (4 * i + 4) << 24;
+            squares += (u32) (lane * lane);
+        }
+        CHECK(m.reg(r0) == 528);
+        CHECK(m.reg(r4) == 48);
+        CHECK(m.reg(r5) == squares);
+        CHECK(m.reg(r6) == 12);
+    });
+}
+
+TEST_CASE("Vector: comparisons, bitwise operations and shuffles")
+{
+    checkAllExecs(VECTOR_DATA R"(
+main:
+    mov r1 data
+    vdup.b v2 3
+    vceq.b v2 [r1]
+    vred.b r0 v2
+    vld.b v3 [r1]
+    vdup.b v4 8
+    vcgt.b v3 v4
+    vred.b r2 v3
+    vld.b v3 [r1]
+    vdup.b v4 15
+    vand.b v3 v4
+    vred.b r3 v3
+    vor.b v3 v4
+    vred.b r4 v3
+    vxor.b v3 v3
+    vred.b r5 v3
+    vld.b v5 [r1]
+    mov r6 rev
+    vshuf.b v5 [r6]
+    mov r7 out
+    vst.b v5 [r7]
+    mov.b r8 [r7]
+    mov.b r9 [r7, 15]
+    halt
+)", [](const Machine& m) {
+        CHECK(m.reg(r0) == 255);
+        CHECK(m.reg(r2) == 8 * 255);
+        CHECK(m.reg(r3) == 120);
+        CHECK(m.reg(r4) == 16 * 15);
+        CHECK(m.reg(r5) == 0);
+        CHECK(m.reg(r8) == 16);
+        CHECK(m.reg(r9) == 1);
+    });
+}
@@ -0,0 +1,140 @@
+/**
+ * Copyright (c) 2022 Suilteam, Carter Mbotho
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the MIT license. See LICENSE for details.
+ *
+ * @author Carter
+ * @date 2022-12-27
+ */
+
+#pragma once
+
+#include <doctest.h>
+
+#include "compiler/asm/asm.h"
+#include "compiler/init.h"
+#include "compiler/common/log.h"
+#include "compiler/common/lexer.h"
+
+#include "vm/vm.h"
+#include "vm/jit.h"
+
+#include <cstring>
+
+namespace cyn::test {
+
+// How a test program is executed
+enum class Exec {
+    Interpret,
+    Jit,
+    JitLoops
+};
+
+static const Exec AllExecs[] = { Exec::Interpret, Exec::Jit, Exec::JitLoops };
+
+static const char *execName(Exec exec)
+{
+    switch (exec) {
+        case Exec::Jit: return "--jit";
+        case Exec::JitLoops: return "--jit-loops";
+        default: return "interpreter";
+    }
+}
+
+/**
+ * A virtual machine running an assembled test program, the machine is
+ * kept after the program halts so that its registers and memory can be
+ * checked.
+ */
+struct Machine {
+    Code code{};
+    VM vm{};
+
+    Machine(const char *source, Exec exec,
+            u64 ms = CYN_VM_DEFAULT_MS,
+            u64 mx = CYN_VM_DEFAULT_MX,
+            HeapAllocator alc = CYN_VM_HEAP_DEFAULT_ALLOCATOR,
+            u32 ss = CYN_VM_DEFAULT_SS)
+    {
+        static bool initialized = false;
+        Log L{};
+        Source src{};
+        Lexer lX{};
+        Assembler as{};
+
+        if (!initialized) {
+            Compiler_init_common();
+            initialized = true;
+        }
+        Log_init(&L);
+        Source_load(&src, "test.cas", source);
+        Lexer_init(&lX, &L, &src);
+        Assembler_init(&as, &lX);
+        Vector_init(&code);
+        Assembler_assemble(&as, &code);
+        Assembler_deinit(&as);
+        REQUIRE_MESSAGE(L.errors == 0, "assembling the test program failed");
+        REQUIRE(VM_verify(&code, Stderr));
+
+        VM_init_(&vm, &code, ms, mx, alc, CYN_VM_HEAP_DEFAULT_NHBS, ss);
+        // builds without the JIT interpret the program (\see CYN_VM_JIT)
+        if (exec == Exec::Jit && !VM_jit_compile(&vm))
+            MESSAGE("compiling to native code is not supported, interpreting");
+        else if (exec == Exec::JitLoops && !VM_jit_trace_init(&vm))
+            MESSAGE("compiling loops to native code is not supported, interpreting");
+        VM_run(&vm, 0, nullptr);
+    }
+
+    ~Machine()
+    {
+        VM_deinit(&vm);
+        Vector_deinit(&code);
+    }
+
+    u64 reg(Register r) const
+    {
+        return vm.regs[r];
+    }
+
+    i64 ireg(Register r) const
+    {
+        return (i64) vm.regs[r];
+    }
+
+    f64 freg(Register r) const
+    {
+        f64 f;
+        memcpy(&f, &vm.regs[r], sizeof(f));
+        return f;
+    }
+
+    const u8 *mem(u32 addr) const
+    {
+        return &vm.ram.base[addr];
+    }
+};
+
+/**
+ * Runs \param source with every way of executing code and checks that
+ * registers `r0`-`r11` agree with the interpreter, \param check is invoked
+ * with the machine run by the interpreter
+ */
+template <typename Check>
+static void checkAllExecs(const char *source, Check check)
+{
+    Machine interpreted{source, Exec::Interpret};
+    check(interpreted);
+
+    for (auto exec: AllExecs) {
+        if (exec == Exec::Interpret) continue;
+        CAPTURE(execName(exec));
+        Machine compiled{source, exec};
+        for (int r = r0; r <= r11; r++) {
+            CAPTURE(r);
+            CHECK(compiled.reg((Register) r) == interpreted.reg((Register) r));
+        }
+    }
+}
+
+}